@@ -0,0 +1,73 @@
+#include "asset_loader.h"
+
+#include <algorithm>
+
+asset_loader::asset_loader(int nr_of_threads) : _stop(false), _pending(0)
+  {
+  if (nr_of_threads <= 0)
+    nr_of_threads = std::max((int)std::thread::hardware_concurrency(), 1);
+  for (int i = 0; i < nr_of_threads; ++i)
+    _threads.emplace_back(&asset_loader::_worker, this);
+  }
+
+asset_loader::~asset_loader()
+  {
+    {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+    }
+  _cv.notify_all();
+  for (auto& t : _threads)
+    t.join();
+  }
+
+void asset_loader::add(std::function<void()> job, std::function<void()> done)
+  {
+    {
+    std::lock_guard<std::mutex> lock(_mutex);
+    task t;
+    t.job = std::move(job);
+    t.done = std::move(done);
+    _requests.push_back(std::move(t));
+    ++_pending;
+    }
+  _cv.notify_one();
+  }
+
+bool asset_loader::update()
+  {
+  std::vector<std::function<void()>> finished;
+    {
+    std::lock_guard<std::mutex> lock(_mutex);
+    finished.swap(_finished);
+    _pending -= (int)finished.size();
+    }
+  // outside the lock: the callbacks upload textures and may add new jobs
+  for (auto& done : finished)
+    {
+    if (done)
+      done();
+    }
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _pending == 0;
+  }
+
+void asset_loader::_worker()
+  {
+  for (;;)
+    {
+    task t;
+      {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cv.wait(lock, [this]() { return _stop || !_requests.empty(); });
+      if (_stop)
+        return;
+      t = std::move(_requests.front());
+      _requests.pop_front();
+      }
+    if (t.job)
+      t.job();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _finished.push_back(std::move(t.done));
+    }
+  }
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+namespace RenderDoos
+  {
+  class render_engine;
+  }
+
+// Baked texture file: a header, a table with a baked_texture_level entry for every face and mip level,
+// followed by the pixels of the levels, raw rgba8 or 4x4 blocks (block_compression.h). A 2D texture has 1 face,
+// a cubemap has 6 faces in the order front, back, left, right, top, bottom (as add_cubemap_texture).
+// Level 0 is the full resolution image, every next level halves the width and height, usually down to 1 x 1.
+// The table is ordered face by face, and by level within a face. Level data starts at 16 byte aligned offsets.
+// source_key identifies the images the texture was baked from (baked_texture_source_key), so a cache can tell
+// that its sources changed.
+struct baked_texture_header
+  {
+  char magic[4];
+  uint32_t version;
+  uint32_t format; // baked_texture_format
+  uint32_t width;
+  uint32_t height;
+  uint32_t faces;
+  uint32_t levels;
+  uint32_t source_key; // 0 when unknown
+  };
+
+enum baked_texture_format
+  {
+  baked_texture_format_rgba8 = 0,
+  baked_texture_format_bc1 = 1,
+  baked_texture_format_bc3 = 2,
+  baked_texture_format_bc5 = 3
+  };
+
+// hash of the names, sizes and modification times of the files, 0 when none of them exists
+uint32_t baked_texture_source_key(const std::vector<std::string>& filenames);
+
+// bytes of a level of w x h texels
+uint64_t baked_texture_level_size(uint32_t format, uint32_t w, uint32_t h);
+
+struct baked_texture_level
+  {
+  uint32_t width;
+  uint32_t height;
+  uint64_t offset; // from the start of the file
+  uint64_t size;
+  };
+
+// channels a format keeps, counted from red: 4 for rgba8 and bc3, 3 for bc1 (alpha decodes as 255),
+// 2 for bc5 (blue decodes as 0, alpha as 255)
+int baked_texture_channels(uint32_t format);
+
+// Writes a baked texture from rgba8 texels: texels[f * levels + l] holds level l of face f, the levels halve
+// width x height as in the file, but the chain may stop before 1 x 1. Block compressed formats are encoded here,
+// bc1 and bc5 are written as bc3 when a texel is not opaque, so alpha is never lost (the header holds the format
+// that was written). psnr is as for bake_texture.
+bool write_baked_texture(const std::string& filename, const std::vector<std::vector<uint32_t>>& texels, uint32_t width, uint32_t height, uint32_t faces, baked_texture_format format = baked_texture_format_rgba8, double* psnr = nullptr, uint32_t source_key = 0);
+
+// Bakes 1 image (2D texture) or 6 images (cubemap faces of equal size) with their mip chains.
+// For block compressed formats psnr receives the peak signal to noise ratio (in dB) of the decoded level 0
+// of all faces against the source images, over all four channels, as the levels are decoded to rgba8 at load.
+// Block compression only makes the file smaller: RenderDoos has no compressed texture formats, so a baked level
+// uses as much gpu memory and bandwidth as rgba8, after a lossy encode and a decode on the cpu at load.
+// The source key of the images is stored in the header.
+bool bake_texture(const std::vector<std::string>& image_filenames, const std::string& filename, baked_texture_format format = baked_texture_format_rgba8, double* psnr = nullptr);
+
+// Memory mapped baked texture file.
+class baked_texture
+  {
+  public:
+    baked_texture();
+
+    bool open(const std::string& filename);
+    void close();
+
+    const baked_texture_header& header() const { return _header; }
+    const baked_texture_level& level(int face, int level) const;
+    const uint8_t* level_data(int face, int level) const;
+
+  private:
+    mapped_file _file;
+    baked_texture_header _header;
+    std::vector<baked_texture_level> _levels;
+  };
+
+// One level of a baked texture in rgba8, ready for add_texture or add_cubemap_texture.
+struct baked_texture_upload
+  {
+  uint32_t width;
+  uint32_t height;
+  uint32_t faces;
+  const uint8_t* data[6]; // into the mapped file, or into decoded for block compressed levels
+  std::vector<uint32_t> decoded[6];
+  };
+
+// Decodes the level if needed, without touching the render engine, so it can run on a loader thread.
+// The texture must stay open until the upload is done.
+bool prepare_baked_texture(baked_texture_upload& upload, const baked_texture& texture, int level);
+
+int32_t add_baked_texture(RenderDoos::render_engine* engine, const baked_texture_upload& upload);
+
+// Creates a texture (or cubemap) from mip level first_level of the baked texture, straight from the mapped file.
+// RenderDoos textures have a single level, so a coarser first_level trades resolution for memory and upload time.
+// RenderDoos has no compressed texture formats either: block compressed levels are decoded to rgba8 first,
+// so they only save disk space and read time. Returns -1 on failure.
+int32_t add_baked_texture(RenderDoos::render_engine* engine, const baked_texture& texture, int first_level = 0);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Block compression of rgba8 images (4x4 texel blocks, as in the BCn texture formats):
+// BC1: rgb, 8 bytes per block: two 565 endpoints and 2 bit indices into 4 interpolated colors.
+// BC3: rgba, 16 bytes per block: a BC4 block for alpha followed by a BC1 block for rgb.
+// BC5: red and green, 16 bytes per block: a BC4 block per channel (normal maps, z is reconstructed).
+// A BC4 block holds two 8 bit endpoints and 3 bit indices into 8 interpolated values.
+// Blocks are stored in row major order; images that are not a multiple of 4 pad their border blocks
+// by repeating the last row and column.
+enum block_format
+  {
+  block_format_bc1,
+  block_format_bc3,
+  block_format_bc5
+  };
+
+size_t block_compressed_size(block_format format, int w, int h);
+
+// rgba holds w x h texels with red in the lowest byte; the blocks are encoded on all hardware threads
+void block_compress(uint8_t* blocks, const uint32_t* rgba, int w, int h, block_format format);
+
+// Reference decoder of the block formats, BC1 and BC5 decode with an alpha of 255 and BC5 with a blue of 0.
+void block_decompress(uint32_t* rgba, const uint8_t* blocks, int w, int h, block_format format);
@@ -11,6 +11,8 @@ struct VertexIn {
 struct CubeMaterialUniforms {
   float4x4 projection_matrix;
   float4x4 camera_matrix;
+  int environment_map;
+  float exposure; // 0 for display colors, see cube_material::set_exposure
 };
 
 struct VertexOut {
@@ -26,6 +28,32 @@ vertex VertexOut cube_material_vertex_shader(const device VertexIn *vertices [[b
   return out;
 }
 
+// full screen triangle with the clip space corners in the positions, just in front of the far plane (see cube_material::set_skybox)
+vertex VertexOut skybox_material_vertex_shader(const device VertexIn *vertices [[buffer(0)]], uint vertexId [[vertex_id]], constant CubeMaterialUniforms& input [[buffer(10)]]) {
+  VertexOut out;
+  float2 corner = float3(vertices[vertexId].position).xy;
+  float4x4 p = input.projection_matrix;
+  float z = 1.0 / p[2][3];
+  float3 viewdir = float3((corner.x - p[2][0] * z) / p[0][0], (corner.y - p[2][1] * z) / p[1][1], z);
+  float3x3 rotation = float3x3(input.camera_matrix[0].xyz, input.camera_matrix[1].xyz, input.camera_matrix[2].xyz);
+  out.localpos = transpose(rotation) * viewdir;
+  out.position = float4(corner, 0.99999, 1.0);
+  return out;
+}
+
+float3 linear_to_srgb(float3 c) {
+  c = clamp(c, 0.0, 1.0);
+  return mix(c*12.92, 1.055*pow(c, float3(1.0/2.4)) - 0.055, step(float3(0.0031308), c));
+}
+
+// Narkowicz's fit of the ACES filmic curve
+float3 tonemap(float3 x) {
+  return (x*(2.51*x + 0.03)) / (x*(2.43*x + 0.59) + 0.14);
+}
+
 fragment float4 cube_material_fragment_shader(const VertexOut vertexIn [[stage_in]], texturecube<float> texture [[texture(0)]], sampler cubesampler [[sampler(0)]], constant CubeMaterialUniforms& input [[buffer(10)]]) {
-  return texture.sample(cubesampler, vertexIn.localpos);
+  float4 color = texture.sample(cubesampler, vertexIn.localpos);
+  if (input.exposure > 0.0)
+    color.rgb = linear_to_srgb(tonemap(color.rgb*input.exposure));
+  return color;
 }
@@ -0,0 +1,399 @@
+#include "cubemap_filter.h"
+#include "image.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+  {
+  const float pi = 3.14159265358979f;
+
+  struct ggx_sample
+    {
+    float x, y, z; // direction of the sample in the tangent frame of the normal (z)
+    float weight; // n dot l
+    float mip; // level of the mip chain that matches the solid angle of the sample
+    };
+
+  // inverse of cube_face_direction, s and t in [0, 1]
+  int direction_face(float& s, float& t, const float* d)
+    {
+    const float ax = std::abs(d[0]);
+    const float ay = std::abs(d[1]);
+    const float az = std::abs(d[2]);
+    int face;
+    float sc, tc, ma;
+    if (ax >= ay && ax >= az)
+      {
+      face = d[0] >= 0.f ? 0 : 1;
+      sc = d[0] >= 0.f ? -d[2] : d[2];
+      tc = -d[1];
+      ma = ax;
+      }
+    else if (ay >= az)
+      {
+      face = d[1] >= 0.f ? 2 : 3;
+      sc = d[0];
+      tc = d[1] >= 0.f ? d[2] : -d[2];
+      ma = ay;
+      }
+    else
+      {
+      face = d[2] >= 0.f ? 4 : 5;
+      sc = d[2] >= 0.f ? d[0] : -d[0];
+      tc = -d[1];
+      ma = az;
+      }
+    s = 0.5f * (sc / ma + 1.f);
+    t = 0.5f * (tc / ma + 1.f);
+    return face;
+    }
+
+  float texel_coordinate(int i, int size)
+    {
+    return 2.f * ((float)i + 0.5f) / (float)size - 1.f;
+    }
+
+  // proportional to the solid angle of a texel around (sc, tc)
+  float solid_angle_weight(float sc, float tc)
+    {
+    const float r = 1.f + sc * sc + tc * tc;
+    return 1.f / (r * std::sqrt(r));
+    }
+
+  void bilinear(float* result, const cubemap_level& level, int face, float s, float t)
+    {
+    const int n = level.size;
+    const float px = s * (float)n - 0.5f;
+    const float py = t * (float)n - 0.5f;
+    const float fx = std::floor(px);
+    const float fy = std::floor(py);
+    const float tx = px - fx;
+    const float ty = py - fy;
+    const int x0 = std::min(std::max((int)fx, 0), n - 1);
+    const int y0 = std::min(std::max((int)fy, 0), n - 1);
+    const int x1 = std::min(x0 + 1, n - 1);
+    const int y1 = std::min(y0 + 1, n - 1);
+    const float* im = level.faces[face].data();
+    const float* p00 = im + 4 * ((size_t)y0 * n + x0);
+    const float* p10 = im + 4 * ((size_t)y0 * n + x1);
+    const float* p01 = im + 4 * ((size_t)y1 * n + x0);
+    const float* p11 = im + 4 * ((size_t)y1 * n + x1);
+    for (int c = 0; c < 4; ++c)
+      {
+      const float a = p00[c] + (p10[c] - p00[c]) * tx;
+      const float b = p01[c] + (p11[c] - p01[c]) * tx;
+      result[c] = a + (b - a) * ty;
+      }
+    }
+
+  // trilinear lookup of direction d in the chain
+  void sample_chain(float* result, const std::vector<cubemap_level>& chain, const float* d, float mip)
+    {
+    float s, t;
+    const int face = direction_face(s, t, d);
+    mip = std::min(std::max(mip, 0.f), (float)(chain.size() - 1));
+    const int m0 = (int)mip;
+    const int m1 = std::min(m0 + 1, (int)chain.size() - 1);
+    const float f = mip - (float)m0;
+    bilinear(result, chain[m0], face, s, t);
+    if (f > 0.f && m1 != m0)
+      {
+      float coarse[4];
+      bilinear(coarse, chain[m1], face, s, t);
+      for (int c = 0; c < 4; ++c)
+        result[c] += (coarse[c] - result[c]) * f;
+      }
+    }
+
+  // the texel on the other side of the edge of face at side (-1 or 1) of s (horizontal) or t
+  const float* across_edge(const cubemap_level& level, int face, int x, int y, bool horizontal, float side)
+    {
+    const int n = level.size;
+    // just past the shared edge, so the texel is found on the neighbouring face
+    const float edge = side * 1.001f;
+    float d[3];
+    if (horizontal)
+      cube_face_direction(d, face, edge, texel_coordinate(y, n));
+    else
+      cube_face_direction(d, face, texel_coordinate(x, n), edge);
+    float s, t;
+    const int neighbour = direction_face(s, t, d);
+    const int nx = std::min(std::max((int)(s * (float)n), 0), n - 1);
+    const int ny = std::min(std::max((int)(t * (float)n), 0), n - 1);
+    return level.faces[neighbour].data() + 4 * ((size_t)ny * n + nx);
+    }
+
+  // Averages every edge texel with its neighbours across the seams. Both texels of a seam (or the three texels of
+  // a corner) average the same set, so they end up equal.
+  void fix_edges(cubemap_level& level)
+    {
+    const int n = level.size;
+    cubemap_level source = level;
+    for (int face = 0; face < 6; ++face)
+      {
+      for (int y = 0; y < n; ++y)
+        {
+        // only the first and last texel of the rows in between lie on an edge
+        const int step = (y == 0 || y == n - 1) ? 1 : n - 1;
+        for (int x = 0; x < n; x += step)
+          {
+          float sum[4];
+          const float* p = source.faces[face].data() + 4 * ((size_t)y * n + x);
+          std::copy(p, p + 4, sum);
+          int count = 1;
+          const float* q[4];
+          int neighbours = 0;
+          if (x == 0)
+            q[neighbours++] = across_edge(source, face, x, y, true, -1.f);
+          if (x == n - 1)
+            q[neighbours++] = across_edge(source, face, x, y, true, 1.f);
+          if (y == 0)
+            q[neighbours++] = across_edge(source, face, x, y, false, -1.f);
+          if (y == n - 1)
+            q[neighbours++] = across_edge(source, face, x, y, false, 1.f);
+          for (int i = 0; i < neighbours; ++i)
+            {
+            for (int c = 0; c < 4; ++c)
+              sum[c] += q[i][c];
+            ++count;
+            }
+          float* out = level.faces[face].data() + 4 * ((size_t)y * n + x);
+          for (int c = 0; c < 4; ++c)
+            out[c] = sum[c] / (float)count;
+          }
+        }
+      }
+    }
+
+  void downsample(cubemap_level& coarse, const cubemap_level& fine)
+    {
+    const int n = std::max(fine.size / 2, 1);
+    coarse.size = n;
+    for (int face = 0; face < 6; ++face)
+      coarse.faces[face].resize((size_t)n * n * 4);
+    parallel_for(0, 6 * n, [&](int row)
+      {
+      const int face = row / n;
+      const int y = row % n;
+      const float* im = fine.faces[face].data();
+      float* out = coarse.faces[face].data() + (size_t)y * n * 4;
+      for (int x = 0; x < n; ++x)
+        {
+        float sum[4] = { 0.f, 0.f, 0.f, 0.f };
+        float total = 0.f;
+        for (int j = 0; j < 2; ++j)
+          {
+          const int fy = std::min(2 * y + j, fine.size - 1);
+          for (int i = 0; i < 2; ++i)
+            {
+            const int fx = std::min(2 * x + i, fine.size - 1);
+            const float w = solid_angle_weight(texel_coordinate(fx, fine.size), texel_coordinate(fy, fine.size));
+            const float* p = im + 4 * ((size_t)fy * fine.size + fx);
+            for (int c = 0; c < 4; ++c)
+              sum[c] += p[c] * w;
+            total += w;
+            }
+          }
+        for (int c = 0; c < 4; ++c)
+          out[4 * x + c] = sum[c] / total;
+        }
+      });
+    }
+
+  float radical_inverse(uint32_t bits)
+    {
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return (float)bits * 2.3283064365386963e-10f;
+    }
+
+  // Importance samples of the GGX distribution around the normal, with the view direction equal to the normal.
+  // The sample pattern is the same for every texel, only the tangent frame changes.
+  void make_ggx_samples(std::vector<ggx_sample>& samples, float roughness, int sample_count, int chain_size)
+    {
+    const float a = roughness * roughness;
+    const float texel_solid_angle = 4.f * pi / (6.f * (float)chain_size * (float)chain_size);
+    samples.clear();
+    for (int i = 0; i < sample_count; ++i)
+      {
+      const float phi = 2.f * pi * (float)i / (float)sample_count;
+      const float e = radical_inverse((uint32_t)i);
+      const float cos_theta = std::sqrt((1.f - e) / (1.f + (a * a - 1.f) * e));
+      const float sin_theta = std::sqrt(std::max(1.f - cos_theta * cos_theta, 0.f));
+      const float hx = sin_theta * std::cos(phi);
+      const float hy = sin_theta * std::sin(phi);
+      const float hz = cos_theta;
+      ggx_sample s;
+      // reflect the normal around the half vector
+      s.x = 2.f * hz * hx;
+      s.y = 2.f * hz * hy;
+      s.z = 2.f * hz * hz - 1.f;
+      s.weight = s.z;
+      if (s.weight <= 0.f)
+        continue;
+      // pdf of l is D(h) (n.h) / (4 (v.h)), with v = n
+      const float denominator = hz * hz * (a * a - 1.f) + 1.f;
+      const float distribution = a * a / (pi * denominator * denominator);
+      const float pdf = distribution / 4.f;
+      const float sample_solid_angle = 1.f / ((float)sample_count * pdf + 1e-6f);
+      s.mip = roughness == 0.f ? 0.f : 0.5f * std::log2(sample_solid_angle / texel_solid_angle) + 1.f;
+      samples.push_back(s);
+      }
+    }
+  }
+
+void cube_face_direction(float* d, int face, float sc, float tc)
+  {
+  switch (face)
+    {
+    case 0: d[0] = 1.f; d[1] = -tc; d[2] = -sc; break;
+    case 1: d[0] = -1.f; d[1] = -tc; d[2] = sc; break;
+    case 2: d[0] = sc; d[1] = 1.f; d[2] = tc; break;
+    case 3: d[0] = sc; d[1] = -1.f; d[2] = -tc; break;
+    case 4: d[0] = sc; d[1] = -tc; d[2] = 1.f; break;
+    default: d[0] = -sc; d[1] = -tc; d[2] = -1.f; break;
+    }
+  }
+
+void make_cubemap_mip_chain(std::vector<cubemap_level>& chain, const rgba_image* faces)
+  {
+  chain.resize(1);
+  const int n = faces[0].w;
+  chain[0].size = n;
+  for (int face = 0; face < 6; ++face)
+    {
+    std::vector<float>& out = chain[0].faces[face];
+    out.resize((size_t)n * n * 4);
+    for (size_t i = 0; i < (size_t)n * n; ++i)
+      {
+      const uint32_t p = faces[face].im[i];
+      out[4 * i + 0] = srgb_to_linear((uint8_t)p);
+      out[4 * i + 1] = srgb_to_linear((uint8_t)(p >> 8));
+      out[4 * i + 2] = srgb_to_linear((uint8_t)(p >> 16));
+      out[4 * i + 3] = (float)(p >> 24) / 255.f;
+      }
+    }
+  while (chain.back().size > 1)
+    {
+    cubemap_level coarse;
+    downsample(coarse, chain.back());
+    fix_edges(coarse);
+    chain.push_back(coarse);
+    }
+  }
+
+void make_ggx_prefiltered_chain(std::vector<cubemap_level>& prefiltered, const std::vector<cubemap_level>& chain, int base_size, int sample_count)
+  {
+  prefiltered.clear();
+  if (chain.empty())
+    return;
+  size_t first = 0;
+  while (first + 1 < chain.size() && chain[first].size > base_size)
+    ++first;
+  const int levels = (int)(chain.size() - first);
+  prefiltered.resize(levels);
+  std::vector<ggx_sample> samples;
+  for (int l = 0; l < levels; ++l)
+    {
+    cubemap_level& level = prefiltered[l];
+    const int n = chain[first + l].size;
+    level.size = n;
+    if (l == 0)
+      {
+      // roughness 0 reflects the environment itself
+      level = chain[first];
+      continue;
+      }
+    const float roughness = (float)l / (float)(levels - 1);
+    make_ggx_samples(samples, roughness, sample_count, chain[0].size);
+    for (int face = 0; face < 6; ++face)
+      level.faces[face].resize((size_t)n * n * 4);
+    parallel_for(0, 6 * n, [&](int row)
+      {
+      const int face = row / n;
+      const int y = row % n;
+      float* out = level.faces[face].data() + (size_t)y * n * 4;
+      for (int x = 0; x < n; ++x)
+        {
+        float normal[3];
+        cube_face_direction(normal, face, texel_coordinate(x, n), texel_coordinate(y, n));
+        const float inv_len = 1.f / std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        for (int c = 0; c < 3; ++c)
+          normal[c] *= inv_len;
+        // tangent frame around the normal
+        const float up[3] = { std::abs(normal[2]) < 0.999f ? 0.f : 1.f, 0.f, std::abs(normal[2]) < 0.999f ? 1.f : 0.f };
+        float tangent[3] = { up[1] * normal[2] - up[2] * normal[1], up[2] * normal[0] - up[0] * normal[2], up[0] * normal[1] - up[1] * normal[0] };
+        const float inv_tangent_len = 1.f / std::sqrt(tangent[0] * tangent[0] + tangent[1] * tangent[1] + tangent[2] * tangent[2]);
+        for (int c = 0; c < 3; ++c)
+          tangent[c] *= inv_tangent_len;
+        const float bitangent[3] = { normal[1] * tangent[2] - normal[2] * tangent[1], normal[2] * tangent[0] - normal[0] * tangent[2], normal[0] * tangent[1] - normal[1] * tangent[0] };
+        float sum[4] = { 0.f, 0.f, 0.f, 0.f };
+        float total = 0.f;
+        for (const auto& s : samples)
+          {
+          float d[3], color[4];
+          for (int c = 0; c < 3; ++c)
+            d[c] = tangent[c] * s.x + bitangent[c] * s.y + normal[c] * s.z;
+          sample_chain(color, chain, d, s.mip);
+          for (int c = 0; c < 4; ++c)
+            sum[c] += color[c] * s.weight;
+          total += s.weight;
+          }
+        for (int c = 0; c < 4; ++c)
+          out[4 * x + c] = total > 0.f ? sum[c] / total : 0.f;
+        }
+      });
+    fix_edges(level);
+    }
+  }
+
+void cubemap_chain_to_texels(std::vector<std::vector<uint32_t>>& texels, const std::vector<cubemap_level>& chain)
+  {
+  const size_t levels = chain.size();
+  texels.resize(6 * levels);
+  for (int face = 0; face < 6; ++face)
+    {
+    for (size_t l = 0; l < levels; ++l)
+      {
+      const std::vector<float>& im = chain[l].faces[face];
+      std::vector<uint32_t>& out = texels[face * levels + l];
+      out.resize(im.size() / 4);
+      for (size_t i = 0; i < out.size(); ++i)
+        {
+        const uint32_t alpha = (uint32_t)(std::min(std::max(im[4 * i + 3], 0.f), 1.f) * 255.f + 0.5f);
+        out[i] = (uint32_t)linear_to_srgb(im[4 * i]) | ((uint32_t)linear_to_srgb(im[4 * i + 1]) << 8) | ((uint32_t)linear_to_srgb(im[4 * i + 2]) << 16) | (alpha << 24);
+        }
+      }
+    }
+  }
+
+std::string ggx_filename(const std::string& filename)
+  {
+  const std::string extension(".tex");
+  if (filename.size() >= extension.size() && filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0)
+    return filename.substr(0, filename.size() - extension.size()) + "_ggx" + extension;
+  return filename + "_ggx";
+  }
+
+bool bake_cubemap(const rgba_image* faces, const std::string& filename, baked_texture_format format, double* psnr, uint32_t source_key)
+  {
+  for (int face = 0; face < 6; ++face)
+    {
+    if (!faces[face].im || faces[face].w != faces[face].h || faces[face].w != faces[0].w)
+      return false;
+    }
+  std::vector<cubemap_level> chain, prefiltered;
+  std::vector<std::vector<uint32_t>> texels;
+  make_cubemap_mip_chain(chain, faces);
+  cubemap_chain_to_texels(texels, chain);
+  if (!write_baked_texture(filename, texels, (uint32_t)chain[0].size, (uint32_t)chain[0].size, 6, format, psnr, source_key))
+    return false;
+  make_ggx_prefiltered_chain(prefiltered, chain);
+  cubemap_chain_to_texels(texels, prefiltered);
+  return write_baked_texture(ggx_filename(filename), texels, (uint32_t)prefiltered[0].size, (uint32_t)prefiltered[0].size, 6, baked_texture_format_rgba8, nullptr, source_key);
+  }
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "baked_texture.h"
+
+struct rgba_image;
+
+// Cubemap filtering on the CPU. The faces are in the order of add_cubemap_texture (front, back, left, right,
+// top, bottom), which RenderDoos uploads as the cube faces +x, -x, +y, -y, +z, -z. Texel directions follow
+// the OpenGL cube map convention for these faces. Filtering is done on linear colors: the 8 bit texels are
+// sRGB encoded and decoded before, and encoded again after filtering.
+struct cubemap_level
+  {
+  int size; // width and height of every face
+  std::vector<float> faces[6]; // linear rgba, 4 floats per texel
+  };
+
+// direction through the point (sc, tc) in [-1, 1] x [-1, 1] of a face, (-1, -1) is the first texel of the face
+void cube_face_direction(float* d, int face, float sc, float tc);
+
+// Mip chain down to 1 x 1 from six square faces of equal size. Every level is a 2x2 box filter of the previous
+// one, weighted by the solid angle of the texels. Afterwards the texels on the edges of a face are averaged
+// with the texels on the other side of the seam (three texels at a corner), so bilinear filtering of a level
+// shows no seams between the faces. At 1 x 1 every face is averaged with its four neighbours.
+void make_cubemap_mip_chain(std::vector<cubemap_level>& chain, const rgba_image* faces);
+
+// Environment map prefiltered with the GGX distribution for image based lighting (split sum approximation).
+// Level l has size base_size >> l and roughness l / (levels - 1), so level 0 is the sharp environment and the
+// last level the roughest. Each texel integrates sample_count importance sampled directions, and each sample
+// reads the mip chain at the level that matches its solid angle, which removes the noise of few samples.
+// base_size is clamped to the size of chain[0]; rows of texels are spread over all hardware threads.
+void make_ggx_prefiltered_chain(std::vector<cubemap_level>& prefiltered, const std::vector<cubemap_level>& chain, int base_size = 128, int sample_count = 64);
+
+// rgba8 texels of the chain in the layout of write_baked_texture
+void cubemap_chain_to_texels(std::vector<std::vector<uint32_t>>& texels, const std::vector<cubemap_level>& chain);
+
+// the name of the prefiltered cache next to a baked cubemap: assets/cubemap.tex -> assets/cubemap_ggx.tex
+std::string ggx_filename(const std::string& filename);
+
+// Writes the mip chain of the faces to filename, and its GGX prefiltered chain in rgba8 to ggx_filename(filename).
+// psnr is as for bake_texture, source_key (baked_texture_source_key of the files of the faces) goes in both headers.
+bool bake_cubemap(const rgba_image* faces, const std::string& filename, baked_texture_format format = baked_texture_format_rgba8, double* psnr = nullptr, uint32_t source_key = 0);
@@ -0,0 +1,126 @@
+#include "equirectangular.h"
+#include "cubemap_filter.h"
+#include "image.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+  {
+  const float pi = 3.14159265358979f;
+  const int batch = 8;
+  const int tile_size = 32;
+
+  inline int wrap(int v, int n)
+    {
+    return (v >= 0 && v < n) ? v : ((v % n) + n) % n;
+    }
+
+  // one row of a tile: texels [x0, x1) of row y of the face
+  void resample_row(float* out, const rgbaf_image& panorama, int face, int face_size, int y, int x0, int x1)
+    {
+    const float fw = (float)panorama.w;
+    const float fh = (float)panorama.h;
+    const float tc = 2.f * ((float)y + 0.5f) / (float)face_size - 1.f;
+    float dx[batch], dy[batch], dz[batch], px[batch], py[batch], tx[batch], ty[batch];
+    int ix[batch], iy[batch];
+    float c00[4 * batch], c10[4 * batch], c01[4 * batch], c11[4 * batch];
+    for (int first = x0; first < x1; first += batch)
+      {
+      const int count = std::min(batch, x1 - first);
+      for (int i = 0; i < batch; ++i)
+        {
+        // tail entries repeat the last texel, so the loops below keep their fixed length
+        const int x = first + std::min(i, count - 1);
+        float d[3];
+        cube_face_direction(d, face, 2.f * ((float)x + 0.5f) / (float)face_size - 1.f, tc);
+        dx[i] = d[0];
+        dy[i] = d[1];
+        dz[i] = d[2];
+        }
+      for (int i = 0; i < batch; ++i)
+        {
+        const float inv_len = 1.f / std::sqrt(dx[i] * dx[i] + dy[i] * dy[i] + dz[i] * dz[i]);
+        dy[i] = std::min(std::max(dy[i] * inv_len, -1.f), 1.f);
+        }
+      for (int i = 0; i < batch; ++i)
+        {
+        px[i] = (std::atan2(dz[i], dx[i]) / (2.f * pi) + 0.5f) * fw - 0.5f;
+        py[i] = (0.5f - std::asin(dy[i]) / pi) * fh - 0.5f;
+        }
+      for (int i = 0; i < batch; ++i)
+        {
+        const float fx = std::floor(px[i]);
+        const float fy = std::floor(py[i]);
+        tx[i] = px[i] - fx;
+        ty[i] = py[i] - fy;
+        ix[i] = (int)fx;
+        iy[i] = (int)fy;
+        }
+      for (int i = 0; i < batch; ++i)
+        {
+        const int u0 = wrap(ix[i], panorama.w);
+        const int u1 = u0 + 1 == panorama.w ? 0 : u0 + 1;
+        const float* row0 = panorama.im + (size_t)std::min(std::max(iy[i], 0), panorama.h - 1) * panorama.w * 4;
+        const float* row1 = panorama.im + (size_t)std::min(std::max(iy[i] + 1, 0), panorama.h - 1) * panorama.w * 4;
+        for (int c = 0; c < 4; ++c)
+          {
+          c00[c * batch + i] = row0[4 * u0 + c];
+          c10[c * batch + i] = row0[4 * u1 + c];
+          c01[c * batch + i] = row1[4 * u0 + c];
+          c11[c * batch + i] = row1[4 * u1 + c];
+          }
+        }
+      for (int c = 0; c < 4; ++c)
+        {
+        for (int i = 0; i < batch; ++i)
+          {
+          const float a = c00[c * batch + i] + (c10[c * batch + i] - c00[c * batch + i]) * tx[i];
+          const float b = c01[c * batch + i] + (c11[c * batch + i] - c01[c * batch + i]) * tx[i];
+          c00[c * batch + i] = a + (b - a) * ty[i];
+          }
+        }
+      for (int i = 0; i < count; ++i)
+        {
+        for (int c = 0; c < 4; ++c)
+          out[4 * (first + i) + c] = c00[c * batch + i];
+        }
+      }
+    }
+  }
+
+void equirectangular_to_cubemap(rgbaf_image* faces, const rgbaf_image& panorama, int face_size)
+  {
+  for (int face = 0; face < 6; ++face)
+    faces[face].allocate(face_size, face_size);
+  if (panorama.im == nullptr || panorama.w <= 0 || panorama.h <= 0)
+    {
+    for (int face = 0; face < 6; ++face)
+      std::fill(faces[face].im, faces[face].im + (size_t)face_size * face_size * 4, 0.f);
+    return;
+    }
+  const int tiles = (face_size + tile_size - 1) / tile_size;
+  parallel_for(0, 6 * tiles * tiles, [&](int index)
+    {
+    const int face = index / (tiles * tiles);
+    const int tile_y = (index / tiles) % tiles;
+    const int tile_x = index % tiles;
+    const int x0 = tile_x * tile_size;
+    const int x1 = std::min(x0 + tile_size, face_size);
+    const int y1 = std::min((tile_y + 1) * tile_size, face_size);
+    for (int y = tile_y * tile_size; y < y1; ++y)
+      resample_row(faces[face].im + (size_t)y * face_size * 4, panorama, face, face_size, y, x0, x1);
+    });
+  }
+
+void encode_rgba8(rgba_image& result, const rgbaf_image& image)
+  {
+  result.allocate(image.w, image.h);
+  for (size_t i = 0; i < (size_t)image.w * image.h; ++i)
+    {
+    const float alpha = std::min(std::max(image.im[4 * i + 3], 0.f), 1.f);
+    result.im[i] = (uint32_t)linear_to_srgb(image.im[4 * i]) | ((uint32_t)linear_to_srgb(image.im[4 * i + 1]) << 8) |
+      ((uint32_t)linear_to_srgb(image.im[4 * i + 2]) << 16) | ((uint32_t)(alpha * 255.f + 0.5f) << 24);
+    }
+  }
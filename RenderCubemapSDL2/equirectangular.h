@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+struct rgba_image;
+struct rgbaf_image;
+
+// Resamples an equirectangular panorama (longitude along x, the top row looks straight up) into six square cubemap
+// faces of face_size texels, in the face order and orientation of cubemap_filter.h, ready for add_cubemap_texture.
+// The faces are split in tiles that are spread over all hardware threads. Within a tile the texels are processed in
+// fixed size batches of plain loops that the compiler can vectorize; only the texel gathers and the inverse
+// trigonometry are scalar. Filtering is bilinear, wrapping around in longitude and clamped at the poles.
+void equirectangular_to_cubemap(rgbaf_image* faces, const rgbaf_image& panorama, int face_size);
+
+// Encodes linear colors with linear_to_srgb (image.h), the inverse of the decoding of 8 bit images, values above 1 are clipped.
+void encode_rgba8(rgba_image& result, const rgbaf_image& image);
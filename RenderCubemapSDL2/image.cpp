@@ -3,25 +3,126 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "../stb/stb_image.h"
 
-rgba_image::rgba_image() : im(nullptr)
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace
+  {
+  template <class TImage>
+  void release(TImage& image)
+    {
+    if (image.decoder_owned)
+      stbi_image_free(image.im);
+    else
+      delete [] image.im;
+    image.im = nullptr;
+    image.decoder_owned = false;
+    }
+
+  std::vector<float> make_srgb_table()
+    {
+    std::vector<float> table(256);
+    for (int i = 0; i < 256; ++i)
+      {
+      const float v = (float)i / 255.f;
+      table[i] = v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+      }
+    return table;
+    }
+  }
+
+float srgb_to_linear(uint8_t c)
+  {
+  static const std::vector<float> table = make_srgb_table();
+  return table[c];
+  }
+
+uint8_t linear_to_srgb(float v)
+  {
+  v = std::min(std::max(v, 0.f), 1.f);
+  v = v <= 0.0031308f ? v * 12.92f : 1.055f * std::pow(v, 1.f / 2.4f) - 0.055f;
+  return (uint8_t)(v * 255.f + 0.5f);
+  }
+
+rgba_image::rgba_image() : w(0), h(0), im(nullptr), decoder_owned(false)
   {
   }
 
 rgba_image::~rgba_image()
-  {  
-  delete [] im;
+  {
+  release(*this);
+  }
+
+void rgba_image::allocate(int width, int height)
+  {
+  release(*this);
+  w = width;
+  h = height;
+  im = new uint32_t[(size_t)width * height];
   }
 
 bool read_image_from_file(rgba_image& rgba, const std::string& filename)
   {
+  mapped_file file(filename);
+  if (file.data() == nullptr)
+    return false;
   int imw, imh, nr_of_channels;
-  unsigned char* im = stbi_load(filename.c_str(), &imw, &imh, &nr_of_channels, 4);
+  unsigned char* im = stbi_load_from_memory(file.data(), (int)file.size(), &imw, &imh, &nr_of_channels, 4);
   if (im == nullptr)
     return false;
+  release(rgba);
   rgba.w = imw;
   rgba.h = imh;
-  rgba.im = new uint32_t[imw * imh];
-  memcpy(rgba.im, im, imw * imh * 4);  
-  stbi_image_free(im);
+  rgba.im = (uint32_t*)im;
+  rgba.decoder_owned = true;
   return true;
-  }
\ No newline at end of file
+  }
+
+rgbaf_image::rgbaf_image() : w(0), h(0), im(nullptr), decoder_owned(false)
+  {
+  }
+
+rgbaf_image::~rgbaf_image()
+  {
+  release(*this);
+  }
+
+void rgbaf_image::allocate(int width, int height)
+  {
+  release(*this);
+  w = width;
+  h = height;
+  im = new float[(size_t)width * height * 4];
+  }
+
+bool read_hdr_image_from_file(rgbaf_image& rgba, const std::string& filename)
+  {
+  mapped_file file(filename);
+  if (file.data() == nullptr)
+    return false;
+  int imw, imh, nr_of_channels;
+  if (!stbi_is_hdr_from_memory(file.data(), (int)file.size()))
+    {
+    // stb would make 8 bit images linear with a gamma of 2.2
+    unsigned char* im = stbi_load_from_memory(file.data(), (int)file.size(), &imw, &imh, &nr_of_channels, 4);
+    if (im == nullptr)
+      return false;
+    rgba.allocate(imw, imh);
+    for (size_t i = 0; i < (size_t)imw * imh * 4; ++i)
+      rgba.im[i] = (i & 3) == 3 ? (float)im[i] / 255.f : srgb_to_linear(im[i]);
+    stbi_image_free(im);
+    return true;
+    }
+  float* im = stbi_loadf_from_memory(file.data(), (int)file.size(), &imw, &imh, &nr_of_channels, 4);
+  if (im == nullptr)
+    return false;
+  release(rgba);
+  rgba.w = imw;
+  rgba.h = imh;
+  rgba.im = im;
+  rgba.decoder_owned = true;
+  return true;
+  }
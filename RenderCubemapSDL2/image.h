@@ -7,9 +7,35 @@ struct rgba_image
   rgba_image();
   ~rgba_image();
 
+  // replaces the pixels by an uninitialized buffer of w x h texels
+  void allocate(int width, int height);
+
   int w, h;
   uint32_t* im;
+  bool decoder_owned; // im is the buffer of the image decoder, it is released with stbi_image_free
+  };
+
+// The file is memory mapped and decoded from the mapping, the image takes over the buffer of the decoder without a copy.
+bool read_image_from_file(rgba_image& rgba, const std::string& filename);
+
+// linear float rgba, e.g. decoded from a Radiance .hdr panorama
+struct rgbaf_image
+  {
+  rgbaf_image();
+  ~rgbaf_image();
+
+  // replaces the pixels by an uninitialized buffer of w x h texels
+  void allocate(int width, int height);
+
+  int w, h;
+  float* im; // 4 floats per texel
+  bool decoder_owned;
   };
 
+// Reads .hdr files as they are; the colors of 8 bit formats are made linear with srgb_to_linear, alpha is kept.
+bool read_hdr_image_from_file(rgbaf_image& rgba, const std::string& filename);
 
-bool read_image_from_file(rgba_image& rgba, const std::string& filename);
\ No newline at end of file
+// The exact sRGB transfer function, the one conversion between 8 bit and linear colors in this demo.
+float srgb_to_linear(uint8_t c);
+// clamps to [0, 1] before encoding
+uint8_t linear_to_srgb(float v);
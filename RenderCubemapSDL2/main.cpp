@@ -5,10 +5,13 @@
 #include "SDL.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <iostream>
 #include <thread>
 #include <chrono>
+#include <algorithm>
+#include <functional>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -29,8 +32,13 @@
 #endif
 
 #include "RenderDoos/render_engine.h"
+#include "asset_loader.h"
+#include "baked_texture.h"
+#include "cubemap_filter.h"
+#include "equirectangular.h"
 #include "material.h"
 #include "image.h"
+#include "program_cache.h"
 #include "RenderDoos/types.h"
 
 #include <iostream>
@@ -77,6 +85,75 @@ int _main(int argc, char** argv)
   {
   SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_VERBOSE);
 
+  const char* face_filenames[6] = { "assets/front.jpg", "assets/back.jpg", "assets/left.jpg", "assets/right.jpg", "assets/top.jpg", "assets/bottom.jpg" };
+  const uint32_t faces_key = baked_texture_source_key(std::vector<std::string>(face_filenames, face_filenames + 6));
+  // RenderCubemapSDL2 --bake-cubemap <out.tex> [rgba8|bc1]
+  // writes the mip chain to out.tex and the GGX prefiltered levels to out_ggx.tex. bc1 only makes the file smaller:
+  // the levels are decoded to rgba8 on the cpu at load, so they use as much gpu memory and bandwidth as rgba8.
+  for (int i = 1; i < argc; ++i)
+    {
+    if (strcmp(argv[i], "--bake-cubemap") == 0 && i + 1 < argc)
+      {
+      const baked_texture_format format = (i + 2 < argc && strcmp(argv[i + 2], "bc1") == 0) ? baked_texture_format_bc1 : baked_texture_format_rgba8;
+      double psnr = 0.0;
+      rgba_image faces[6];
+      bool faces_read = true;
+      for (int f = 0; f < 6; ++f)
+        faces_read = faces_read && read_image_from_file(faces[f], face_filenames[f]);
+      if (!faces_read || !bake_cubemap(faces, argv[i + 1], format, &psnr, faces_key))
+        {
+        std::cout << "Could not bake the cubemap\n";
+        return 1;
+        }
+      if (format != baked_texture_format_rgba8)
+        std::cout << "PSNR " << psnr << " dB (rgba), the cubemap is decoded to rgba8 at load and uses as much gpu memory as rgba8\n";
+      return 0;
+      }
+    }
+  // RenderCubemapSDL2 --bake-panorama <panorama> <out.tex> [face size]
+  // resamples an equirectangular panorama (.hdr or 8 bit) into faces and bakes them as --bake-cubemap does.
+  // As assets/cubemap.tex it is only used without the face images, otherwise those replace it (see below).
+  for (int i = 1; i < argc; ++i)
+    {
+    if (strcmp(argv[i], "--bake-panorama") == 0 && i + 2 < argc)
+      {
+      rgbaf_image panorama;
+      if (!read_hdr_image_from_file(panorama, argv[i + 1]))
+        {
+        std::cout << "Could not read " << argv[i + 1] << "\n";
+        return 1;
+        }
+      const int face_size = i + 3 < argc ? atoi(argv[i + 3]) : panorama.w / 4;
+      rgbaf_image panorama_faces[6];
+      equirectangular_to_cubemap(panorama_faces, panorama, std::max(face_size, 1));
+      rgba_image faces[6];
+      for (int f = 0; f < 6; ++f)
+        encode_rgba8(faces[f], panorama_faces[f]);
+      if (!bake_cubemap(faces, argv[i + 2], baked_texture_format_rgba8, nullptr, baked_texture_source_key({ argv[i + 1] })))
+        {
+        std::cout << "Could not bake the cubemap\n";
+        return 1;
+        }
+      return 0;
+      }
+    }
+  // RenderCubemapSDL2 --panorama <panorama> [face size] [exposure]
+  // resamples the panorama at load time and uploads the float faces, so .hdr keeps its range; nothing is cached.
+  // The faces hold linear radiance, cube_material exposes, tone maps and sRGB encodes them (exposure 1 by default).
+  const char* panorama_filename = nullptr;
+  int panorama_face_size = 0;
+  float panorama_exposure = 1.f;
+  for (int i = 1; i < argc; ++i)
+    {
+    if (strcmp(argv[i], "--panorama") == 0 && i + 1 < argc)
+      {
+      panorama_filename = argv[i + 1];
+      panorama_face_size = i + 2 < argc ? atoi(argv[i + 2]) : 0;
+      if (i + 3 < argc && atof(argv[i + 3]) > 0.0)
+        panorama_exposure = (float)atof(argv[i + 3]);
+      }
+    }
+
   uint32_t w = 800;
   uint32_t h = 450;
   RenderDoos::render_engine engine;
@@ -134,6 +211,9 @@ int _main(int argc, char** argv)
   engine.init(nullptr, nullptr, RenderDoos::renderer_type::OPENGL);
 #endif 
 
+  // linked OpenGL programs are kept in assets/program_*.bin, so the next start skips compiling the shaders
+  set_program_cache_folder("assets");
+
   mouse_data md;
   md.mouse_x = 0.f;
   md.mouse_y = 0.f;
@@ -148,96 +228,165 @@ int _main(int argc, char** argv)
   mv_props.zoom_y = 1.f * h / w;
   mv_props.light_dir = RenderDoos::normalize(RenderDoos::float4(0.2f, 0.3f, 0.4f, 0.f));
 
-  rgba_image front, back, left, right, top, bottom;
-  if (!read_image_from_file(front, "assets/front.jpg")
-    || !read_image_from_file(back, "assets/back.jpg")
-    || !read_image_from_file(left, "assets/left.jpg")
-    || !read_image_from_file(right, "assets/right.jpg")
-    || !read_image_from_file(top, "assets/top.jpg")
-    || !read_image_from_file(bottom, "assets/bottom.jpg")
-    )
-    {
-    std::cout << "Could not read asset\n";
-    exit(1);
-    }
-  
-  uint32_t texture_id = engine.add_cubemap_texture(front.w, front.h, RenderDoos::texture_format_rgba8,
-    (const uint8_t*)front.im,
-    (const uint8_t*)back.im,
-    (const uint8_t*)left.im,
-    (const uint8_t*)right.im,
-    (const uint8_t*)top.im,
-    (const uint8_t*)bottom.im
-    );
-
   cube_material cube_mat;
-  cube_mat.set_cubemap(texture_id, TEX_WRAP_REPEAT | TEX_FILTER_LINEAR);
   cube_mat.compile(&engine);
-  uint32_t geometry_id = engine.add_geometry(VERTEX_STANDARD);  
+
+  // assets/cubemap.tex caches the mip chain of the cubemap and assets/cubemap_ggx.tex its GGX prefiltered levels
+  // (cubemap_filter.h). When the cache is there the cubemap is uploaded straight from the mapped file.
+  // The caches hold the source key of the faces they were made from, a cache of other faces (or of older files)
+  // is made again. Without the face images the caches are all there is, and are used as they are.
+  // Otherwise the six faces are decoded in parallel while the window already presents frames.
+  // The cubemap is created from all faces at once, so it is made when the last face is decoded,
+  // after which the cache is computed on the loader, so that happens only once.
+  const std::string cubemap_cache("assets/cubemap.tex");
+  baked_texture prefiltered; // key r shows the prefiltered levels, as the environment seen by rougher surfaces
+  int prefiltered_level = 0; // 0 shows the environment itself
+  int32_t prefiltered_id = -1;
+  auto open_cache = [&](baked_texture& cache, const std::string& filename)
+    {
+    if (cache.open(filename) && cache.header().faces == 6 && (faces_key == 0 || cache.header().source_key == faces_key))
+      return true;
+    cache.close();
+    return false;
+    };
+  auto open_prefiltered = [&]()
+    {
+    open_cache(prefiltered, ggx_filename(cubemap_cache));
+    };
+  bool cache_written = false;
+  rgba_image faces[6];
+  rgbaf_image panorama_faces[6];
+  bool face_read[6] = { false, false, false, false, false, false };
+  int faces_left = 6;
+  int32_t texture_id = -1;
+  asset_loader loader;
+  const auto load_start = std::chrono::high_resolution_clock::now();
+  baked_texture baked_cubemap;
+  const uint32_t preview_size = 64;
+  baked_texture_upload refined;
+  std::function<void(int)> refine;
+  if (panorama_filename)
+    {
+    loader.add([&]()
+      {
+      rgbaf_image panorama;
+      face_read[0] = read_hdr_image_from_file(panorama, panorama_filename);
+      equirectangular_to_cubemap(panorama_faces, panorama, panorama_face_size > 0 ? panorama_face_size : std::max(panorama.w / 4, 1));
+      }, [&]()
+      {
+      if (!face_read[0])
+        {
+        std::cout << "Could not read " << panorama_filename << "\n";
+        exit(1);
+        }
+      texture_id = engine.add_cubemap_texture(panorama_faces[0].w, panorama_faces[0].h, RenderDoos::texture_format_rgba32f,
+        (const uint8_t*)panorama_faces[0].im,
+        (const uint8_t*)panorama_faces[1].im,
+        (const uint8_t*)panorama_faces[2].im,
+        (const uint8_t*)panorama_faces[3].im,
+        (const uint8_t*)panorama_faces[4].im,
+        (const uint8_t*)panorama_faces[5].im
+        );
+      cube_mat.set_cubemap(texture_id, TEX_WRAP_REPEAT | TEX_FILTER_LINEAR);
+      cube_mat.set_exposure(panorama_exposure);
+      std::cout << "panorama loaded in " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - load_start).count() << " ms\n";
+      });
+    }
+  else if (open_cache(baked_cubemap, cubemap_cache))
+    {
+    // A small level of the cached chain is uploaded right away as a preview. Every finer level is then decoded on
+    // the loader and replaces the cubemap on the render thread when it arrives, up to the full resolution.
+    int level = 0;
+    while (level + 1 < (int)baked_cubemap.header().levels && baked_cubemap.level(0, level).width > preview_size)
+      ++level;
+    texture_id = add_baked_texture(&engine, baked_cubemap, level);
+    open_prefiltered();
+    cube_mat.set_cubemap(texture_id, TEX_WRAP_REPEAT | TEX_FILTER_LINEAR);
+    std::cout << "cubemap preview " << baked_cubemap.level(0, level).width << " loaded in " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - load_start).count() << " ms\n";
+    refine = [&](int finer)
+      {
+      loader.add([&, finer]()
+        {
+        prepare_baked_texture(refined, baked_cubemap, finer);
+        }, [&, finer]()
+        {
+        engine.remove_texture(texture_id);
+        texture_id = add_baked_texture(&engine, refined);
+        refined = baked_texture_upload();
+        if (prefiltered_level == 0)
+          cube_mat.set_cubemap(texture_id, TEX_WRAP_REPEAT | TEX_FILTER_LINEAR);
+        std::cout << "cubemap " << baked_cubemap.level(0, finer).width << " loaded in " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - load_start).count() << " ms\n";
+        if (finer > 0)
+          refine(finer - 1);
+        else
+          baked_cubemap.close();
+        });
+      };
+    if (level > 0)
+      refine(level - 1);
+    else
+      baked_cubemap.close();
+    }
+  for (int i = 0; i < 6 && texture_id < 0 && !panorama_filename; ++i)
+    {
+    loader.add([&, i]()
+      {
+      face_read[i] = read_image_from_file(faces[i], face_filenames[i]);
+      }, [&, i]()
+      {
+      if (!face_read[i])
+        {
+        std::cout << "Could not read asset\n";
+        exit(1);
+        }
+      if (--faces_left > 0)
+        return;
+      texture_id = engine.add_cubemap_texture(faces[0].w, faces[0].h, RenderDoos::texture_format_rgba8,
+        (const uint8_t*)faces[0].im,
+        (const uint8_t*)faces[1].im,
+        (const uint8_t*)faces[2].im,
+        (const uint8_t*)faces[3].im,
+        (const uint8_t*)faces[4].im,
+        (const uint8_t*)faces[5].im
+        );
+      cube_mat.set_cubemap(texture_id, TEX_WRAP_REPEAT | TEX_FILTER_LINEAR);
+      std::cout << "cubemap loaded in " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - load_start).count() << " ms\n";
+      const auto filter_start = std::chrono::high_resolution_clock::now();
+      loader.add([&]()
+        {
+        cache_written = bake_cubemap(faces, cubemap_cache, baked_texture_format_rgba8, nullptr, faces_key);
+        }, [&, filter_start]()
+        {
+        if (!cache_written)
+          {
+          std::cout << "Could not write " << cubemap_cache << "\n";
+          return;
+          }
+        open_prefiltered();
+        std::cout << "cubemap mip chain and prefiltered levels cached in " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - filter_start).count() << " ms\n";
+        });
+      });
+    }
+  // the sky is a single full screen triangle with its clip space corners as positions (cube_material::set_skybox)
+  cube_mat.set_skybox(true);
+  uint32_t geometry_id = engine.add_geometry(VERTEX_STANDARD);
 
   RenderDoos::vertex_standard* vp;
   uint32_t* ip;
 
-  engine.geometry_begin(geometry_id, 36, 36, (float**)&vp, (void**)&ip);
-  // drawing
-  float vertices[] = {
-    // back face
-    -1.0f, -1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 0.0f, // bottom-left
-     1.0f,  1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 1.0f, 1.0f, // top-right
-     1.0f, -1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 1.0f, 0.0f, // bottom-right         
-     1.0f,  1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 1.0f, 1.0f, // top-right
-    -1.0f, -1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 0.0f, // bottom-left
-    -1.0f,  1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 1.0f, // top-left
-    // front face
-    -1.0f, -1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 0.0f, // bottom-left
-     1.0f, -1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 0.0f, // bottom-right
-     1.0f,  1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 1.0f, // top-right
-     1.0f,  1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 1.0f, // top-right
-    -1.0f,  1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 1.0f, // top-left
-    -1.0f, -1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 0.0f, // bottom-left
-    // left face
-    -1.0f,  1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-right
-    -1.0f,  1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 1.0f, // top-left
-    -1.0f, -1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-left
-    -1.0f, -1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-left
-    -1.0f, -1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 0.0f, // bottom-right
-    -1.0f,  1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-right
-    // right face
-     1.0f,  1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-left
-     1.0f, -1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-right
-     1.0f,  1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 1.0f, // top-right         
-     1.0f, -1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-right
-     1.0f,  1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-left
-     1.0f, -1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 0.0f, // bottom-left     
-    // bottom face
-    -1.0f, -1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 1.0f, // top-right
-     1.0f, -1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 1.0f, // top-left
-     1.0f, -1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 0.0f, // bottom-left
-     1.0f, -1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 0.0f, // bottom-left
-    -1.0f, -1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 0.0f, // bottom-right
-    -1.0f, -1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 1.0f, // top-right
-    // top face
-    -1.0f,  1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 1.0f, // top-left
-     1.0f,  1.0f , 1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 0.0f, // bottom-right
-     1.0f,  1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 1.0f, // top-right     
-     1.0f,  1.0f,  1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 0.0f, // bottom-right
-    -1.0f,  1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 1.0f, // top-left
-    -1.0f,  1.0f,  1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 0.0f  // bottom-left        
-    };
-  for (int ii = 0; ii < 36; ii++)
+  engine.geometry_begin(geometry_id, 3, 3, (float**)&vp, (void**)&ip);
+  const float corners[] = { -1.f, -1.f, 3.f, -1.f, -1.f, 3.f };
+  for (int ii = 0; ii < 3; ii++)
     {
-    vp->x = vertices[ii * 8 + 0];
-    vp->y = vertices[ii * 8 + 1];
-    vp->z = vertices[ii * 8 + 2];
-    vp->nx = vertices[ii * 8 + 3];
-    vp->ny = vertices[ii * 8 + 4];
-    vp->nz = vertices[ii * 8 + 5];
-    vp->u = vertices[ii * 8 + 6];
-    vp->v = vertices[ii * 8 + 7];
+    vp->x = corners[ii * 2 + 0];
+    vp->y = corners[ii * 2 + 1];
+    vp->z = 1.f;
+    vp->nx = 0.f;
+    vp->ny = 0.f;
+    vp->nz = 1.f;
+    vp->u = 0.f;
+    vp->v = 0.f;
     vp++;
-    }
-  for (int ii = 0; ii < 36; ii++)
-    {
     ip[ii] = ii;
     }
 
@@ -266,6 +415,19 @@ int _main(int argc, char** argv)
           quit = true;
           break;
           }
+          case SDLK_r:
+          {
+          if (texture_id < 0 || prefiltered.header().levels < 2)
+            break;
+          // next roughness, after the roughest level back to the environment
+          prefiltered_level = prefiltered_level + 1 < (int)prefiltered.header().levels ? prefiltered_level + 1 : 0;
+          if (prefiltered_id >= 0)
+            engine.remove_texture(prefiltered_id);
+          prefiltered_id = prefiltered_level > 0 ? add_baked_texture(&engine, prefiltered, prefiltered_level) : -1;
+          cube_mat.set_cubemap(prefiltered_id >= 0 ? prefiltered_id : texture_id, TEX_WRAP_REPEAT | TEX_FILTER_LINEAR);
+          std::cout << "roughness " << (float)prefiltered_level / (float)(prefiltered.header().levels - 1) << "\n";
+          break;
+          }
           }
         }
         case SDL_MOUSEMOTION:
@@ -349,6 +511,7 @@ int _main(int argc, char** argv)
     drawables.metal_drawable = (void*)drawable.drawable;
     drawables.metal_screen_texture = (void*)drawable.texture;
 #endif
+    loader.update();
     engine.frame_begin(drawables);
 
     RenderDoos::renderpass_descriptor descr;
@@ -359,8 +522,12 @@ int _main(int argc, char** argv)
     engine.renderpass_begin(descr);
 
     engine.set_model_view_properties(mv_props);
-    cube_mat.bind(&engine);
-    engine.geometry_draw(geometry_id);
+    // opaque geometry goes here, the sky is drawn last so only the pixels it does not cover are shaded
+    if (texture_id >= 0)
+      {
+      cube_mat.bind(&engine);
+      engine.geometry_draw(geometry_id);
+      }
 
     engine.renderpass_end();
     engine.frame_end();
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+// Read only memory mapping of a whole file. data() is nullptr when the file could not be mapped.
+class mapped_file
+  {
+  public:
+    mapped_file();
+    explicit mapped_file(const std::string& filename);
+    ~mapped_file();
+
+    bool open(const std::string& filename);
+    void close();
+
+    const unsigned char* data() const { return _data; }
+    size_t size() const { return _size; }
+
+  private:
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator = (const mapped_file&) = delete;
+
+  private:
+    const unsigned char* _data;
+    size_t _size;
+#ifdef _WIN32
+    void* _file; // HANDLE
+    void* _mapping;
+#endif
+  };
@@ -1,4 +1,5 @@
 #include "material.h"
+#include "program_cache.h"
 #include "RenderDoos/types.h"
 #include "RenderDoos/render_context.h"
 #include "RenderDoos/render_engine.h"
@@ -34,28 +35,68 @@ in vec3 localPos;
   
 uniform samplerCube environmentMap;
 //uniform sampler2D environmentMap;
+uniform float Exposure; // 0 for display colors, see cube_material::set_exposure
+
+vec3 linearToSrgb(vec3 c)
+{
+    c = clamp(c, 0.0, 1.0);
+    return mix(c*12.92, 1.055*pow(c, vec3(1.0/2.4)) - 0.055, step(vec3(0.0031308), c));
+}
+
+// Narkowicz's fit of the ACES filmic curve
+vec3 tonemap(vec3 x)
+{
+    return (x*(2.51*x + 0.03)) / (x*(2.43*x + 0.59) + 0.14);
+}
   
 void main()
 {
     vec3 envColor = texture(environmentMap, localPos).rgb;
-    
-    //envColor = envColor / (envColor + vec3(1.0));
-    //envColor = pow(envColor, vec3(1.0/2.2)); 
+    if (Exposure > 0.0)
+        envColor = linearToSrgb(tonemap(envColor*Exposure));
   
     FragColor = vec4(envColor, 1.0);
 }
 )");
   }
 
+static std::string get_skybox_material_vertex_shader()
+  {
+  return std::string(R"(#version 330 core
+layout (location = 0) in vec3 vPosition;
+
+uniform mat4 Projection; // columns
+uniform mat4 Camera; // columns
+
+out vec3 localPos;
+
+void main()
+{
+    // view space direction through this corner for a perspective projection, the eye looks along w = 1
+    float z = 1.0 / Projection[2][3];
+    vec3 viewDir = vec3((vPosition.x - Projection[2][0] * z) / Projection[0][0], (vPosition.y - Projection[2][1] * z) / Projection[1][1], z);
+    localPos = transpose(mat3(Camera)) * viewDir; // rotate back to world space
+    // just in front of the far plane, so the sky also passes a less (not only a less-equal) test against the cleared depth
+    gl_Position = vec4(vPosition.xy, 0.99999, 1.0);
+}
+)");
+  }
+
 cube_material::cube_material()
   {
   vs_handle = -1;
   fs_handle = -1;
   shader_program_handle = -1;
+  skybox_vs_handle = -1;
+  skybox_fs_handle = -1;
+  skybox_program_handle = -1;
+  skybox = false;
+  exposure = 0.f;
   tex_handle = -1;
   projection_handle = -1;
   cam_handle = -1;
   tex0_handle = -1;
+  exposure_handle = -1;
   }
 
 cube_material::~cube_material()
@@ -71,15 +112,29 @@ void cube_material::set_cubemap(int32_t handle, int32_t flags)
   texture_flags = flags;
   }
 
+void cube_material::set_skybox(bool enable)
+  {
+  skybox = enable;
+  }
+
+void cube_material::set_exposure(float e)
+  {
+  exposure = e;
+  }
+
 void cube_material::destroy(RenderDoos::render_engine* engine)
   {
   engine->remove_program(shader_program_handle);
   engine->remove_shader(vs_handle);
   engine->remove_shader(fs_handle);
+  engine->remove_program(skybox_program_handle);
+  engine->remove_shader(skybox_vs_handle);
+  engine->remove_shader(skybox_fs_handle);
   engine->remove_texture(tex_handle);
   engine->remove_uniform(projection_handle);
   engine->remove_uniform(cam_handle);
   engine->remove_uniform(tex0_handle);
+  engine->remove_uniform(exposure_handle);
   }
 
 void cube_material::compile(RenderDoos::render_engine* engine)
@@ -89,30 +144,37 @@ void cube_material::compile(RenderDoos::render_engine* engine)
     {
     vs_handle = engine->add_shader(nullptr, SHADER_VERTEX, "cube_material_vertex_shader");
     fs_handle = engine->add_shader(nullptr, SHADER_FRAGMENT, "cube_material_fragment_shader");
+    skybox_vs_handle = engine->add_shader(nullptr, SHADER_VERTEX, "skybox_material_vertex_shader");
+    skybox_fs_handle = engine->add_shader(nullptr, SHADER_FRAGMENT, "cube_material_fragment_shader");
+    shader_program_handle = engine->add_program(vs_handle, fs_handle);
+    skybox_program_handle = engine->add_program(skybox_vs_handle, skybox_fs_handle);
     }
   else if (engine->get_renderer_type() == renderer_type::OPENGL)
     {
-    vs_handle = engine->add_shader(get_cubemap_material_vertex_shader().c_str(), SHADER_VERTEX, nullptr);
-    fs_handle = engine->add_shader(get_cubemap_material_fragment_shader().c_str(), SHADER_FRAGMENT, nullptr);
+    shader_program_handle = add_cached_program(engine, vs_handle, fs_handle, get_cubemap_material_vertex_shader(), get_cubemap_material_fragment_shader());
+    skybox_program_handle = add_cached_program(engine, skybox_vs_handle, skybox_fs_handle, get_skybox_material_vertex_shader(), get_cubemap_material_fragment_shader());
     }
-  shader_program_handle = engine->add_program(vs_handle, fs_handle);
   projection_handle = engine->add_uniform("Projection", uniform_type::mat4, 1);
   cam_handle = engine->add_uniform("Camera", uniform_type::mat4, 1);
   tex0_handle = engine->add_uniform("environmentMap", uniform_type::sampler, 1);
+  exposure_handle = engine->add_uniform("Exposure", uniform_type::scalar, 1);
   }
 
 void cube_material::bind(RenderDoos::render_engine* engine)
   {
-  engine->bind_program(shader_program_handle);
+  const int32_t program = skybox ? skybox_program_handle : shader_program_handle;
+  engine->bind_program(program);
 
   engine->set_uniform(projection_handle, (void*)&engine->get_projection());
   engine->set_uniform(cam_handle, (void*)&engine->get_camera_space());
   int32_t tex_0 = 0;
   engine->set_uniform(tex0_handle, (void*)&tex_0);
+  engine->set_uniform(exposure_handle, (void*)&exposure);
 
-  engine->bind_uniform(shader_program_handle, projection_handle);
-  engine->bind_uniform(shader_program_handle, cam_handle);
-  engine->bind_uniform(shader_program_handle, tex0_handle);
+  engine->bind_uniform(program, projection_handle);
+  engine->bind_uniform(program, cam_handle);
+  engine->bind_uniform(program, tex0_handle);
+  engine->bind_uniform(program, exposure_handle);
   //const RenderDoos::texture* tex = engine->get_texture(tex_handle);  
   engine->bind_texture_to_channel(tex_handle, 0, texture_flags);  
   }
\ No newline at end of file
@@ -9,6 +9,14 @@ class cube_material : public RenderDoos::material
     virtual ~cube_material();
 
     void set_cubemap(int32_t handle, int32_t flags);
+    // Skybox mode draws a single full screen triangle just in front of the far plane instead of the cube,
+    // so it is drawn after the opaque geometry and the depth test leaves only the visible sky pixels to shade.
+    // The geometry to draw holds the clip space corners (-1, -1), (3, -1) and (-1, 3) of the triangle as positions.
+    void set_skybox(bool enable);
+    // 0 (the default) for a cubemap with display colors, as the sRGB encoded 8 bit faces. A positive exposure is for
+    // a cubemap with linear radiance, e.g. the float faces of an .hdr panorama: the colors are scaled by the
+    // exposure, tone mapped (ACES fit) and sRGB encoded.
+    void set_exposure(float exposure);
 
     virtual void compile(RenderDoos::render_engine* engine);
     virtual void bind(RenderDoos::render_engine* engine);
@@ -17,7 +25,11 @@ class cube_material : public RenderDoos::material
   private:
     int32_t vs_handle, fs_handle;
     int32_t shader_program_handle;
+    int32_t skybox_vs_handle, skybox_fs_handle;
+    int32_t skybox_program_handle;
+    bool skybox;
+    float exposure;
     int32_t tex_handle;    
     int32_t texture_flags;
-    int32_t projection_handle, cam_handle, tex0_handle; // uniforms
+    int32_t projection_handle, cam_handle, tex0_handle, exposure_handle; // uniforms
   };
\ No newline at end of file
@@ -31,6 +31,7 @@
 #include "RenderDoos/render_engine.h"
 #include "RenderDoos/material.h"
 #include "material.h"
+#include "program_cache.h"
 
 #include "RenderDoos/types.h"
 
@@ -121,6 +122,9 @@ int _main(int argc, char** argv)
 
   engine.init(nullptr, nullptr, RenderDoos::renderer_type::OPENGL);
 #endif 
+
+  // linked OpenGL programs are kept in data/program_*.bin, so the next start skips compiling the shaders
+  set_program_cache_folder("data");
   RenderDoos::model_view_properties mv_props;
   mv_props.init(w, h);
   mv_props.orthogonal = 1;
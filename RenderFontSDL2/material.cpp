@@ -2,6 +2,7 @@
 #include "RenderDoos/types.h"
 #include "RenderDoos/render_context.h"
 #include "RenderDoos/render_engine.h"
+#include "program_cache.h"
 
 #include <vector>
 
@@ -175,13 +176,12 @@ void font_material::compile(RenderDoos::render_engine* engine)
     {
     vs_handle = engine->add_shader(nullptr, SHADER_VERTEX, "font_material_vertex_shader");
     fs_handle = engine->add_shader(nullptr, SHADER_FRAGMENT, "font_material_fragment_shader");
+    shader_program_handle = engine->add_program(vs_handle, fs_handle);
     }
   else if (engine->get_renderer_type() == RenderDoos::renderer_type::OPENGL)
     {
-    vs_handle = engine->add_shader(get_font_material_vertex_shader().c_str(), SHADER_VERTEX, nullptr);
-    fs_handle = engine->add_shader(get_font_material_fragment_shader().c_str(), SHADER_FRAGMENT, nullptr);
+    shader_program_handle = add_cached_program(engine, vs_handle, fs_handle, get_font_material_vertex_shader(), get_font_material_fragment_shader());
     }
-  shader_program_handle = engine->add_program(vs_handle, fs_handle);
   width_handle = engine->add_uniform("width", RenderDoos::uniform_type::integer, 1);
   height_handle = engine->add_uniform("height", RenderDoos::uniform_type::integer, 1);
   _init_font(engine);
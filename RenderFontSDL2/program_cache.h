@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+namespace RenderDoos
+  {
+  class render_engine;
+  }
+
+// Cache of linked OpenGL programs (glGetProgramBinary), one file per program in the cache folder, named after a
+// hash of the shader sources and of the vendor, renderer and version strings of the driver, so a driver update
+// makes a new entry. RenderDoos links its programs itself: a warm start links a pair of trivial placeholder shaders
+// to get a program object and replaces its executable by the cached binary with glProgramBinary. This relies on
+// RenderDoos looking up the uniform locations by name when they are bound. A missing or rejected binary falls back
+// to compiling the sources, after which the binary of the new program is stored.
+// The Metal shaders are compiled offline into the default library, so there is nothing to cache there.
+
+// the cache is disabled while the folder is empty, which is the default
+void set_program_cache_folder(const std::string& folder);
+
+// add_shader for both sources and add_program, or their cached equivalent, for the OpenGL renderer.
+// vs_handle and fs_handle are removed with remove_shader as usual.
+int32_t add_cached_program(RenderDoos::render_engine* engine, int32_t& vs_handle, int32_t& fs_handle, const std::string& vertex_source, const std::string& fragment_source);
@@ -0,0 +1,250 @@
+#include "frame_capture.h"
+
+#include "RenderDoos/render_engine.h"
+#include "RenderDoos/types.h"
+
+#if !defined(RENDERDOOS_METAL)
+#include <GL/glew.h>
+#include <glew/GL/glew.h>
+#endif
+
+#include <string.h>
+
+namespace
+  {
+  // frames waiting for the writer, the render loop waits when the disk can't keep up
+  const size_t max_queued_frames = 8;
+
+  // splits frames/%05d.ppm in frames/, 5 zero padded digits and .ppm; false unless there is exactly one conversion
+  bool parse_frame_pattern(std::string& prefix, std::string& suffix, int& digits, bool& zero_pad, const std::string& pattern)
+    {
+    bool found = false;
+    std::string* text = &prefix;
+    prefix.clear();
+    suffix.clear();
+    digits = 0;
+    zero_pad = false;
+    for (size_t i = 0; i < pattern.size(); ++i)
+      {
+      if (pattern[i] != '%')
+        {
+        text->push_back(pattern[i]);
+        continue;
+        }
+      if (++i < pattern.size() && pattern[i] == '%')
+        {
+        text->push_back('%');
+        continue;
+        }
+      if (found)
+        return false;
+      if (i < pattern.size() && pattern[i] == '0')
+        {
+        zero_pad = true;
+        ++i;
+        }
+      while (i < pattern.size() && pattern[i] >= '0' && pattern[i] <= '9' && digits < 100)
+        digits = digits * 10 + (pattern[i++] - '0');
+      if (i >= pattern.size() || (pattern[i] != 'd' && pattern[i] != 'i' && pattern[i] != 'u'))
+        return false;
+      found = true;
+      text = &suffix;
+      }
+    return found;
+    }
+  }
+
+frame_capture::frame_capture() : _sequence(false), _digits(0), _zero_pad(false), _stream(nullptr), _w(0), _h(0), _fbo(0), _attached_texture(0),
+  _first(0), _pending(0), _frames_captured(0), _frames_written(0), _closing(false)
+  {
+  for (int i = 0; i < ring_size; ++i)
+    {
+    _pbo[i] = 0;
+    _fence[i] = nullptr;
+    }
+  }
+
+frame_capture::~frame_capture()
+  {
+  close();
+  }
+
+bool frame_capture::open(const std::string& output, uint32_t w, uint32_t h)
+  {
+  close();
+#if defined(RENDERDOOS_METAL)
+  (void)output;
+  (void)w;
+  (void)h;
+  return false;
+#else
+  _output = output;
+  _sequence = output.find('%') != std::string::npos;
+  if (_sequence && !parse_frame_pattern(_prefix, _suffix, _digits, _zero_pad, output))
+    return false;
+  if (!_sequence)
+    {
+    _stream = output == "-" ? stdout : fopen(output.c_str(), "wb");
+    if (!_stream)
+      return false;
+    }
+  _w = w;
+  _h = h;
+  _first = 0;
+  _pending = 0;
+  _frames_captured = 0;
+  _frames_written = 0;
+  glGenFramebuffers(1, &_fbo);
+  glGenBuffers(ring_size, _pbo);
+  for (int i = 0; i < ring_size; ++i)
+    {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _pbo[i]);
+    glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)w * h * 4, nullptr, GL_STREAM_READ);
+    }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  _closing = false;
+  _writer = std::thread(&frame_capture::_write, this);
+  return true;
+#endif
+  }
+
+void frame_capture::capture(RenderDoos::render_engine* engine, int32_t frame_buffer_handle)
+  {
+#if defined(RENDERDOOS_METAL)
+  (void)engine;
+  (void)frame_buffer_handle;
+#else
+  if (_fbo == 0)
+    return;
+  if (_pending == ring_size)
+    _retrieve_oldest();
+  // the texture of the frame buffer is found through the texture binding
+  engine->bind_texture_to_channel(engine->get_frame_buffer(frame_buffer_handle)->texture_handle, 0, TEX_WRAP_CLAMP_TO_EDGE | TEX_FILTER_NEAREST);
+  glActiveTexture(GL_TEXTURE0);
+  GLint texture = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+  GLint previous_fbo = 0;
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previous_fbo);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, _fbo);
+  if ((uint32_t)texture != _attached_texture)
+    {
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, (GLuint)texture, 0);
+    _attached_texture = (uint32_t)texture;
+    }
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  const uint32_t slot = (_first + _pending) % ring_size;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, _pbo[slot]);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glReadPixels(0, 0, (GLsizei)_w, (GLsizei)_h, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  _fence[slot] = (void*)glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, (GLuint)previous_fbo);
+  ++_pending;
+  ++_frames_captured;
+#endif
+  }
+
+void frame_capture::_retrieve_oldest()
+  {
+#if !defined(RENDERDOOS_METAL)
+  const uint32_t slot = _first;
+  GLsync fence = (GLsync)_fence[slot];
+  glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+  glDeleteSync(fence);
+  _fence[slot] = nullptr;
+  std::vector<uint8_t> rgba((size_t)_w * _h * 4);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, _pbo[slot]);
+  const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)rgba.size(), GL_MAP_READ_BIT);
+  if (mapped)
+    {
+    memcpy(rgba.data(), mapped, rgba.size());
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  _first = (_first + 1) % ring_size;
+  --_pending;
+  std::unique_lock<std::mutex> lock(_mutex);
+  _cv.wait(lock, [&] { return _queue.size() < max_queued_frames; });
+  _queue.push_back(std::move(rgba));
+  _cv.notify_all();
+#endif
+  }
+
+void frame_capture::close()
+  {
+#if !defined(RENDERDOOS_METAL)
+  if (_fbo == 0)
+    return;
+  while (_pending > 0)
+    _retrieve_oldest();
+  {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _closing = true;
+  }
+  _cv.notify_all();
+  if (_writer.joinable())
+    _writer.join();
+  glDeleteBuffers(ring_size, _pbo);
+  glDeleteFramebuffers(1, &_fbo);
+  for (int i = 0; i < ring_size; ++i)
+    _pbo[i] = 0;
+  _fbo = 0;
+  _attached_texture = 0;
+  if (_stream && _stream != stdout)
+    fclose(_stream);
+  else if (_stream)
+    fflush(_stream);
+  _stream = nullptr;
+#endif
+  }
+
+void frame_capture::_write()
+  {
+  uint32_t frame = 0;
+  for (;;)
+    {
+    std::vector<uint8_t> rgba;
+    {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv.wait(lock, [&] { return !_queue.empty() || _closing; });
+    if (_queue.empty())
+      return;
+    rgba.swap(_queue.front());
+    _queue.pop_front();
+    }
+    _cv.notify_all();
+    if (_write_frame(rgba, frame))
+      ++_frames_written;
+    ++frame;
+    }
+  }
+
+bool frame_capture::_write_frame(const std::vector<uint8_t>& rgba, uint32_t frame)
+  {
+  // rgb rows from the top, glReadPixels starts at the bottom row
+  std::vector<uint8_t> rgb((size_t)_w * _h * 3);
+  for (uint32_t y = 0; y < _h; ++y)
+    {
+    const uint8_t* src = rgba.data() + (size_t)(_h - 1 - y) * _w * 4;
+    uint8_t* dst = rgb.data() + (size_t)y * _w * 3;
+    for (uint32_t x = 0; x < _w; ++x)
+      {
+      dst[3 * x + 0] = src[4 * x + 0];
+      dst[3 * x + 1] = src[4 * x + 1];
+      dst[3 * x + 2] = src[4 * x + 2];
+      }
+    }
+  if (!_sequence)
+    return fwrite(rgb.data(), 1, rgb.size(), _stream) == rgb.size();
+  std::string number = std::to_string(frame);
+  if ((int)number.size() < _digits)
+    number.insert(0, _digits - number.size(), _zero_pad ? '0' : ' ');
+  const std::string filename = _prefix + number + _suffix;
+  FILE* f = fopen(filename.c_str(), "wb");
+  if (!f)
+    return false;
+  fprintf(f, "P6\n%u %u\n255\n", _w, _h);
+  const bool written = fwrite(rgb.data(), 1, rgb.size(), f) == rgb.size();
+  fclose(f);
+  return written;
+  }
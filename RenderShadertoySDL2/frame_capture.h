@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace RenderDoos
+  {
+  class render_engine;
+  }
+
+// Reads rendered frames back from a frame buffer and writes them to disk, without stalling the render loop.
+// A frame is copied to a pixel buffer object with glReadPixels, which only queues the transfer; the copy is mapped
+// a few frames later, when the gpu is done with it. Writing the files happens on a background thread.
+// The output is an image sequence when the name contains a pattern for the frame number, e.g. frames/%05d.ppm
+// (binary ppm): exactly one %d, %i or %u with an optional zero flag and width, and %% for a literal %. The pattern
+// is expanded here, not by printf. Otherwise the output is a raw rgb24 stream, rows from the top, "-" for stdout,
+// e.g. to pipe into
+// ffmpeg -f rawvideo -pix_fmt rgb24 -s <w>x<h> -r <fps> -i - out.mp4.
+// Only the OpenGL renderer is supported. RenderDoos has no read back of frame buffers, so the OpenGL texture of the
+// frame buffer is attached to a frame buffer object of our own.
+class frame_capture
+  {
+  public:
+    frame_capture();
+    ~frame_capture();
+
+    bool open(const std::string& output, uint32_t w, uint32_t h);
+
+    // after renderpass_end of the pass that rendered the w x h frame into frame_buffer_handle
+    void capture(RenderDoos::render_engine* engine, int32_t frame_buffer_handle);
+
+    // writes the outstanding frames
+    void close();
+
+    uint32_t frames_written() const { return _frames_written; }
+
+  private:
+    void _retrieve_oldest();
+    void _write();
+    bool _write_frame(const std::vector<uint8_t>& rgba, uint32_t frame);
+
+  private:
+    enum { ring_size = 3 };
+    std::string _output;
+    bool _sequence;
+    // the image sequence name is _prefix, the frame number padded to _digits, _suffix
+    std::string _prefix, _suffix;
+    int _digits;
+    bool _zero_pad;
+    FILE* _stream;
+    uint32_t _w, _h;
+    uint32_t _fbo, _attached_texture;
+    uint32_t _pbo[ring_size];
+    void* _fence[ring_size];
+    uint32_t _first, _pending;
+    uint32_t _frames_captured, _frames_written;
+
+    std::thread _writer;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::vector<uint8_t>> _queue;
+    bool _closing;
+  };
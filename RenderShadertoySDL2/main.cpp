@@ -9,6 +9,8 @@
 #include <iostream>
 #include <thread>
 #include <chrono>
+#include <memory>
+#include <stdlib.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -33,6 +35,12 @@
 
 #include "RenderDoos/types.h"
 
+#include "dynamic_resolution.h"
+#include "frame_capture.h"
+#include "multipass_shadertoy.h"
+#include "progressive_accumulation.h"
+#include "script_watcher.h"
+
 #include <iostream>
 
 
@@ -66,6 +74,31 @@ int _main(int argc, char** argv)
 
   uint32_t w = 800;
   uint32_t h = 450;
+  // batch rendering, see --render below
+  std::string render_output;
+  uint32_t render_frames = 0;
+  double render_fps = 60.0;
+  bool render_multipass = false;
+  for (int i = 1; i < argc; ++i)
+    {
+    if (strcmp(argv[i], "--render") == 0 && i + 2 < argc)
+      {
+      render_output = argv[i + 1];
+      render_frames = (uint32_t)atoi(argv[i + 2]);
+      if (i + 3 < argc && argv[i + 3][0] != '-')
+        render_fps = atof(argv[i + 3]);
+      }
+    else if (strcmp(argv[i], "--size") == 0 && i + 2 < argc)
+      {
+      w = (uint32_t)atoi(argv[i + 1]);
+      h = (uint32_t)atoi(argv[i + 2]);
+      }
+    else if (strcmp(argv[i], "--multipass") == 0)
+      render_multipass = true;
+    }
+  if (render_fps <= 0.0)
+    render_fps = 60.0;
+  const uint32_t window_visibility = render_frames > 0 ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN;
   RenderDoos::render_engine engine;
   if (SDL_Init(SDL_INIT_EVERYTHING) == -1)
     {
@@ -77,7 +110,7 @@ int _main(int argc, char** argv)
 
   SDL_Window* window = SDL_CreateWindow("RenderShadertoySDL2",
     SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-    w, h, SDL_WINDOW_RESIZABLE | SDL_WINDOW_SHOWN);
+    w, h, SDL_WINDOW_RESIZABLE | window_visibility);
 
   SDL_MetalView metalView = SDL_Metal_CreateView(window);
   void* layer = SDL_Metal_GetLayer(metalView);
@@ -100,13 +133,13 @@ int _main(int argc, char** argv)
   SDL_Window* window = SDL_CreateWindow("RenderShadertoySDL2",
     SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
     w, h,
-    SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_SHOWN);
+    SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | window_visibility);
 
   if (!window)
     throw std::runtime_error("SDL can't create a window");
 
   SDL_GLContext gl_context = SDL_GL_CreateContext(window);
-  SDL_GL_SetSwapInterval(1); // Enable vsync
+  SDL_GL_SetSwapInterval(render_frames > 0 ? 0 : 1); // Enable vsync, except for batch rendering
 
 
   glewExperimental = true;
@@ -153,6 +186,66 @@ int _main(int argc, char** argv)
 #endif
   shadertoy_mat.set_script(script);
   shadertoy_mat.compile(&engine);
+
+  // Multi-pass example, toggle with m: Buffer A fades its own previous frame and adds a moving dot,
+  // the image pass shows Buffer A.
+  multipass_shadertoy multipass;
+#if defined(RENDERDOOS_METAL)
+  std::string buffer_a_script = std::string(R"(void mainImage(thread float4& fragColor, float2 fragCoord, float iTime, float iTimeDelta, float3 iResolution, int iFrame, texture2d<float> iChannel0, texture2d<float> iChannel1, texture2d<float> iChannel2, texture2d<float> iChannel3, sampler iChannelSampler)
+{
+  float2 uv = fragCoord / iResolution.xy;
+  // the rows of Metal textures start at the top
+  // the buffers are 8 bit, the fade subtracts a step as well to reach black
+  float3 previous = max(iChannel0.sample(iChannelSampler, float2(uv.x, 1 - uv.y)).rgb * 0.97 - 1.0/255.0, 0.0);
+  float2 center = 0.5 + 0.3*float2(cos(iTime), sin(1.3*iTime));
+  float d = length((uv - center)*iResolution.xy) / iResolution.y;
+  float3 spot = (0.5 + 0.5*cos(iTime + float3(0, 2, 4))) * smoothstep(0.03, 0.0, d);
+  fragColor = float4(max(previous, spot), 1);
+})");
+  std::string image_script = std::string(R"(void mainImage(thread float4& fragColor, float2 fragCoord, float iTime, float iTimeDelta, float3 iResolution, int iFrame, texture2d<float> iChannel0, texture2d<float> iChannel1, texture2d<float> iChannel2, texture2d<float> iChannel3, sampler iChannelSampler)
+{
+  float2 uv = fragCoord / iResolution.xy;
+  fragColor = float4(iChannel0.sample(iChannelSampler, float2(uv.x, 1 - uv.y)).rgb, 1);
+})");
+#else
+  std::string buffer_a_script = std::string(R"(void mainImage( out vec4 fragColor, in vec2 fragCoord )
+{
+    vec2 uv = fragCoord/iResolution.xy;
+
+    // Fade the previous frame of this buffer, the buffers are 8 bit: without
+    // the subtracted step, dark values round back to themselves and never reach black
+    vec3 previous = max(texture(iChannel0, uv).rgb*0.97 - 1.0/255.0, 0.0);
+
+    // and add a moving dot
+    vec2 center = 0.5 + 0.3*vec2(cos(iTime), sin(1.3*iTime));
+    float d = length((uv - center)*iResolution.xy)/iResolution.y;
+    vec3 spot = (0.5 + 0.5*cos(iTime+vec3(0,2,4)))*smoothstep(0.03, 0.0, d);
+
+    fragColor = vec4(max(previous, spot),1.0);
+})");
+  std::string image_script = std::string(R"(void mainImage( out vec4 fragColor, in vec2 fragCoord )
+{
+    fragColor = vec4(texture(iChannel0, fragCoord/iResolution.xy).rgb,1.0);
+})");
+#endif
+  multipass.set_script(multipass_shadertoy::buffer_a, buffer_a_script);
+  multipass.set_channel(multipass_shadertoy::buffer_a, 0, multipass_shadertoy::buffer_a);
+  multipass.set_script(multipass_shadertoy::image, image_script);
+  multipass.set_channel(multipass_shadertoy::image, 0, multipass_shadertoy::buffer_a);
+  multipass.compile(&engine);
+  bool use_multipass = render_multipass;
+
+  // RenderShadertoySDL2 --watch <script file>
+  // Renders the script in the file as a single pass (shadertoy_pass_material, so with its Metal signature) and reloads
+  // it whenever the file changes. The file is watched and read on a background thread. A new program is compiled
+  // next to the one in use, which keeps rendering, and replaces it only when it compiled and linked.
+  script_watcher watcher;
+  std::unique_ptr<shadertoy_pass_material> live_mat;
+  for (int i = 1; i < argc; ++i)
+    {
+    if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc && !watcher.start(argv[i + 1]))
+      std::cout << "Could not read " << argv[i + 1] << "\n";
+    }
   uint32_t geometry_id = engine.add_geometry(VERTEX_STANDARD);
   RenderDoos::vertex_standard* vp;
   uint32_t* ip;
@@ -214,6 +307,116 @@ int _main(int argc, char** argv)
   last_tic = start;
   bool quit = false;
 
+  // With dynamic resolution (off by default, toggle with v) the shader is rendered in an intermediate target
+  // whose resolution follows the measured frame time, and upscaled to the window.
+  dynamic_resolution dynres;
+
+  // Progressive accumulation for path traced scripts, toggle with a: iTime stays at the moment accumulation started,
+  // iFrame is the sample index, and every frame adds one sample to the average. It starts over when the script is
+  // reloaded or the multi-pass example is toggled.
+  progressive_accumulation accumulation;
+  accumulation.compile(&engine);
+  bool accumulate = false;
+  float accumulation_time = 0.f;
+
+  auto draw_shadertoy = [&]()
+    {
+    if (use_multipass)
+      multipass.draw_image(&engine, geometry_id, st_props);
+    else
+      {
+      RenderDoos::material* mat = live_mat ? (RenderDoos::material*)live_mat.get() : &shadertoy_mat;
+      mat->bind(&engine);
+      engine.geometry_draw(geometry_id);
+      }
+    };
+
+  auto draw_view = [&]()
+    {
+    if (accumulate)
+      accumulation.draw(&engine, geometry_id);
+    else
+      draw_shadertoy();
+    };
+
+  // messages go to stderr, --render can write the frames to stdout
+  auto load_watched_script = [&]()
+    {
+    std::string new_script;
+    if (watcher.poll(new_script))
+      {
+      std::unique_ptr<shadertoy_pass_material> candidate(new shadertoy_pass_material());
+      candidate->set_script(new_script);
+      candidate->compile(&engine);
+      if (candidate->compiled())
+        {
+        if (live_mat)
+          live_mat->destroy(&engine);
+        live_mat.swap(candidate);
+        accumulation.reset();
+        std::cerr << "loaded " << watcher.filename() << "\n";
+        }
+      else
+        {
+        candidate->destroy(&engine);
+        std::cerr << "could not compile " << watcher.filename() << ", the previous script stays\n";
+        }
+      }
+    };
+
+  // RenderShadertoySDL2 --render <output> <frames> [fps] [--size <w> <h>] [--multipass] [--watch <script file>]
+  // Renders the frames at a fixed time step of 1 / fps seconds (60 by default) into a frame buffer, without showing
+  // the window, and writes them with frame_capture: an image sequence for a name with a printf pattern
+  // (frames/%05d.ppm), otherwise a raw rgb24 stream ("-" for stdout). iTime only depends on the frame number, so the
+  // output and the reported frames per second are reproducible. Without gpu or display, Mesa's software OpenGL works,
+  // e.g. LIBGL_ALWAYS_SOFTWARE=1 SDL_VIDEODRIVER=offscreen, or under xvfb-run.
+  if (render_frames > 0)
+    {
+    load_watched_script();
+    const int32_t capture_framebuffer_id = engine.add_frame_buffer(w, h, false);
+    frame_capture capture;
+    if (!capture.open(render_output, w, h))
+      std::cerr << "Could not write " << render_output << " (only supported with OpenGL, a pattern needs exactly one %d)\n";
+    else
+      {
+      std::cerr << "rendering " << render_frames << " frames of " << w << "x" << h << " at " << render_fps << " fps\n";
+      const auto render_start = std::chrono::high_resolution_clock::now();
+      st_props.time_delta = (float)(1.0 / render_fps);
+      // the buffer passes of --multipass run before the first set_model_view_properties of the frame
+      engine.set_model_view_properties(mv_props);
+      for (uint32_t frame = 0; frame < render_frames; ++frame)
+        {
+        st_props.frame = frame;
+        st_props.time = (float)((double)frame / render_fps);
+        shadertoy_mat.set_shadertoy_properties(st_props);
+        if (live_mat)
+          live_mat->set_shadertoy_properties(st_props);
+        RenderDoos::render_drawables drawables;
+        engine.frame_begin(drawables);
+        if (use_multipass)
+          multipass.render_buffers(&engine, geometry_id, st_props, w, h);
+        RenderDoos::renderpass_descriptor descr;
+        descr.clear_color = 0xff203040;
+        descr.clear_flags = CLEAR_COLOR | CLEAR_DEPTH;
+        descr.w = w;
+        descr.h = h;
+        descr.frame_buffer_handle = capture_framebuffer_id;
+        descr.frame_buffer_channel = 10;
+        engine.renderpass_begin(descr);
+        engine.set_model_view_properties(mv_props);
+        draw_shadertoy();
+        engine.renderpass_end();
+        capture.capture(&engine, capture_framebuffer_id);
+        engine.frame_end();
+        }
+      capture.close();
+      const double seconds = (double)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - render_start).count() / 1000000.0;
+      std::cerr << "wrote " << capture.frames_written() << " frames in " << seconds << " s (" << (double)render_frames / seconds << " frames/s)\n";
+      }
+    engine.remove_frame_buffer(capture_framebuffer_id);
+    quit = true;
+    }
+
   while (!quit)
     {
     SDL_Event event;
@@ -235,6 +438,24 @@ int _main(int argc, char** argv)
           quit = true;
           break;
           }
+          case SDLK_v:
+          {
+          dynres.set_enabled(!dynres.enabled());
+          break;
+          }
+          case SDLK_m:
+          {
+          use_multipass = !use_multipass;
+          accumulation.reset();
+          break;
+          }
+          case SDLK_a:
+          {
+          accumulate = !accumulate;
+          accumulation.reset();
+          accumulation_time = st_props.time;
+          break;
+          }
           }
         }
         }
@@ -247,27 +468,68 @@ int _main(int argc, char** argv)
     drawables.metal_drawable = (void*)drawable.drawable;
     drawables.metal_screen_texture = (void*)drawable.texture;
 #endif
+    dynres.frame_started();
     engine.frame_begin(drawables);
     auto tic = std::chrono::high_resolution_clock::now();
     st_props.time_delta = (float)(std::chrono::duration_cast<std::chrono::microseconds>(tic - last_tic).count()) / 1000000.f;
     last_tic = tic;
     st_props.time = (float)(std::chrono::duration_cast<std::chrono::microseconds>(tic - start).count()) / 1000000.f;
+    if (accumulate)
+      {
+      // the scripts move their camera with iTime
+      st_props.time = accumulation_time;
+      st_props.time_delta = 0.f;
+      st_props.frame = (int)accumulation.sample_index();
+      }
     shadertoy_mat.set_shadertoy_properties(st_props);
+    load_watched_script();
+    if (live_mat)
+      live_mat->set_shadertoy_properties(st_props);
+    // the buffers keep the window resolution, so feedback survives changes of the dynamic resolution
+    if (use_multipass)
+      multipass.render_buffers(&engine, geometry_id, st_props, mv_props.viewport_width, mv_props.viewport_height);
+    // the samples are rendered at the window resolution as well
+    if (accumulate)
+      accumulation.accumulate(&engine, geometry_id, mv_props.viewport_width, mv_props.viewport_height, draw_shadertoy);
 
     RenderDoos::renderpass_descriptor descr;
     descr.clear_color = 0xff203040;
     descr.clear_flags = CLEAR_COLOR | CLEAR_DEPTH;
+
+    if (dynres.enabled())
+      {
+      descr.frame_buffer_handle = dynres.render_target(&engine, mv_props.viewport_width, mv_props.viewport_height);
+      descr.frame_buffer_channel = 10;
+      engine.renderpass_begin(descr);
+      // iResolution is the resolution of the render target
+      RenderDoos::model_view_properties target_props = mv_props;
+      dynres.scaled_size(target_props.viewport_width, target_props.viewport_height, mv_props.viewport_width, mv_props.viewport_height);
+      engine.set_model_view_properties(target_props);
+      draw_view();
+      engine.renderpass_end();
+      descr.frame_buffer_handle = -1;
+      }
+
     descr.w = mv_props.viewport_width;
     descr.h = mv_props.viewport_height;
 
     engine.renderpass_begin(descr);
 
     engine.set_model_view_properties(mv_props);
-    shadertoy_mat.bind(&engine);
-    engine.geometry_draw(geometry_id);
+    if (dynres.enabled())
+      {
+      dynres.present(&engine, geometry_id);
+      }
+    else
+      {
+      draw_view();
+      }
 
     engine.renderpass_end();
-    engine.frame_end();
+    // waiting for the gpu only when the frame time drives the render resolution
+    engine.frame_end(dynres.enabled());
+    dynres.frame_finished();
+    ++st_props.frame;
     std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(10.0));
 
 #if defined(RENDERDOOS_OPENGL)
@@ -276,6 +538,13 @@ int _main(int argc, char** argv)
 
     } //while (!quit)
 
+  dynres.destroy(&engine);
+  accumulation.destroy(&engine);
+  multipass.destroy(&engine);
+  watcher.stop();
+  if (live_mat)
+    live_mat->destroy(&engine);
+
   SDL_Quit();
   return 0;
   }
@@ -0,0 +1,330 @@
+#include "multipass_shadertoy.h"
+
+#include "RenderDoos/render_engine.h"
+#include "RenderDoos/types.h"
+
+namespace
+  {
+  std::string get_shadertoy_pass_vertex_shader()
+    {
+    return std::string(R"(#version 330 core
+layout (location = 0) in vec3 vPosition;
+uniform mat4 Projection; // columns
+
+void main()
+  {
+  gl_Position = Projection*vec4(vPosition.xyz,1);
+  }
+)");
+    }
+
+  std::string get_shadertoy_pass_fragment_shader(const std::string& script)
+    {
+    return std::string(R"(#version 330 core
+uniform vec3 iResolution;
+uniform float iTime;
+uniform float iTimeDelta;
+uniform int iFrame;
+uniform sampler2D iChannel0;
+uniform sampler2D iChannel1;
+uniform sampler2D iChannel2;
+uniform sampler2D iChannel3;
+out vec4 FragColor;
+)") + script + std::string(R"(
+void main()
+  {
+  vec4 color = vec4(0.0, 0.0, 0.0, 1.0);
+  mainImage(color, gl_FragCoord.xy);
+  FragColor = color;
+  }
+)");
+    }
+
+  // compiled from source at runtime, as the script of RenderDoos::shadertoy_material
+  std::string get_shadertoy_pass_metal_shaders(const std::string& script)
+    {
+    return std::string(R"(#include <metal_stdlib>
+using namespace metal;
+
+struct VertexIn {
+  packed_float3 position;
+  packed_float3 normal;
+  packed_float2 textureCoordinates;
+};
+
+struct ShadertoyPassUniforms {
+  float4x4 projection_matrix;
+  float3 iResolution;
+  float iTime;
+  float iTimeDelta;
+  int iFrame;
+  int iChannel0;
+  int iChannel1;
+  int iChannel2;
+  int iChannel3;
+};
+
+struct VertexOut {
+  float4 position [[position]];
+};
+
+vertex VertexOut shadertoy_pass_vertex_shader(const device VertexIn *vertices [[buffer(0)]], uint vertexId [[vertex_id]], constant ShadertoyPassUniforms& input [[buffer(10)]]) {
+  VertexOut out;
+  float4 pos(vertices[vertexId].position, 1);
+  out.position = input.projection_matrix * pos;
+  return out;
+}
+)") + script + std::string(R"(
+fragment float4 shadertoy_pass_fragment_shader(const VertexOut vertexIn [[stage_in]], texture2d<float> iChannel0 [[texture(0)]], texture2d<float> iChannel1 [[texture(1)]], texture2d<float> iChannel2 [[texture(2)]], texture2d<float> iChannel3 [[texture(3)]], sampler iChannelSampler [[sampler(0)]], constant ShadertoyPassUniforms& input [[buffer(10)]]) {
+  float2 fragCoord = float2(vertexIn.position.x, input.iResolution.y - vertexIn.position.y);
+  float4 color = float4(0, 0, 0, 1);
+  mainImage(color, fragCoord, input.iTime, input.iTimeDelta, input.iResolution, input.iFrame, iChannel0, iChannel1, iChannel2, iChannel3, iChannelSampler);
+  return color;
+}
+)");
+    }
+
+  const uint32_t black = 0xff000000;
+  }
+
+shadertoy_pass_material::shadertoy_pass_material()
+  {
+  props.frame = 0;
+  props.time = 0.f;
+  props.time_delta = 0.f;
+  vs_handle = -1;
+  fs_handle = -1;
+  shader_program_handle = -1;
+  proj_handle = -1;
+  res_handle = -1;
+  time_handle = -1;
+  time_delta_handle = -1;
+  frame_handle = -1;
+  for (int i = 0; i < 4; ++i)
+    {
+    channel_handles[i] = -1;
+    channel_textures[i] = -1;
+    }
+  empty_texture = -1;
+  }
+
+shadertoy_pass_material::~shadertoy_pass_material()
+  {
+  }
+
+void shadertoy_pass_material::set_script(const std::string& s)
+  {
+  script = s;
+  }
+
+void shadertoy_pass_material::set_channel(int channel, int32_t texture_handle)
+  {
+  if (channel >= 0 && channel < 4)
+    channel_textures[channel] = texture_handle;
+  }
+
+void shadertoy_pass_material::set_shadertoy_properties(const RenderDoos::shadertoy_material::properties& p)
+  {
+  props = p;
+  }
+
+bool shadertoy_pass_material::compiled() const
+  {
+  return vs_handle >= 0 && fs_handle >= 0 && shader_program_handle >= 0;
+  }
+
+void shadertoy_pass_material::compile(RenderDoos::render_engine* engine)
+  {
+  using namespace RenderDoos;
+  if (engine->get_renderer_type() == renderer_type::METAL)
+    {
+    const std::string source = get_shadertoy_pass_metal_shaders(script);
+    vs_handle = engine->add_shader(source.c_str(), SHADER_VERTEX, "shadertoy_pass_vertex_shader");
+    fs_handle = engine->add_shader(source.c_str(), SHADER_FRAGMENT, "shadertoy_pass_fragment_shader");
+    }
+  else if (engine->get_renderer_type() == renderer_type::OPENGL)
+    {
+    vs_handle = engine->add_shader(get_shadertoy_pass_vertex_shader().c_str(), SHADER_VERTEX, nullptr);
+    fs_handle = engine->add_shader(get_shadertoy_pass_fragment_shader(script).c_str(), SHADER_FRAGMENT, nullptr);
+    }
+  shader_program_handle = engine->add_program(vs_handle, fs_handle);
+  proj_handle = engine->add_uniform("Projection", uniform_type::mat4, 1);
+  res_handle = engine->add_uniform("iResolution", uniform_type::vec3, 1);
+  time_handle = engine->add_uniform("iTime", uniform_type::scalar, 1);
+  time_delta_handle = engine->add_uniform("iTimeDelta", uniform_type::scalar, 1);
+  frame_handle = engine->add_uniform("iFrame", uniform_type::integer, 1);
+  channel_handles[0] = engine->add_uniform("iChannel0", uniform_type::sampler, 1);
+  channel_handles[1] = engine->add_uniform("iChannel1", uniform_type::sampler, 1);
+  channel_handles[2] = engine->add_uniform("iChannel2", uniform_type::sampler, 1);
+  channel_handles[3] = engine->add_uniform("iChannel3", uniform_type::sampler, 1);
+  // bound to the channels without an input
+  empty_texture = engine->add_texture(1, 1, texture_format_rgba8, (const uint8_t*)&black);
+  }
+
+void shadertoy_pass_material::bind(RenderDoos::render_engine* engine)
+  {
+  engine->bind_program(shader_program_handle);
+  engine->set_uniform(proj_handle, (void*)(&engine->get_projection()));
+  const auto& mv = engine->get_model_view_properties();
+  float res[3] = { (float)mv.viewport_width, (float)mv.viewport_height, 1.f };
+  engine->set_uniform(res_handle, (void*)res);
+  engine->set_uniform(time_handle, (void*)&props.time);
+  engine->set_uniform(time_delta_handle, (void*)&props.time_delta);
+  engine->set_uniform(frame_handle, (void*)&props.frame);
+  for (int32_t i = 0; i < 4; ++i)
+    {
+    engine->set_uniform(channel_handles[i], (void*)&i);
+    engine->bind_texture_to_channel(channel_textures[i] >= 0 ? channel_textures[i] : empty_texture, i, TEX_WRAP_CLAMP_TO_EDGE | TEX_FILTER_LINEAR);
+    }
+
+  engine->bind_uniform(shader_program_handle, proj_handle);
+  engine->bind_uniform(shader_program_handle, res_handle);
+  engine->bind_uniform(shader_program_handle, time_handle);
+  engine->bind_uniform(shader_program_handle, time_delta_handle);
+  engine->bind_uniform(shader_program_handle, frame_handle);
+  for (int i = 0; i < 4; ++i)
+    engine->bind_uniform(shader_program_handle, channel_handles[i]);
+  }
+
+void shadertoy_pass_material::destroy(RenderDoos::render_engine* engine)
+  {
+  engine->remove_program(shader_program_handle);
+  engine->remove_shader(vs_handle);
+  engine->remove_shader(fs_handle);
+  engine->remove_uniform(proj_handle);
+  engine->remove_uniform(res_handle);
+  engine->remove_uniform(time_handle);
+  engine->remove_uniform(time_delta_handle);
+  engine->remove_uniform(frame_handle);
+  for (int i = 0; i < 4; ++i)
+    engine->remove_uniform(channel_handles[i]);
+  engine->remove_texture(empty_texture);
+  }
+
+multipass_shadertoy::multipass_shadertoy() : _w(0), _h(0)
+  {
+  for (int p = 0; p < 5; ++p)
+    {
+    _active[p] = false;
+    for (int c = 0; c < 4; ++c)
+      _channels[p][c] = -1;
+    }
+  for (int b = 0; b < 4; ++b)
+    {
+    _frame_buffers[b][0] = -1;
+    _frame_buffers[b][1] = -1;
+    _current[b] = 0;
+    }
+  }
+
+void multipass_shadertoy::set_script(pass p, const std::string& script)
+  {
+  _materials[p].set_script(script);
+  _active[p] = !script.empty();
+  }
+
+void multipass_shadertoy::set_channel(pass p, int channel, int buffer)
+  {
+  if (channel >= 0 && channel < 4)
+    _channels[p][channel] = (buffer >= buffer_a && buffer <= buffer_d) ? buffer : -1;
+  }
+
+void multipass_shadertoy::compile(RenderDoos::render_engine* engine)
+  {
+  for (int p = 0; p < 5; ++p)
+    {
+    if (_active[p])
+      _materials[p].compile(engine);
+    }
+  }
+
+void multipass_shadertoy::_bind_channels(RenderDoos::render_engine* engine, int p)
+  {
+  for (int c = 0; c < 4; ++c)
+    {
+    const int b = _channels[p][c];
+    const bool available = b >= 0 && _active[b] && _frame_buffers[b][_current[b]] >= 0;
+    _materials[p].set_channel(c, available ? engine->get_frame_buffer(_frame_buffers[b][_current[b]])->texture_handle : -1);
+    }
+  }
+
+void multipass_shadertoy::_release_frame_buffers(RenderDoos::render_engine* engine)
+  {
+  for (int b = 0; b < 4; ++b)
+    {
+    for (int i = 0; i < 2; ++i)
+      {
+      if (_frame_buffers[b][i] >= 0)
+        engine->remove_frame_buffer(_frame_buffers[b][i]);
+      _frame_buffers[b][i] = -1;
+      }
+    _current[b] = 0;
+    }
+  _w = 0;
+  _h = 0;
+  }
+
+void multipass_shadertoy::render_buffers(RenderDoos::render_engine* engine, uint32_t geometry_id, const RenderDoos::shadertoy_material::properties& props, uint32_t w, uint32_t h)
+  {
+  if (w != _w || h != _h)
+    {
+    _release_frame_buffers(engine);
+    for (int b = 0; b < 4; ++b)
+      {
+      if (!_active[b])
+        continue;
+      _frame_buffers[b][0] = engine->add_frame_buffer(w, h, false);
+      _frame_buffers[b][1] = engine->add_frame_buffer(w, h, false);
+      }
+    _w = w;
+    _h = h;
+    }
+  // iResolution is the resolution of the buffers
+  const RenderDoos::model_view_properties previous_props = engine->get_model_view_properties();
+  RenderDoos::model_view_properties target_props = previous_props;
+  target_props.viewport_width = w;
+  target_props.viewport_height = h;
+  engine->set_model_view_properties(target_props);
+  for (int b = 0; b < 4; ++b)
+    {
+    if (!_active[b])
+      continue;
+    _bind_channels(engine, b);
+    const int target = 1 - _current[b];
+    RenderDoos::renderpass_descriptor descr;
+    descr.clear_color = 0xff000000;
+    descr.clear_flags = CLEAR_COLOR;
+    descr.w = w;
+    descr.h = h;
+    descr.frame_buffer_handle = _frame_buffers[b][target];
+    descr.frame_buffer_channel = 10;
+    engine->renderpass_begin(descr);
+    _materials[b].set_shadertoy_properties(props);
+    _materials[b].bind(engine);
+    engine->geometry_draw(geometry_id);
+    engine->renderpass_end();
+    // later passes (and this one in the next frame) read the new output
+    _current[b] = target;
+    }
+  engine->set_model_view_properties(previous_props);
+  }
+
+void multipass_shadertoy::draw_image(RenderDoos::render_engine* engine, uint32_t geometry_id, const RenderDoos::shadertoy_material::properties& props)
+  {
+  if (!_active[image])
+    return;
+  _bind_channels(engine, image);
+  _materials[image].set_shadertoy_properties(props);
+  _materials[image].bind(engine);
+  engine->geometry_draw(geometry_id);
+  }
+
+void multipass_shadertoy::destroy(RenderDoos::render_engine* engine)
+  {
+  _release_frame_buffers(engine);
+  for (int p = 0; p < 5; ++p)
+    {
+    if (_active[p])
+      _materials[p].destroy(engine);
+    }
+  }
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include "RenderDoos/material.h"
+
+namespace RenderDoos
+  {
+  class render_engine;
+  }
+
+// One shadertoy pass with four texture inputs iChannel0 to iChannel3, next to iResolution, iTime, iTimeDelta and iFrame.
+// In GLSL the script defines mainImage(out vec4 fragColor, in vec2 fragCoord) as on shadertoy. In Metal it defines
+// mainImage(thread float4& fragColor, float2 fragCoord, float iTime, float iTimeDelta, float3 iResolution, int iFrame,
+// texture2d<float> iChannel0, texture2d<float> iChannel1, texture2d<float> iChannel2, texture2d<float> iChannel3,
+// sampler iChannelSampler), with fragCoord from the bottom left corner as in GLSL.
+class shadertoy_pass_material : public RenderDoos::material
+  {
+  public:
+    shadertoy_pass_material();
+    virtual ~shadertoy_pass_material();
+
+    void set_script(const std::string& script);
+    // texture handle of the input, -1 for none
+    void set_channel(int channel, int32_t texture_handle);
+    void set_shadertoy_properties(const RenderDoos::shadertoy_material::properties& props);
+
+    // false when compile could not make the shaders or the program, e.g. because of errors in the script
+    bool compiled() const;
+
+    virtual void compile(RenderDoos::render_engine* engine);
+    virtual void bind(RenderDoos::render_engine* engine);
+    virtual void destroy(RenderDoos::render_engine* engine);
+
+  private:
+    std::string script;
+    RenderDoos::shadertoy_material::properties props;
+    int32_t vs_handle, fs_handle;
+    int32_t shader_program_handle;
+    int32_t proj_handle, res_handle, time_handle, time_delta_handle, frame_handle;
+    int32_t channel_handles[4];
+    int32_t channel_textures[4];
+    int32_t empty_texture;
+  };
+
+// Shadertoy style multi-pass rendering: the buffer passes A to D render into their own frame buffers in that order,
+// then the image pass draws to the current render pass. Every iChannel of a pass can read a buffer. A buffer has two
+// frame buffers that swap every frame, so a pass reads its own output of the previous frame (feedback). As on
+// shadertoy, a buffer earlier in the order is read as rendered in this frame, the others as of the previous frame.
+// The frame buffers are only reallocated when the resolution changes.
+// Unlike the float buffers of shadertoy, the buffers are 8 bit unorm (RenderDoos frame buffers are rgba8): values are
+// clamped to [0, 1] and quantized to 1/255, so feedback scripts that rely on float precision or range (accumulated
+// sums, state, slow fades that need to reach zero) must encode their data accordingly.
+class multipass_shadertoy
+  {
+  public:
+    enum pass
+      {
+      buffer_a = 0,
+      buffer_b = 1,
+      buffer_c = 2,
+      buffer_d = 3,
+      image = 4
+      };
+
+    multipass_shadertoy();
+
+    // a buffer pass without a script is skipped
+    void set_script(pass p, const std::string& script);
+    // channel 0 to 3 of pass p reads buffer (buffer_a to buffer_d), or nothing for -1
+    void set_channel(pass p, int channel, int buffer);
+
+    void compile(RenderDoos::render_engine* engine);
+
+    // renders the buffer passes at w x h, outside of any render pass
+    void render_buffers(RenderDoos::render_engine* engine, uint32_t geometry_id, const RenderDoos::shadertoy_material::properties& props, uint32_t w, uint32_t h);
+    // draws the image pass with a full screen quad in the current render pass
+    void draw_image(RenderDoos::render_engine* engine, uint32_t geometry_id, const RenderDoos::shadertoy_material::properties& props);
+
+    void destroy(RenderDoos::render_engine* engine);
+
+  private:
+    void _bind_channels(RenderDoos::render_engine* engine, int p);
+    void _release_frame_buffers(RenderDoos::render_engine* engine);
+
+  private:
+    shadertoy_pass_material _materials[5];
+    bool _active[5];
+    int _channels[5][4];
+    int32_t _frame_buffers[4][2];
+    int _current[4]; // frame buffer of each buffer pass with its latest output
+    uint32_t _w, _h;
+  };
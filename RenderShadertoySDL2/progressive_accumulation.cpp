@@ -0,0 +1,360 @@
+#include "progressive_accumulation.h"
+
+#include "RenderDoos/render_engine.h"
+#include "RenderDoos/types.h"
+
+#include <string>
+
+namespace
+  {
+  std::string get_accumulation_vertex_shader()
+    {
+    return std::string(R"(#version 330 core
+layout (location = 0) in vec3 vPosition;
+uniform mat4 Projection; // columns
+
+void main()
+  {
+  gl_Position = Projection*vec4(vPosition.xyz,1);
+  }
+)");
+    }
+
+  std::string get_accumulation_fragment_shader()
+    {
+    return std::string(R"(#version 330 core
+uniform vec3 iResolution;
+uniform int Mode;
+uniform float Weight;
+uniform int Frame;
+uniform sampler2D Sample;
+uniform sampler2D AccumHigh;
+uniform sampler2D AccumLow;
+out vec4 FragColor;
+
+vec3 decode(vec3 high, vec3 low)
+  {
+  return (floor(high*255.0 + 0.5)*256.0 + floor(low*255.0 + 0.5)) / 65535.0;
+  }
+
+// uniform in [0, 1) per channel, the same in the pass of the high and of the low bytes
+vec3 dither(ivec2 p, int frame)
+  {
+  uvec3 v = uvec3(uvec2(p), uint(frame));
+  v = v*1664525u + 1013904223u;
+  v.x += v.y*v.z; v.y += v.z*v.x; v.z += v.x*v.y;
+  v ^= v >> 16u;
+  v.x += v.y*v.z; v.y += v.z*v.x; v.z += v.x*v.y;
+  return vec3(v >> 8u) / 16777216.0;
+  }
+
+void main()
+  {
+  if (Mode == 2)
+    {
+    vec2 uv = gl_FragCoord.xy/iResolution.xy;
+    FragColor = vec4(decode(texture(AccumHigh, uv).rgb, texture(AccumLow, uv).rgb), 1.0);
+    return;
+    }
+  ivec2 p = ivec2(gl_FragCoord.xy);
+  vec3 mean = decode(texelFetch(AccumHigh, p, 0).rgb, texelFetch(AccumLow, p, 0).rgb);
+  mean = mix(mean, clamp(texelFetch(Sample, p, 0).rgb, 0.0, 1.0), Weight);
+  vec3 q = min(floor(mean*65535.0 + dither(p, Frame)), 65535.0);
+  vec3 high = floor(q/256.0);
+  FragColor = vec4((Mode == 0 ? high : q - high*256.0)/255.0, 1.0);
+  }
+)");
+    }
+
+  // compiled from source at runtime, as shadertoy_pass_material
+  std::string get_accumulation_metal_shaders()
+    {
+    return std::string(R"(#include <metal_stdlib>
+using namespace metal;
+
+struct VertexIn {
+  packed_float3 position;
+  packed_float3 normal;
+  packed_float2 textureCoordinates;
+};
+
+struct AccumulationUniforms {
+  float4x4 projection_matrix;
+  float3 iResolution;
+  int Mode;
+  float Weight;
+  int Frame;
+  int Sample;
+  int AccumHigh;
+  int AccumLow;
+};
+
+struct VertexOut {
+  float4 position [[position]];
+};
+
+vertex VertexOut accumulation_vertex_shader(const device VertexIn *vertices [[buffer(0)]], uint vertexId [[vertex_id]], constant AccumulationUniforms& input [[buffer(10)]]) {
+  VertexOut out;
+  float4 pos(vertices[vertexId].position, 1);
+  out.position = input.projection_matrix * pos;
+  return out;
+}
+
+float3 decode(float3 high, float3 low) {
+  return (floor(high*255.0 + 0.5)*256.0 + floor(low*255.0 + 0.5)) / 65535.0;
+}
+
+float3 dither(uint2 p, int frame) {
+  uint3 v = uint3(p, uint(frame));
+  v = v*1664525u + 1013904223u;
+  v.x += v.y*v.z; v.y += v.z*v.x; v.z += v.x*v.y;
+  v ^= v >> 16u;
+  v.x += v.y*v.z; v.y += v.z*v.x; v.z += v.x*v.y;
+  return float3(v >> 8u) / 16777216.0;
+}
+
+fragment float4 accumulation_fragment_shader(const VertexOut vertexIn [[stage_in]], texture2d<float> Sample [[texture(0)]], texture2d<float> AccumHigh [[texture(1)]], texture2d<float> AccumLow [[texture(2)]], constant AccumulationUniforms& input [[buffer(10)]]) {
+  if (input.Mode == 2) {
+    constexpr sampler nearest(filter::nearest, address::clamp_to_edge);
+    float2 uv = vertexIn.position.xy / input.iResolution.xy;
+    return float4(decode(AccumHigh.sample(nearest, uv).rgb, AccumLow.sample(nearest, uv).rgb), 1);
+  }
+  uint2 p = uint2(vertexIn.position.xy);
+  float3 mean = decode(AccumHigh.read(p).rgb, AccumLow.read(p).rgb);
+  mean = mix(mean, clamp(Sample.read(p).rgb, 0.0, 1.0), input.Weight);
+  float3 q = min(floor(mean*65535.0 + dither(p, input.Frame)), 65535.0);
+  float3 high = floor(q/256.0);
+  return float4((input.Mode == 0 ? high : q - high*256.0)/255.0, 1);
+}
+)");
+    }
+
+  const int mode_high = 0;
+  const int mode_low = 1;
+  const int mode_draw = 2;
+  }
+
+accumulation_material::accumulation_material()
+  {
+  mode = mode_draw;
+  frame = 0;
+  weight = 1.f;
+  sample_texture = -1;
+  high_texture = -1;
+  low_texture = -1;
+  vs_handle = -1;
+  fs_handle = -1;
+  shader_program_handle = -1;
+  proj_handle = -1;
+  res_handle = -1;
+  mode_handle = -1;
+  weight_handle = -1;
+  frame_handle = -1;
+  sample_handle = -1;
+  high_handle = -1;
+  low_handle = -1;
+  }
+
+accumulation_material::~accumulation_material()
+  {
+  }
+
+void accumulation_material::set_mode(int m)
+  {
+  mode = m;
+  }
+
+void accumulation_material::set_weight(float w)
+  {
+  weight = w;
+  }
+
+void accumulation_material::set_frame(int f)
+  {
+  frame = f;
+  }
+
+void accumulation_material::set_textures(int32_t sample, int32_t high, int32_t low)
+  {
+  sample_texture = sample;
+  high_texture = high;
+  low_texture = low;
+  }
+
+void accumulation_material::compile(RenderDoos::render_engine* engine)
+  {
+  using namespace RenderDoos;
+  if (engine->get_renderer_type() == renderer_type::METAL)
+    {
+    const std::string source = get_accumulation_metal_shaders();
+    vs_handle = engine->add_shader(source.c_str(), SHADER_VERTEX, "accumulation_vertex_shader");
+    fs_handle = engine->add_shader(source.c_str(), SHADER_FRAGMENT, "accumulation_fragment_shader");
+    }
+  else if (engine->get_renderer_type() == renderer_type::OPENGL)
+    {
+    vs_handle = engine->add_shader(get_accumulation_vertex_shader().c_str(), SHADER_VERTEX, nullptr);
+    fs_handle = engine->add_shader(get_accumulation_fragment_shader().c_str(), SHADER_FRAGMENT, nullptr);
+    }
+  shader_program_handle = engine->add_program(vs_handle, fs_handle);
+  proj_handle = engine->add_uniform("Projection", uniform_type::mat4, 1);
+  res_handle = engine->add_uniform("iResolution", uniform_type::vec3, 1);
+  mode_handle = engine->add_uniform("Mode", uniform_type::integer, 1);
+  weight_handle = engine->add_uniform("Weight", uniform_type::scalar, 1);
+  frame_handle = engine->add_uniform("Frame", uniform_type::integer, 1);
+  sample_handle = engine->add_uniform("Sample", uniform_type::sampler, 1);
+  high_handle = engine->add_uniform("AccumHigh", uniform_type::sampler, 1);
+  low_handle = engine->add_uniform("AccumLow", uniform_type::sampler, 1);
+  }
+
+void accumulation_material::bind(RenderDoos::render_engine* engine)
+  {
+  engine->bind_program(shader_program_handle);
+  engine->set_uniform(proj_handle, (void*)(&engine->get_projection()));
+  const auto& mv = engine->get_model_view_properties();
+  float res[3] = { (float)mv.viewport_width, (float)mv.viewport_height, 1.f };
+  engine->set_uniform(res_handle, (void*)res);
+  engine->set_uniform(mode_handle, (void*)&mode);
+  engine->set_uniform(weight_handle, (void*)&weight);
+  engine->set_uniform(frame_handle, (void*)&frame);
+  // the bytes of neighbouring texels can't be interpolated, all textures are read without filtering
+  const int32_t textures[3] = { sample_texture, high_texture, low_texture };
+  const int32_t handles[3] = { sample_handle, high_handle, low_handle };
+  for (int32_t i = 0; i < 3; ++i)
+    {
+    engine->set_uniform(handles[i], (void*)&i);
+    // the sample texture is not read when drawing the mean
+    engine->bind_texture_to_channel(textures[i] >= 0 ? textures[i] : high_texture, i, TEX_WRAP_CLAMP_TO_EDGE | TEX_FILTER_NEAREST);
+    }
+
+  engine->bind_uniform(shader_program_handle, proj_handle);
+  engine->bind_uniform(shader_program_handle, res_handle);
+  engine->bind_uniform(shader_program_handle, mode_handle);
+  engine->bind_uniform(shader_program_handle, weight_handle);
+  engine->bind_uniform(shader_program_handle, frame_handle);
+  for (int i = 0; i < 3; ++i)
+    engine->bind_uniform(shader_program_handle, handles[i]);
+  }
+
+void accumulation_material::destroy(RenderDoos::render_engine* engine)
+  {
+  engine->remove_program(shader_program_handle);
+  engine->remove_shader(vs_handle);
+  engine->remove_shader(fs_handle);
+  engine->remove_uniform(proj_handle);
+  engine->remove_uniform(res_handle);
+  engine->remove_uniform(mode_handle);
+  engine->remove_uniform(weight_handle);
+  engine->remove_uniform(frame_handle);
+  engine->remove_uniform(sample_handle);
+  engine->remove_uniform(high_handle);
+  engine->remove_uniform(low_handle);
+  }
+
+progressive_accumulation::progressive_accumulation() : _sample_frame_buffer(-1), _current(0), _samples(0), _w(0), _h(0)
+  {
+  for (int i = 0; i < 2; ++i)
+    {
+    _frame_buffers[i][0] = -1;
+    _frame_buffers[i][1] = -1;
+    }
+  }
+
+void progressive_accumulation::compile(RenderDoos::render_engine* engine)
+  {
+  _material.compile(engine);
+  }
+
+void progressive_accumulation::reset()
+  {
+  _samples = 0;
+  }
+
+int32_t progressive_accumulation::_texture(RenderDoos::render_engine* engine, int32_t frame_buffer_handle) const
+  {
+  return engine->get_frame_buffer(frame_buffer_handle)->texture_handle;
+  }
+
+void progressive_accumulation::_release_frame_buffers(RenderDoos::render_engine* engine)
+  {
+  if (_sample_frame_buffer >= 0)
+    engine->remove_frame_buffer(_sample_frame_buffer);
+  _sample_frame_buffer = -1;
+  for (int i = 0; i < 2; ++i)
+    {
+    for (int j = 0; j < 2; ++j)
+      {
+      if (_frame_buffers[i][j] >= 0)
+        engine->remove_frame_buffer(_frame_buffers[i][j]);
+      _frame_buffers[i][j] = -1;
+      }
+    }
+  _w = 0;
+  _h = 0;
+  }
+
+void progressive_accumulation::accumulate(RenderDoos::render_engine* engine, uint32_t geometry_id, uint32_t w, uint32_t h, const std::function<void()>& draw_sample)
+  {
+  if (w != _w || h != _h)
+    {
+    _release_frame_buffers(engine);
+    _sample_frame_buffer = engine->add_frame_buffer(w, h, false);
+    for (int i = 0; i < 2; ++i)
+      {
+      _frame_buffers[i][0] = engine->add_frame_buffer(w, h, false);
+      _frame_buffers[i][1] = engine->add_frame_buffer(w, h, false);
+      }
+    _w = w;
+    _h = h;
+    _samples = 0;
+    }
+  const RenderDoos::model_view_properties previous_props = engine->get_model_view_properties();
+  RenderDoos::model_view_properties target_props = previous_props;
+  target_props.viewport_width = w;
+  target_props.viewport_height = h;
+  engine->set_model_view_properties(target_props);
+
+  RenderDoos::renderpass_descriptor descr;
+  descr.clear_color = 0xff000000;
+  descr.clear_flags = CLEAR_COLOR;
+  descr.w = w;
+  descr.h = h;
+  descr.frame_buffer_handle = _sample_frame_buffer;
+  descr.frame_buffer_channel = 10;
+  engine->renderpass_begin(descr);
+  draw_sample();
+  engine->renderpass_end();
+
+  // the first sample replaces whatever the targets hold
+  const int target = 1 - _current;
+  _material.set_weight(1.f / (float)(_samples + 1));
+  _material.set_frame((int)_samples);
+  _material.set_textures(_texture(engine, _sample_frame_buffer), _texture(engine, _frame_buffers[_current][0]), _texture(engine, _frame_buffers[_current][1]));
+  for (int mode = mode_high; mode <= mode_low; ++mode)
+    {
+    descr.frame_buffer_handle = _frame_buffers[target][mode];
+    engine->renderpass_begin(descr);
+    _material.set_mode(mode);
+    _material.bind(engine);
+    engine->geometry_draw(geometry_id);
+    engine->renderpass_end();
+    }
+  engine->set_model_view_properties(previous_props);
+  _current = target;
+  ++_samples;
+  }
+
+void progressive_accumulation::draw(RenderDoos::render_engine* engine, uint32_t geometry_id)
+  {
+  if (_samples == 0)
+    return;
+  _material.set_mode(mode_draw);
+  _material.set_textures(-1, _texture(engine, _frame_buffers[_current][0]), _texture(engine, _frame_buffers[_current][1]));
+  _material.bind(engine);
+  engine->geometry_draw(geometry_id);
+  }
+
+void progressive_accumulation::destroy(RenderDoos::render_engine* engine)
+  {
+  _release_frame_buffers(engine);
+  _material.destroy(engine);
+  }
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+
+#include "RenderDoos/material.h"
+
+namespace RenderDoos
+  {
+  class render_engine;
+  }
+
+// Blends a new sample into the running mean of the accumulation targets (mode 0 writes the high bytes, mode 1 the
+// low bytes), or draws the mean (mode 2).
+class accumulation_material : public RenderDoos::material
+  {
+  public:
+    accumulation_material();
+    virtual ~accumulation_material();
+
+    void set_mode(int mode);
+    // weight of the new sample, 1 / (sample index + 1)
+    void set_weight(float weight);
+    // seeds the dither of the rounding
+    void set_frame(int frame);
+    void set_textures(int32_t sample_texture, int32_t high_texture, int32_t low_texture);
+
+    virtual void compile(RenderDoos::render_engine* engine);
+    virtual void bind(RenderDoos::render_engine* engine);
+    virtual void destroy(RenderDoos::render_engine* engine);
+
+  private:
+    int mode, frame;
+    float weight;
+    int32_t sample_texture, high_texture, low_texture;
+    int32_t vs_handle, fs_handle;
+    int32_t shader_program_handle;
+    int32_t proj_handle, res_handle, mode_handle, weight_handle, frame_handle;
+    int32_t sample_handle, high_handle, low_handle;
+  };
+
+// Progressive accumulation for Monte Carlo scripts that are noisy per frame: every frame renders one new sample
+// of the image, which is averaged with the previous samples, so the image converges without a higher cost per frame.
+// The script gets the sample index as iFrame, to seed its random numbers, and should keep its camera still
+// (iTime is held by the caller). reset starts over, e.g. when the script or the camera changes.
+// RenderDoos frame buffers are rgba8, so the mean is kept with 16 bits per channel split over two frame buffers with
+// the high and the low bytes (ping-ponged, as the new mean is computed from the previous one). The new mean is
+// rounded stochastically, which keeps it unbiased once a sample changes it by less than one 16 bit step.
+// The samples are clamped to [0, 1], as they pass through an rgba8 target as well.
+class progressive_accumulation
+  {
+  public:
+    progressive_accumulation();
+
+    void compile(RenderDoos::render_engine* engine);
+
+    void reset();
+    // index of the sample that the next accumulate renders
+    uint32_t sample_index() const { return _samples; }
+
+    // renders one sample with draw_sample in a w x h render pass and blends it into the mean, outside of any render
+    // pass. A new resolution starts over.
+    void accumulate(RenderDoos::render_engine* engine, uint32_t geometry_id, uint32_t w, uint32_t h, const std::function<void()>& draw_sample);
+    // draws the mean with a full screen quad in the current render pass
+    void draw(RenderDoos::render_engine* engine, uint32_t geometry_id);
+
+    void destroy(RenderDoos::render_engine* engine);
+
+  private:
+    void _release_frame_buffers(RenderDoos::render_engine* engine);
+    int32_t _texture(RenderDoos::render_engine* engine, int32_t frame_buffer_handle) const;
+
+  private:
+    accumulation_material _material;
+    int32_t _sample_frame_buffer;
+    int32_t _frame_buffers[2][2]; // [ping-pong][high, low bytes]
+    int _current; // frame buffers with the latest mean
+    uint32_t _samples;
+    uint32_t _w, _h;
+  };
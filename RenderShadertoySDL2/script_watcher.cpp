@@ -0,0 +1,84 @@
+#include "script_watcher.h"
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <sstream>
+
+namespace
+  {
+  const int poll_interval_ms = 250;
+
+  bool read_file(std::string& contents, const std::string& filename)
+    {
+    std::ifstream file(filename);
+    if (!file.is_open())
+      return false;
+    std::stringstream ss;
+    ss << file.rdbuf();
+    contents = ss.str();
+    return true;
+    }
+  }
+
+script_watcher::script_watcher() : _stop(false), _has_pending(false)
+  {
+  }
+
+script_watcher::~script_watcher()
+  {
+  stop();
+  }
+
+bool script_watcher::start(const std::string& filename)
+  {
+  stop();
+  std::string contents;
+  if (!read_file(contents, filename))
+    return false;
+  _filename = filename;
+  const size_t contents_hash = std::hash<std::string>()(contents);
+  _pending = contents;
+  _has_pending = true;
+  _stop = false;
+  _thread = std::thread(&script_watcher::_watch, this, contents_hash);
+  return true;
+  }
+
+void script_watcher::stop()
+  {
+  _stop = true;
+  if (_thread.joinable())
+    _thread.join();
+  }
+
+bool script_watcher::poll(std::string& script)
+  {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (!_has_pending)
+    return false;
+  script.swap(_pending);
+  _pending.clear();
+  _has_pending = false;
+  return true;
+  }
+
+void script_watcher::_watch(size_t last_hash)
+  {
+  std::hash<std::string> hash;
+  while (!_stop)
+    {
+    std::this_thread::sleep_for(std::chrono::milliseconds(poll_interval_ms));
+    // editors often truncate before they write, an empty file is the intermediate state
+    std::string contents;
+    if (!read_file(contents, _filename) || contents.empty())
+      continue;
+    const size_t contents_hash = hash(contents);
+    if (contents_hash == last_hash)
+      continue;
+    last_hash = contents_hash;
+    std::lock_guard<std::mutex> lock(_mutex);
+    _pending.swap(contents);
+    _has_pending = true;
+    }
+  }
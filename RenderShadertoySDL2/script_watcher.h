@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Watches a script file on a background thread: the file is read a few times per second and compared with the
+// last version by a hash of its contents, so the render loop only picks up the new text with poll. Modification
+// times are not used, as they have a resolution of a second on some file systems and miss quick saves.
+class script_watcher
+  {
+  public:
+    script_watcher();
+    ~script_watcher();
+
+    // the current contents of the file are reported by the first poll
+    bool start(const std::string& filename);
+    void stop();
+
+    // true with the new script when the file changed since the last poll
+    bool poll(std::string& script);
+
+    const std::string& filename() const { return _filename; }
+
+  private:
+    // last_hash: hash of the contents that start reported
+    void _watch(size_t last_hash);
+
+  private:
+    std::string _filename;
+    std::thread _thread;
+    std::atomic<bool> _stop;
+    std::mutex _mutex;
+    std::string _pending;
+    bool _has_pending;
+  };
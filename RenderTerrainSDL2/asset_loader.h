@@ -0,0 +1,43 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Thread pool for loading assets while the window is already presenting frames.
+// A job (e.g. decoding an image) runs on one of the worker threads; its done callback runs on the
+// render thread in update, so that is where textures are uploaded. A done callback may add new jobs
+// for work that depends on the result.
+class asset_loader
+  {
+  public:
+    // nr_of_threads <= 0 uses all hardware threads
+    explicit asset_loader(int nr_of_threads = 0);
+    ~asset_loader();
+
+    void add(std::function<void()> job, std::function<void()> done);
+
+    // runs the done callbacks of the finished jobs, returns true when no jobs are left
+    bool update();
+
+  private:
+    struct task
+      {
+      std::function<void()> job;
+      std::function<void()> done;
+      };
+
+    void _worker();
+
+  private:
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _stop;
+    std::deque<task> _requests;
+    std::vector<std::function<void()>> _finished;
+    int _pending; // jobs added and not yet handed to update
+  };
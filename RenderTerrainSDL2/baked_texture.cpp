@@ -0,0 +1,336 @@
+#include "baked_texture.h"
+#include "block_compression.h"
+#include "image.h"
+
+#include "RenderDoos/render_engine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <string.h>
+#include <sys/stat.h>
+
+namespace
+  {
+  const uint32_t baked_texture_version = 1;
+  const uint64_t level_alignment = 16;
+
+  uint32_t fnv1a(uint32_t hash, const void* data, size_t size)
+    {
+    for (size_t i = 0; i < size; ++i)
+      {
+      hash ^= ((const uint8_t*)data)[i];
+      hash *= 16777619u;
+      }
+    return hash;
+    }
+
+  uint64_t align(uint64_t offset)
+    {
+    return (offset + level_alignment - 1) / level_alignment * level_alignment;
+    }
+
+  // 2x2 box filter, odd sizes repeat the last row or column
+  void downsample(std::vector<uint32_t>& coarse, const std::vector<uint32_t>& fine, int fine_w, int fine_h)
+    {
+    const int w = std::max(fine_w / 2, 1);
+    const int h = std::max(fine_h / 2, 1);
+    coarse.resize((size_t)w * h);
+    for (int y = 0; y < h; ++y)
+      {
+      const uint32_t* row0 = fine.data() + (size_t)std::min(2 * y, fine_h - 1) * fine_w;
+      const uint32_t* row1 = fine.data() + (size_t)std::min(2 * y + 1, fine_h - 1) * fine_w;
+      for (int x = 0; x < w; ++x)
+        {
+        const int x0 = std::min(2 * x, fine_w - 1);
+        const int x1 = std::min(2 * x + 1, fine_w - 1);
+        uint32_t result = 0;
+        for (int c = 0; c < 32; c += 8)
+          {
+          const uint32_t sum = ((row0[x0] >> c) & 255) + ((row0[x1] >> c) & 255) + ((row1[x0] >> c) & 255) + ((row1[x1] >> c) & 255);
+          result |= ((sum + 2) / 4) << c;
+          }
+        coarse[(size_t)y * w + x] = result;
+        }
+      }
+    }
+
+  bool is_block_compressed(uint32_t format)
+    {
+    return format == baked_texture_format_bc1 || format == baked_texture_format_bc3 || format == baked_texture_format_bc5;
+    }
+
+  block_format to_block_format(uint32_t format)
+    {
+    switch (format)
+      {
+      case baked_texture_format_bc3: return block_format_bc3;
+      case baked_texture_format_bc5: return block_format_bc5;
+      default: return block_format_bc1;
+      }
+    }
+
+  int mip_levels(int w, int h)
+    {
+    int levels = 1;
+    while (w > 1 || h > 1)
+      {
+      w = std::max(w / 2, 1);
+      h = std::max(h / 2, 1);
+      ++levels;
+      }
+    return levels;
+    }
+  }
+
+uint64_t baked_texture_level_size(uint32_t format, uint32_t w, uint32_t h)
+  {
+  if (is_block_compressed(format))
+    return block_compressed_size(to_block_format(format), (int)w, (int)h);
+  return (uint64_t)w * h * 4;
+  }
+
+int baked_texture_channels(uint32_t format)
+  {
+  switch (format)
+    {
+    case baked_texture_format_bc1: return 3;
+    case baked_texture_format_bc5: return 2;
+    default: return 4;
+    }
+  }
+
+uint32_t baked_texture_source_key(const std::vector<std::string>& filenames)
+  {
+  uint32_t key = 2166136261u;
+  bool found = false;
+  for (const auto& filename : filenames)
+    {
+    key = fnv1a(key, filename.c_str(), filename.size() + 1);
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0)
+      continue;
+    const int64_t size = (int64_t)info.st_size;
+    const int64_t time = (int64_t)info.st_mtime;
+    key = fnv1a(key, &size, sizeof(size));
+    key = fnv1a(key, &time, sizeof(time));
+    found = true;
+    }
+  // 0 is kept for unknown sources
+  return found ? std::max(key, 1u) : 0;
+  }
+
+bool write_baked_texture(const std::string& filename, const std::vector<std::vector<uint32_t>>& texels, uint32_t width, uint32_t height, uint32_t faces, baked_texture_format format, double* psnr, uint32_t source_key)
+  {
+  if ((faces != 1 && faces != 6) || texels.empty() || texels.size() % faces != 0)
+    return false;
+  if (baked_texture_channels(format) < 4)
+    {
+    for (const auto& level : texels)
+      {
+      if (std::any_of(level.begin(), level.end(), [](uint32_t texel) { return (texel >> 24) != 255; }))
+        {
+        format = baked_texture_format_bc3;
+        break;
+        }
+      }
+    }
+  baked_texture_header header;
+  memcpy(header.magic, "RDTX", 4);
+  header.version = baked_texture_version;
+  header.format = (uint32_t)format;
+  header.width = width;
+  header.height = height;
+  header.faces = faces;
+  header.levels = (uint32_t)(texels.size() / faces);
+  header.source_key = source_key;
+
+  std::vector<baked_texture_level> levels((size_t)header.faces * header.levels);
+  uint64_t offset = align(sizeof(baked_texture_header) + levels.size() * sizeof(baked_texture_level));
+  for (uint32_t f = 0; f < header.faces; ++f)
+    {
+    int w = (int)header.width;
+    int h = (int)header.height;
+    for (uint32_t l = 0; l < header.levels; ++l)
+      {
+      baked_texture_level& level = levels[(size_t)f * header.levels + l];
+      if (texels[(size_t)f * header.levels + l].size() != (size_t)w * h)
+        return false;
+      level.width = (uint32_t)w;
+      level.height = (uint32_t)h;
+      level.offset = offset;
+      level.size = baked_texture_level_size(header.format, (uint32_t)w, (uint32_t)h);
+      offset = align(offset + level.size);
+      w = std::max(w / 2, 1);
+      h = std::max(h / 2, 1);
+      }
+    }
+
+  std::ofstream file(filename, std::ios::binary);
+  if (!file.is_open())
+    return false;
+  file.write((const char*)&header, sizeof(baked_texture_header));
+  file.write((const char*)levels.data(), levels.size() * sizeof(baked_texture_level));
+  std::vector<uint32_t> decoded;
+  std::vector<uint8_t> blocks;
+  // all channels count, also those the format does not store: they are sampled as decoded
+  const int channels = 4;
+  double squared_error = 0.0;
+  for (size_t i = 0; i < levels.size(); ++i)
+    {
+    const baked_texture_level& level = levels[i];
+    const std::vector<uint32_t>& current = texels[i];
+    file.seekp((std::streamoff)level.offset);
+    if (is_block_compressed(header.format))
+      {
+      blocks.resize((size_t)level.size);
+      block_compress(blocks.data(), current.data(), (int)level.width, (int)level.height, to_block_format(header.format));
+      file.write((const char*)blocks.data(), (std::streamsize)level.size);
+      if (i % header.levels == 0)
+        {
+        // check the encoder against the reference decoder
+        decoded.resize(current.size());
+        block_decompress(decoded.data(), blocks.data(), (int)level.width, (int)level.height, to_block_format(header.format));
+        for (size_t j = 0; j < current.size(); ++j)
+          {
+          for (int c = 0; c < channels; ++c)
+            {
+            const int d = (int)((current[j] >> (8 * c)) & 255) - (int)((decoded[j] >> (8 * c)) & 255);
+            squared_error += (double)(d * d);
+            }
+          }
+        }
+      }
+    else
+      file.write((const char*)current.data(), (std::streamsize)level.size);
+    }
+  if (psnr)
+    {
+    const double mse = squared_error / ((double)header.faces * header.width * header.height * channels);
+    *psnr = mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+    }
+  return file.good();
+  }
+
+bool bake_texture(const std::vector<std::string>& image_filenames, const std::string& filename, baked_texture_format format, double* psnr)
+  {
+  if (image_filenames.size() != 1 && image_filenames.size() != 6)
+    return false;
+  std::vector<rgba_image> images(image_filenames.size());
+  for (size_t i = 0; i < images.size(); ++i)
+    {
+    if (!read_image_from_file(images[i], image_filenames[i]))
+      return false;
+    if (images[i].w != images[0].w || images[i].h != images[0].h)
+      return false;
+    }
+  const int levels = mip_levels(images[0].w, images[0].h);
+  std::vector<std::vector<uint32_t>> texels(images.size() * levels);
+  for (size_t f = 0; f < images.size(); ++f)
+    {
+    int w = images[f].w;
+    int h = images[f].h;
+    texels[f * levels].assign(images[f].im, images[f].im + (size_t)w * h);
+    for (int l = 1; l < levels; ++l)
+      {
+      downsample(texels[f * levels + l], texels[f * levels + l - 1], w, h);
+      w = std::max(w / 2, 1);
+      h = std::max(h / 2, 1);
+      }
+    }
+  return write_baked_texture(filename, texels, (uint32_t)images[0].w, (uint32_t)images[0].h, (uint32_t)images.size(), format, psnr, baked_texture_source_key(image_filenames));
+  }
+
+baked_texture::baked_texture()
+  {
+  memset(&_header, 0, sizeof(baked_texture_header));
+  }
+
+bool baked_texture::open(const std::string& filename)
+  {
+  close();
+  if (!_file.open(filename) || _file.size() < sizeof(baked_texture_header))
+    return false;
+  memcpy(&_header, _file.data(), sizeof(baked_texture_header));
+  if (memcmp(_header.magic, "RDTX", 4) != 0 || _header.version != baked_texture_version || _header.format > baked_texture_format_bc5
+    || (_header.faces != 1 && _header.faces != 6) || _header.levels == 0)
+    {
+    close();
+    return false;
+    }
+  const size_t table_size = (size_t)_header.faces * _header.levels * sizeof(baked_texture_level);
+  if (_file.size() < sizeof(baked_texture_header) + table_size)
+    {
+    close();
+    return false;
+    }
+  _levels.resize((size_t)_header.faces * _header.levels);
+  memcpy(_levels.data(), _file.data() + sizeof(baked_texture_header), table_size);
+  for (const auto& level : _levels)
+    {
+    if (level.offset + level.size > _file.size() || level.size < baked_texture_level_size(_header.format, level.width, level.height))
+      {
+      close();
+      return false;
+      }
+    }
+  return true;
+  }
+
+void baked_texture::close()
+  {
+  _file.close();
+  _levels.clear();
+  memset(&_header, 0, sizeof(baked_texture_header));
+  }
+
+const baked_texture_level& baked_texture::level(int face, int level) const
+  {
+  return _levels[(size_t)face * _header.levels + level];
+  }
+
+const uint8_t* baked_texture::level_data(int face, int level) const
+  {
+  return _file.data() + this->level(face, level).offset;
+  }
+
+bool prepare_baked_texture(baked_texture_upload& upload, const baked_texture& texture, int level)
+  {
+  const baked_texture_header& header = texture.header();
+  if (header.levels == 0)
+    return false;
+  const int l = std::min(std::max(level, 0), (int)header.levels - 1);
+  upload.width = texture.level(0, l).width;
+  upload.height = texture.level(0, l).height;
+  upload.faces = header.faces;
+  for (uint32_t f = 0; f < header.faces; ++f)
+    {
+    upload.data[f] = texture.level_data((int)f, l);
+    if (is_block_compressed(header.format))
+      {
+      upload.decoded[f].resize((size_t)upload.width * upload.height);
+      block_decompress(upload.decoded[f].data(), upload.data[f], (int)upload.width, (int)upload.height, to_block_format(header.format));
+      upload.data[f] = (const uint8_t*)upload.decoded[f].data();
+      }
+    else
+      upload.decoded[f].clear();
+    }
+  return true;
+  }
+
+int32_t add_baked_texture(RenderDoos::render_engine* engine, const baked_texture_upload& upload)
+  {
+  if (upload.faces == 6)
+    return engine->add_cubemap_texture(upload.width, upload.height, RenderDoos::texture_format_rgba8, upload.data[0], upload.data[1], upload.data[2], upload.data[3], upload.data[4], upload.data[5]);
+  if (upload.faces == 1)
+    return engine->add_texture(upload.width, upload.height, RenderDoos::texture_format_rgba8, upload.data[0]);
+  return -1;
+  }
+
+int32_t add_baked_texture(RenderDoos::render_engine* engine, const baked_texture& texture, int first_level)
+  {
+  baked_texture_upload upload;
+  if (!prepare_baked_texture(upload, texture, first_level))
+    return -1;
+  return add_baked_texture(engine, upload);
+  }
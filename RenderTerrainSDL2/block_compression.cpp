@@ -0,0 +1,403 @@
+#include "block_compression.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+namespace
+  {
+  const int refinement_iterations = 2;
+
+  inline int channel(uint32_t texel, int c)
+    {
+    return (int)((texel >> (8 * c)) & 255);
+    }
+
+  int block_size(block_format format)
+    {
+    return format == block_format_bc1 ? 8 : 16;
+    }
+
+  // the 16 texels of block (bx, by), border blocks repeat the last row and column
+  void fetch_block(uint32_t* block, const uint32_t* rgba, int w, int h, int bx, int by)
+    {
+    for (int y = 0; y < 4; ++y)
+      {
+      const uint32_t* row = rgba + (size_t)std::min(by * 4 + y, h - 1) * w;
+      for (int x = 0; x < 4; ++x)
+        block[y * 4 + x] = row[std::min(bx * 4 + x, w - 1)];
+      }
+    }
+
+  void store_block(uint32_t* rgba, const uint32_t* block, int w, int h, int bx, int by)
+    {
+    for (int y = 0; y < 4 && by * 4 + y < h; ++y)
+      {
+      uint32_t* row = rgba + (size_t)(by * 4 + y) * w;
+      for (int x = 0; x < 4 && bx * 4 + x < w; ++x)
+        row[bx * 4 + x] = block[y * 4 + x];
+      }
+    }
+
+  inline void write16(uint8_t* dst, uint32_t v)
+    {
+    dst[0] = (uint8_t)(v & 255);
+    dst[1] = (uint8_t)(v >> 8);
+    }
+
+  inline void write32(uint8_t* dst, uint32_t v)
+    {
+    for (int i = 0; i < 4; ++i)
+      dst[i] = (uint8_t)(v >> (8 * i));
+    }
+
+  inline uint32_t read16(const uint8_t* src)
+    {
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8);
+    }
+
+  inline uint32_t read32(const uint8_t* src)
+    {
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+    }
+
+  // 565 endpoint to 8 bit rgb, as the gpu expands it
+  void unpack565(int* rgb, uint32_t c)
+    {
+    const int r = (int)((c >> 11) & 31);
+    const int g = (int)((c >> 5) & 63);
+    const int b = (int)(c & 31);
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+    }
+
+  uint32_t pack565(float r, float g, float b)
+    {
+    const int ri = std::min(std::max((int)(r * 31.f / 255.f + 0.5f), 0), 31);
+    const int gi = std::min(std::max((int)(g * 63.f / 255.f + 0.5f), 0), 63);
+    const int bi = std::min(std::max((int)(b * 31.f / 255.f + 0.5f), 0), 31);
+    return (uint32_t)((ri << 11) | (gi << 5) | bi);
+    }
+
+  // the 4 colors of a BC1 block in four color mode (c0 > c1)
+  void bc1_palette(int palette[4][3], uint32_t c0, uint32_t c1)
+    {
+    unpack565(palette[0], c0);
+    unpack565(palette[1], c1);
+    for (int c = 0; c < 3; ++c)
+      {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+      }
+    }
+
+  // nearest palette entry for every texel, returns the squared error of the block
+  int bc1_indices(int* indices, const int texels[16][3], uint32_t c0, uint32_t c1)
+    {
+    int palette[4][3];
+    bc1_palette(palette, c0, c1);
+    int error = 0;
+    for (int i = 0; i < 16; ++i)
+      {
+      int best = 0;
+      int best_error = 1 << 30;
+      for (int p = 0; p < 4; ++p)
+        {
+        const int dr = texels[i][0] - palette[p][0];
+        const int dg = texels[i][1] - palette[p][1];
+        const int db = texels[i][2] - palette[p][2];
+        const int e = dr * dr + dg * dg + db * db;
+        if (e < best_error)
+          {
+          best_error = e;
+          best = p;
+          }
+        }
+      indices[i] = best;
+      error += best_error;
+      }
+    return error;
+    }
+
+  // Endpoints on the principal axis of the colors, refined by least squares on the chosen indices.
+  void encode_bc1(uint8_t* dst, const uint32_t* block)
+    {
+    int texels[16][3];
+    float mean[3] = { 0.f, 0.f, 0.f };
+    for (int i = 0; i < 16; ++i)
+      {
+      for (int c = 0; c < 3; ++c)
+        {
+        texels[i][c] = channel(block[i], c);
+        mean[c] += (float)texels[i][c] / 16.f;
+        }
+      }
+    float cov[6] = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+    for (int i = 0; i < 16; ++i)
+      {
+      const float r = (float)texels[i][0] - mean[0];
+      const float g = (float)texels[i][1] - mean[1];
+      const float b = (float)texels[i][2] - mean[2];
+      cov[0] += r * r;
+      cov[1] += r * g;
+      cov[2] += r * b;
+      cov[3] += g * g;
+      cov[4] += g * b;
+      cov[5] += b * b;
+      }
+    // power iteration for the principal axis
+    float axis[3] = { 1.f, 1.f, 1.f };
+    for (int it = 0; it < 8; ++it)
+      {
+      const float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+      const float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+      const float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+      const float len = std::max(std::max(std::abs(x), std::abs(y)), std::abs(z));
+      if (len < 1e-6f)
+        break;
+      axis[0] = x / len;
+      axis[1] = y / len;
+      axis[2] = z / len;
+      }
+    float tmin = 1e30f;
+    float tmax = -1e30f;
+    for (int i = 0; i < 16; ++i)
+      {
+      const float t = ((float)texels[i][0] - mean[0]) * axis[0] + ((float)texels[i][1] - mean[1]) * axis[1] + ((float)texels[i][2] - mean[2]) * axis[2];
+      tmin = std::min(tmin, t);
+      tmax = std::max(tmax, t);
+      }
+    const float axis_len2 = std::max(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2], 1e-12f);
+    float e0[3], e1[3];
+    for (int c = 0; c < 3; ++c)
+      {
+      e0[c] = mean[c] + axis[c] * tmax / axis_len2;
+      e1[c] = mean[c] + axis[c] * tmin / axis_len2;
+      }
+    uint32_t c0 = pack565(e0[0], e0[1], e0[2]);
+    uint32_t c1 = pack565(e1[0], e1[1], e1[2]);
+    int indices[16];
+    int error = bc1_indices(indices, texels, c0, c1);
+
+    // least squares endpoints for the current indices: texel = a*e0 + b*e1 with (a, b) from the index
+    static const float weight0[4] = { 1.f, 0.f, 2.f / 3.f, 1.f / 3.f };
+    for (int it = 0; it < refinement_iterations && error > 0; ++it)
+      {
+      float aa = 0.f, ab = 0.f, bb = 0.f;
+      float ax[3] = { 0.f, 0.f, 0.f };
+      float bx[3] = { 0.f, 0.f, 0.f };
+      for (int i = 0; i < 16; ++i)
+        {
+        const float a = weight0[indices[i]];
+        const float b = 1.f - a;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int c = 0; c < 3; ++c)
+          {
+          ax[c] += a * (float)texels[i][c];
+          bx[c] += b * (float)texels[i][c];
+          }
+        }
+      const float det = aa * bb - ab * ab;
+      if (std::abs(det) < 1e-6f)
+        break;
+      for (int c = 0; c < 3; ++c)
+        {
+        e0[c] = (ax[c] * bb - bx[c] * ab) / det;
+        e1[c] = (bx[c] * aa - ax[c] * ab) / det;
+        }
+      const uint32_t n0 = pack565(e0[0], e0[1], e0[2]);
+      const uint32_t n1 = pack565(e1[0], e1[1], e1[2]);
+      int new_indices[16];
+      const int new_error = bc1_indices(new_indices, texels, n0, n1);
+      if (new_error >= error)
+        break;
+      c0 = n0;
+      c1 = n1;
+      error = new_error;
+      memcpy(indices, new_indices, sizeof(indices));
+      }
+
+    // four color mode needs c0 > c1, swapping the endpoints swaps indices 0 <-> 1 and 2 <-> 3
+    if (c0 < c1)
+      {
+      std::swap(c0, c1);
+      for (int i = 0; i < 16; ++i)
+        indices[i] ^= 1;
+      }
+    else if (c0 == c1)
+      {
+      for (int i = 0; i < 16; ++i)
+        indices[i] = 0;
+      }
+    uint32_t bits = 0;
+    for (int i = 0; i < 16; ++i)
+      bits |= (uint32_t)indices[i] << (2 * i);
+    write16(dst, c0);
+    write16(dst + 2, c1);
+    write32(dst + 4, bits);
+    }
+
+  void bc4_palette(int* palette, int a0, int a1)
+    {
+    palette[0] = a0;
+    palette[1] = a1;
+    if (a0 > a1)
+      {
+      for (int i = 1; i < 7; ++i)
+        palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+      }
+    else
+      {
+      for (int i = 1; i < 5; ++i)
+        palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+      palette[6] = 0;
+      palette[7] = 255;
+      }
+    }
+
+  // single channel block on the range of its values, 8 interpolated values (a0 > a1)
+  void encode_bc4(uint8_t* dst, const uint32_t* block, int c)
+    {
+    int values[16];
+    int lo = 255;
+    int hi = 0;
+    for (int i = 0; i < 16; ++i)
+      {
+      values[i] = channel(block[i], c);
+      lo = std::min(lo, values[i]);
+      hi = std::max(hi, values[i]);
+      }
+    int palette[8];
+    bc4_palette(palette, hi, lo);
+    uint64_t bits = 0;
+    for (int i = 0; i < 16 && hi > lo; ++i)
+      {
+      int best = 0;
+      int best_error = 1 << 30;
+      for (int p = 0; p < 8; ++p)
+        {
+        const int e = std::abs(values[i] - palette[p]);
+        if (e < best_error)
+          {
+          best_error = e;
+          best = p;
+          }
+        }
+      bits |= (uint64_t)best << (3 * i);
+      }
+    dst[0] = (uint8_t)hi;
+    dst[1] = (uint8_t)lo;
+    for (int i = 0; i < 6; ++i)
+      dst[2 + i] = (uint8_t)(bits >> (8 * i));
+    }
+
+  // the color block of BC3 is always in four color mode, a BC1 block with c0 <= c1 has three colors and transparent black
+  void decode_bc1(uint32_t* block, const uint8_t* src, bool four_color_mode_only)
+    {
+    const uint32_t c0 = read16(src);
+    const uint32_t c1 = read16(src + 2);
+    const uint32_t bits = read32(src + 4);
+    int palette[4][3];
+    uint32_t alphas[4] = { 255, 255, 255, 255 };
+    bc1_palette(palette, c0, c1);
+    if (c0 <= c1 && !four_color_mode_only)
+      {
+      for (int c = 0; c < 3; ++c)
+        {
+        palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+        palette[3][c] = 0;
+        }
+      alphas[3] = 0;
+      }
+    for (int i = 0; i < 16; ++i)
+      {
+      const int p = (int)((bits >> (2 * i)) & 3);
+      block[i] = (uint32_t)palette[p][0] | ((uint32_t)palette[p][1] << 8) | ((uint32_t)palette[p][2] << 16) | (alphas[p] << 24);
+      }
+    }
+
+  void decode_bc4(int* values, const uint8_t* src)
+    {
+    int palette[8];
+    bc4_palette(palette, src[0], src[1]);
+    uint64_t bits = 0;
+    for (int i = 0; i < 6; ++i)
+      bits |= (uint64_t)src[2 + i] << (8 * i);
+    for (int i = 0; i < 16; ++i)
+      values[i] = palette[(bits >> (3 * i)) & 7];
+    }
+  }
+
+size_t block_compressed_size(block_format format, int w, int h)
+  {
+  return (size_t)((w + 3) / 4) * (size_t)((h + 3) / 4) * (size_t)block_size(format);
+  }
+
+void block_compress(uint8_t* blocks, const uint32_t* rgba, int w, int h, block_format format)
+  {
+  const int bw = (w + 3) / 4;
+  const int bh = (h + 3) / 4;
+  const int size = block_size(format);
+  parallel_for(0, bh, [&](int by)
+    {
+    uint32_t block[16];
+    uint8_t* dst = blocks + (size_t)by * bw * size;
+    for (int bx = 0; bx < bw; ++bx, dst += size)
+      {
+      fetch_block(block, rgba, w, h, bx, by);
+      switch (format)
+        {
+        case block_format_bc1:
+          encode_bc1(dst, block);
+          break;
+        case block_format_bc3:
+          encode_bc4(dst, block, 3);
+          encode_bc1(dst + 8, block);
+          break;
+        case block_format_bc5:
+          encode_bc4(dst, block, 0);
+          encode_bc4(dst + 8, block, 1);
+          break;
+        }
+      }
+    });
+  }
+
+void block_decompress(uint32_t* rgba, const uint8_t* blocks, int w, int h, block_format format)
+  {
+  const int bw = (w + 3) / 4;
+  const int bh = (h + 3) / 4;
+  const int size = block_size(format);
+  parallel_for(0, bh, [&](int by)
+    {
+    uint32_t block[16];
+    int a[16], b[16];
+    const uint8_t* src = blocks + (size_t)by * bw * size;
+    for (int bx = 0; bx < bw; ++bx, src += size)
+      {
+      switch (format)
+        {
+        case block_format_bc1:
+          decode_bc1(block, src, false);
+          break;
+        case block_format_bc3:
+          decode_bc4(a, src);
+          decode_bc1(block, src + 8, true);
+          for (int i = 0; i < 16; ++i)
+            block[i] = (block[i] & 0x00ffffff) | ((uint32_t)a[i] << 24);
+          break;
+        case block_format_bc5:
+          decode_bc4(a, src);
+          decode_bc4(b, src + 8);
+          for (int i = 0; i < 16; ++i)
+            block[i] = (uint32_t)a[i] | ((uint32_t)b[i] << 8) | 0xff000000u;
+          break;
+        }
+      store_block(rgba, block, w, h, bx, by);
+      }
+    });
+  }
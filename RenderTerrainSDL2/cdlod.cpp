@@ -0,0 +1,158 @@
+#include "cdlod.h"
+#include "max_mip.h"
+#include "terrain_space.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+  {
+  bool box_intersects_sphere(const float* bmin, const float* bmax, const float* center, float radius)
+    {
+    float d2 = 0.f;
+    for (int i = 0; i < 3; ++i)
+      {
+      const float c = std::min(std::max(center[i], bmin[i]), bmax[i]);
+      d2 += (c - center[i]) * (c - center[i]);
+      }
+    return d2 <= radius * radius;
+    }
+
+  // The terrain shaders project view space (x, y, z) to s = 2*(x, y)/z with s.x in [-aspect, aspect]
+  // and s.y in [-1, 1], so the frustum side planes are |x| <= z*aspect/2 and |y| <= z/2.
+  bool box_outside_view(const float* bmin, const float* bmax, const cdlod_view& view)
+    {
+    const float half_w = view.aspect * 0.5f;
+    int outside[5] = { 0, 0, 0, 0, 0 };
+    for (int c = 0; c < 8; ++c)
+      {
+      const float p[3] = { (c & 1) ? bmax[0] : bmin[0], (c & 2) ? bmax[1] : bmin[1], (c & 4) ? bmax[2] : bmin[2] };
+      const float d[3] = { p[0] - view.position[0], p[1] - view.position[1], p[2] - view.position[2] };
+      const float vx = d[0] * view.x_axis[0] + d[1] * view.x_axis[1] + d[2] * view.x_axis[2];
+      const float vy = d[0] * view.y_axis[0] + d[1] * view.y_axis[1] + d[2] * view.y_axis[2];
+      const float vz = d[0] * view.z_axis[0] + d[1] * view.z_axis[1] + d[2] * view.z_axis[2];
+      outside[0] += vx > vz * half_w ? 1 : 0;
+      outside[1] += -vx > vz * half_w ? 1 : 0;
+      outside[2] += vy > vz * 0.5f ? 1 : 0;
+      outside[3] += -vy > vz * 0.5f ? 1 : 0;
+      outside[4] += vz < 0.f ? 1 : 0;
+      }
+    for (int i = 0; i < 5; ++i)
+      {
+      if (outside[i] == 8)
+        return true;
+      }
+    return false;
+    }
+  }
+
+cdlod_view make_cdlod_view(const float* camera, float aspect, float eye_height)
+  {
+  cdlod_view view;
+  for (int i = 0; i < 3; ++i)
+    {
+    view.x_axis[i] = camera[i];
+    view.y_axis[i] = camera[4 + i];
+    view.z_axis[i] = camera[8 + i];
+    view.position[i] = camera[12 + i];
+    }
+  view.position[1] += eye_height;
+  view.aspect = aspect;
+  return view;
+  }
+
+cdlod_quadtree::cdlod_quadtree() : grid_dim(32), lod_levels(7), finest_range(4.f),
+  origin_x(terrain_u_to_world(0.f)), origin_z(terrain_v_to_world(0.f)), root_size(terrain_u_to_world(1.f) - terrain_u_to_world(0.f))
+  {
+  max_height = [](float, float, float, int) { return terrain_height_scale; };
+  }
+
+void cdlod_quadtree::init(const max_mip_pyramid* pyramid, int heightmap_w, int heightmap_h)
+  {
+  // the whole heightmap texture, as rendered by the raymarcher
+  origin_x = terrain_u_to_world(0.f);
+  origin_z = terrain_v_to_world(0.f);
+  root_size = terrain_u_to_world(1.f) - origin_x;
+  max_height = [pyramid, heightmap_w, heightmap_h](float x, float z, float size, int)
+    {
+    return max_height_in_region(*pyramid, heightmap_w, heightmap_h, x, z, size);
+    };
+  }
+
+float cdlod_quadtree::_range(int lod) const
+  {
+  return finest_range * (float)(1 << lod);
+  }
+
+float max_height_in_region(const max_mip_pyramid& pyramid, int heightmap_w, int heightmap_h, float x, float z, float size)
+  {
+  const float x0 = terrain_world_to_u(x) * heightmap_w;
+  const float x1 = terrain_world_to_u(x + size) * heightmap_w;
+  const float y0 = terrain_world_to_v(z) * heightmap_h;
+  const float y1 = terrain_world_to_v(z + size) * heightmap_h;
+  int level = 0;
+  while (level + 1 < pyramid.levels && (float)(1 << level) < std::max(x1 - x0, y1 - y0))
+    ++level;
+  const float cell = (float)(1 << level);
+  const int cx0 = (int)std::floor(x0 / cell);
+  const int cx1 = (int)std::floor(x1 / cell);
+  const int cy0 = (int)std::floor(y0 / cell);
+  const int cy1 = (int)std::floor(y1 / cell);
+  float m = 0.f;
+  for (int cy = cy0; cy <= cy1; ++cy)
+    for (int cx = cx0; cx <= cx1; ++cx)
+      m = std::max(m, pyramid.get(level, cx, cy));
+  return m * terrain_height_scale;
+  }
+
+bool cdlod_quadtree::_select(std::vector<cdlod_node>& selected, const cdlod_view& view, float x, float z, float size, int lod) const
+  {
+  const float bmin[3] = { x, 0.f, z };
+  const float bmax[3] = { x + size, max_height(x, z, size, lod), z + size };
+  if (!box_intersects_sphere(bmin, bmax, view.position, _range(lod)))
+    return false;
+  if (box_outside_view(bmin, bmax, view))
+    return true; // handled: nothing to draw
+  cdlod_node node;
+  node.x = x;
+  node.z = z;
+  node.size = size;
+  node.lod = lod;
+  node.morph_end = _range(lod);
+  node.morph_start = node.morph_end * 0.7f;
+  if (lod == 0 || !box_intersects_sphere(bmin, bmax, view.position, _range(lod - 1)))
+    {
+    selected.push_back(node);
+    return true;
+    }
+  const float half = size * 0.5f;
+  for (int c = 0; c < 4; ++c)
+    {
+    const float cx = x + ((c & 1) ? half : 0.f);
+    const float cz = z + ((c & 2) ? half : 0.f);
+    if (!_select(selected, view, cx, cz, half, lod - 1))
+      {
+      // the child is out of range of its own level: draw it fully morphed, which matches this level
+      const float cmin[3] = { cx, 0.f, cz };
+      const float cmax[3] = { cx + half, max_height(cx, cz, half, lod - 1), cz + half };
+      if (box_outside_view(cmin, cmax, view))
+        continue;
+      cdlod_node child;
+      child.x = cx;
+      child.z = cz;
+      child.size = half;
+      child.lod = lod - 1;
+      child.morph_end = _range(lod - 1);
+      child.morph_start = child.morph_end * 0.7f;
+      selected.push_back(child);
+      }
+    }
+  return true;
+  }
+
+void cdlod_quadtree::select(std::vector<cdlod_node>& selected, const cdlod_view& view) const
+  {
+  selected.clear();
+  const int top = lod_levels - 1;
+  _select(selected, view, origin_x, origin_z, root_size, top);
+  }
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+struct max_mip_pyramid;
+
+struct cdlod_node
+  {
+  float x, z;   // world position of the node corner with minimal x and z
+  float size;   // world size of the node
+  int lod;      // 0 is the finest level
+  float morph_start, morph_end;
+  };
+
+struct cdlod_view
+  {
+  float position[3];
+  float x_axis[3], y_axis[3], z_axis[3];
+  float aspect;
+  };
+
+// camera is the column major camera space matrix passed as Camera to the terrain shaders, the eye is eye_height
+// above its translation (terrain_camera_height_offset for the heightmap terrain)
+cdlod_view make_cdlod_view(const float* camera, float aspect, float eye_height);
+
+// Continuous distance-dependent level of detail selection over a quadtree covering the terrain.
+// Every selected node is drawn with the same grid mesh of grid_dim x grid_dim quads; the vertex
+// shader morphs the grid towards the next coarser level between morph_start and morph_end.
+class cdlod_quadtree
+  {
+  public:
+    cdlod_quadtree();
+
+    // covers the terrain of the demo heightmap, with height bounds taken from its max-mip pyramid
+    void init(const max_mip_pyramid* pyramid, int heightmap_w, int heightmap_h);
+
+    void select(std::vector<cdlod_node>& selected, const cdlod_view& view) const;
+
+    int grid_dim;
+    int lod_levels;
+    float finest_range;
+    float origin_x, origin_z, root_size;
+    // returns the maximum world height inside the node with corner (x, z), the given size and level of detail
+    std::function<float(float x, float z, float size, int lod)> max_height;
+
+  private:
+    bool _select(std::vector<cdlod_node>& selected, const cdlod_view& view, float x, float z, float size, int lod) const;
+    float _range(int lod) const;
+  };
+
+// Maximum height in the world square with corner (x, z) and the given size, read from the max-mip pyramid.
+float max_height_in_region(const max_mip_pyramid& pyramid, int heightmap_w, int heightmap_h, float x, float z, float size);
@@ -0,0 +1,147 @@
+#include "dynamic_resolution.h"
+
+#include "RenderDoos/render_engine.h"
+#include "RenderDoos/types.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+  {
+  const int scale_steps = 16;
+  const size_t max_cached_targets = 3;
+  // frames to wait after a change before lowering or raising the scale again
+  const int frames_before_decrease = 8;
+  const int frames_before_increase = 30;
+  }
+
+dynamic_resolution::dynamic_resolution() : _enabled(false), _target_ms(1000.0 / 60.0), _average_ms(0.0),
+  _min_step(scale_steps / 2), _max_step(scale_steps), _step(scale_steps), _frames_since_change(0), _frame(0),
+  _current_target(-1), _blit_compiled(false)
+  {
+  }
+
+void dynamic_resolution::set_enabled(bool enable)
+  {
+  _enabled = enable;
+  _average_ms = 0.0;
+  _frames_since_change = 0;
+  }
+
+void dynamic_resolution::set_target_frame_time(double milliseconds)
+  {
+  _target_ms = milliseconds;
+  }
+
+void dynamic_resolution::set_scale_range(float min_scale, float max_scale)
+  {
+  _min_step = std::max(1, (int)std::ceil(min_scale * scale_steps));
+  _max_step = std::max(_min_step, (int)std::floor(max_scale * scale_steps));
+  _step = std::min(std::max(_step, _min_step), _max_step);
+  }
+
+void dynamic_resolution::frame_started()
+  {
+  _start = std::chrono::high_resolution_clock::now();
+  }
+
+void dynamic_resolution::frame_finished()
+  {
+  ++_frame;
+  if (!_enabled)
+    return;
+  const double ms = (double)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - _start).count() / 1000.0;
+  _average_ms = _average_ms > 0.0 ? _average_ms * 0.9 + ms * 0.1 : ms;
+  ++_frames_since_change;
+  // the cost of a full screen pass is proportional to the number of pixels, i.e. to the square of the scale
+  int new_step = _step;
+  if (_frames_since_change >= frames_before_decrease && _average_ms > _target_ms * 1.05 && _step > _min_step)
+    {
+    const double wanted = (double)_step * std::sqrt(_target_ms / _average_ms);
+    new_step = std::max(_min_step, std::min(_step - 1, (int)std::floor(wanted)));
+    }
+  else if (_frames_since_change >= frames_before_increase && _step < _max_step)
+    {
+    const double ratio = (double)(_step + 1) / (double)_step;
+    if (_average_ms * ratio * ratio < _target_ms * 0.9)
+      new_step = _step + 1;
+    }
+  if (new_step != _step)
+    {
+    // predict the frame time at the new scale, so the next decision does not wait for the average to settle
+    const double ratio = (double)new_step / (double)_step;
+    _average_ms *= ratio * ratio;
+    _step = new_step;
+    _frames_since_change = 0;
+    }
+  }
+
+float dynamic_resolution::scale() const
+  {
+  return _enabled ? (float)_step / (float)scale_steps : 1.f;
+  }
+
+void dynamic_resolution::scaled_size(uint32_t& scaled_w, uint32_t& scaled_h, uint32_t w, uint32_t h) const
+  {
+  const int step = _enabled ? _step : scale_steps;
+  scaled_w = std::max<uint32_t>(1, (w * step + scale_steps - 1) / scale_steps);
+  scaled_h = std::max<uint32_t>(1, (h * step + scale_steps - 1) / scale_steps);
+  }
+
+int32_t dynamic_resolution::render_target(RenderDoos::render_engine* engine, uint32_t w, uint32_t h)
+  {
+  uint32_t scaled_w, scaled_h;
+  scaled_size(scaled_w, scaled_h, w, h);
+  auto it = std::find_if(_targets.begin(), _targets.end(), [&](const cached_target& t)
+    {
+    return t.w == scaled_w && t.h == scaled_h;
+    });
+  if (it == _targets.end())
+    {
+    if (_targets.size() >= max_cached_targets)
+      {
+      auto oldest = std::min_element(_targets.begin(), _targets.end(), [](const cached_target& left, const cached_target& right)
+        {
+        return left.last_used_frame < right.last_used_frame;
+        });
+      engine->remove_frame_buffer(oldest->frame_buffer_id);
+      _targets.erase(oldest);
+      }
+    cached_target target;
+    target.w = scaled_w;
+    target.h = scaled_h;
+    target.frame_buffer_id = engine->add_frame_buffer(scaled_w, scaled_h, false);
+    _targets.push_back(target);
+    it = _targets.end() - 1;
+    }
+  it->last_used_frame = _frame;
+  _current_target = it->frame_buffer_id;
+  return _current_target;
+  }
+
+void dynamic_resolution::present(RenderDoos::render_engine* engine, uint32_t geometry_id)
+  {
+  if (_current_target < 0)
+    return;
+  if (!_blit_compiled)
+    {
+    _blit.compile(engine);
+    _blit_compiled = true;
+    }
+  _blit.set_texture(engine->get_frame_buffer(_current_target)->texture_handle, TEX_WRAP_CLAMP_TO_EDGE | TEX_FILTER_LINEAR);
+  _blit.bind(engine);
+  engine->geometry_draw(geometry_id);
+  }
+
+void dynamic_resolution::destroy(RenderDoos::render_engine* engine)
+  {
+  for (const auto& target : _targets)
+    engine->remove_frame_buffer(target.frame_buffer_id);
+  _targets.clear();
+  _current_target = -1;
+  if (_blit_compiled)
+    {
+    _blit.destroy(engine);
+    _blit_compiled = false;
+    }
+  }
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+#include <vector>
+
+#include "RenderDoos/material.h"
+
+namespace RenderDoos
+  {
+  class render_engine;
+  }
+
+// Render scale controller: scales the resolution of an intermediate render target so that the
+// measured frame time stays close to a target frame time.
+// The frame time is measured from frame_started (before engine.frame_begin) to frame_finished
+// (after engine.frame_end(true)), so it includes the time the gpu needs to finish the frame.
+// The scale is quantized in steps of 1/16 and the render targets of the most recently used steps
+// are kept, so that switching back and forth between two scales does not reallocate frame buffers.
+// It is disabled by default, because waiting for the gpu at the end of every frame stalls the pipeline.
+class dynamic_resolution
+  {
+  public:
+    dynamic_resolution();
+
+    void set_enabled(bool enable);
+    bool enabled() const { return _enabled; }
+
+    void set_target_frame_time(double milliseconds);
+    void set_scale_range(float min_scale, float max_scale);
+
+    void frame_started();
+    void frame_finished();
+
+    // current scale of the render target relative to the window, 1 when disabled
+    float scale() const;
+    // size of the render target for a window of w x h pixels
+    void scaled_size(uint32_t& scaled_w, uint32_t& scaled_h, uint32_t w, uint32_t h) const;
+
+    // frame buffer of scaled_size(w, h) at the current scale
+    int32_t render_target(RenderDoos::render_engine* engine, uint32_t w, uint32_t h);
+    // draws the last render target with bilinear filtering using a full screen quad
+    void present(RenderDoos::render_engine* engine, uint32_t geometry_id);
+
+    void destroy(RenderDoos::render_engine* engine);
+
+  private:
+    struct cached_target
+      {
+      uint32_t w, h;
+      int32_t frame_buffer_id;
+      uint64_t last_used_frame;
+      };
+
+  private:
+    bool _enabled;
+    double _target_ms;
+    double _average_ms;
+    int _min_step, _max_step;
+    int _step;
+    int _frames_since_change;
+    uint64_t _frame;
+    std::chrono::high_resolution_clock::time_point _start;
+    std::vector<cached_target> _targets;
+    int32_t _current_target;
+    RenderDoos::simple_material _blit;
+    bool _blit_compiled;
+  };
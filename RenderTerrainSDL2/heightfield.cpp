@@ -0,0 +1,232 @@
+#include "heightfield.h"
+#include "image.h"
+#include "terrain_space.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+  {
+  // positions are processed in batches of fixed size with plain loops over the batch,
+  // so the compiler can vectorize the coordinate and filter arithmetic (sse or neon)
+  const int batch = 8;
+  const int max_intersect_steps = 4096;
+  const int substeps = 8; // height tests per finest pyramid cell that the ray does not skip
+  const int bisection_steps = 10;
+
+  inline int wrap(int v, int n)
+    {
+    return (v >= 0 && v < n) ? v : ((v % n) + n) % n;
+    }
+  }
+
+heightfield::heightfield() : _w(0), _h(0), _height_scale(1.f), _repeat(false), _pyramid(nullptr)
+  {
+  }
+
+void heightfield::init(const height_image& heights, const max_mip_pyramid* pyramid, float height_scale, bool repeat)
+  {
+  _w = heights.w;
+  _h = heights.h;
+  _height_scale = height_scale;
+  _repeat = repeat;
+  _heights.resize((size_t)_w * _h);
+  const float s = height_scale / 65535.f;
+  for (size_t i = 0; i < _heights.size(); ++i)
+    _heights[i] = (float)heights.im[i] * s;
+  _pyramid = pyramid;
+  }
+
+float heightfield::height(float x, float z) const
+  {
+  float result;
+  heights(&result, &x, &z, 1);
+  return result;
+  }
+
+void heightfield::heights(float* result, const float* x, const float* z, size_t n) const
+  {
+  if (_heights.empty())
+    {
+    std::fill(result, result + n, 0.f);
+    return;
+    }
+  const float fw = (float)_w;
+  const float fh = (float)_h;
+  float u[batch], v[batch], tx[batch], ty[batch];
+  float h00[batch], h10[batch], h01[batch], h11[batch];
+  int ix[batch], iy[batch];
+  bool inside[batch];
+  for (size_t first = 0; first < n; first += batch)
+    {
+    const int count = (int)std::min<size_t>(batch, n - first);
+    for (int i = 0; i < batch; ++i)
+      {
+      // tail entries repeat the last position, so the loops below keep their fixed length
+      const size_t j = first + std::min(i, count - 1);
+      u[i] = terrain_world_to_u(x[j]);
+      v[i] = terrain_world_to_v(z[j]);
+      }
+    // bilinear filtering as the gpu does it: texel centers at half integers, repeat wrapping
+    for (int i = 0; i < batch; ++i)
+      {
+      inside[i] = _repeat || (u[i] >= 0.f && u[i] < 1.f && v[i] >= 0.f && v[i] < 1.f);
+      const float px = u[i] * fw - 0.5f;
+      const float py = v[i] * fh - 0.5f;
+      const float fx = std::floor(px);
+      const float fy = std::floor(py);
+      tx[i] = px - fx;
+      ty[i] = py - fy;
+      ix[i] = (int)fx;
+      iy[i] = (int)fy;
+      }
+    for (int i = 0; i < batch; ++i)
+      {
+      const int x0 = wrap(ix[i], _w);
+      const int x1 = x0 + 1 == _w ? 0 : x0 + 1;
+      const float* row0 = _heights.data() + (size_t)wrap(iy[i], _h) * _w;
+      const float* row1 = _heights.data() + (size_t)wrap(iy[i] + 1, _h) * _w;
+      h00[i] = row0[x0];
+      h10[i] = row0[x1];
+      h01[i] = row1[x0];
+      h11[i] = row1[x1];
+      }
+    for (int i = 0; i < batch; ++i)
+      {
+      const float h0 = h00[i] + (h10[i] - h00[i]) * tx[i];
+      const float h1 = h01[i] + (h11[i] - h01[i]) * tx[i];
+      h00[i] = inside[i] ? h0 + (h1 - h0) * ty[i] : 0.f;
+      }
+    std::copy(h00, h00 + count, result + first);
+    }
+  }
+
+void heightfield::normals(float* normal_x, float* normal_y, float* normal_z, const float* x, const float* z, size_t n) const
+  {
+  // one texel in world units, see terrain_space.h
+  const float ex = 1.f / (0.01f * (float)std::max(_w, 1));
+  const float ez = 1.f / (0.01f * (float)std::max(_h, 1));
+  float px[4 * batch], pz[4 * batch], h[4 * batch];
+  for (size_t first = 0; first < n; first += batch)
+    {
+    const int count = (int)std::min<size_t>(batch, n - first);
+    for (int i = 0; i < batch; ++i)
+      {
+      const size_t j = first + std::min(i, count - 1);
+      px[i] = x[j] + ex;
+      pz[i] = z[j];
+      px[batch + i] = x[j] - ex;
+      pz[batch + i] = z[j];
+      px[2 * batch + i] = x[j];
+      pz[2 * batch + i] = z[j] + ez;
+      px[3 * batch + i] = x[j];
+      pz[3 * batch + i] = z[j] - ez;
+      }
+    heights(h, px, pz, 4 * batch);
+    for (int i = 0; i < batch; ++i)
+      {
+      const float dx = -(h[i] - h[batch + i]) / (2.f * ex);
+      const float dz = -(h[2 * batch + i] - h[3 * batch + i]) / (2.f * ez);
+      const float inv_len = 1.f / std::sqrt(dx * dx + dz * dz + 1.f);
+      px[i] = dx * inv_len;
+      pz[i] = dz * inv_len;
+      h[i] = inv_len;
+      }
+    std::copy(px, px + count, normal_x + first);
+    std::copy(h, h + count, normal_y + first);
+    std::copy(pz, pz + count, normal_z + first);
+    }
+  }
+
+float heightfield::_max_height(int level, int cell_x, int cell_y) const
+  {
+  const int lw = std::max(_pyramid->base_w >> level, 1);
+  const int lh = std::max(_pyramid->base_h >> level, 1);
+  if (_repeat)
+    {
+    cell_x = wrap(cell_x, lw);
+    cell_y = wrap(cell_y, lh);
+    }
+  return _pyramid->get(level, cell_x, cell_y) * _height_scale;
+  }
+
+// Same walk over the max-mip pyramid as skipEmptySpace in the raymarch shader: cells that the ray passes above
+// are stepped over, otherwise we descend. A finest cell that is not skipped is tested at a few points along the
+// ray, and the first crossing below the surface is refined by bisection.
+bool heightfield::intersect(float& t, float origin_x, float origin_y, float origin_z, float direction_x, float direction_y, float direction_z, float max_distance) const
+  {
+  if (_heights.empty() || !_pyramid)
+    return false;
+  const int top = std::max(_pyramid->levels - 1, 0);
+  // heightmap texel coordinates along the ray, see terrain_space.h
+  const float ax = terrain_world_to_u(origin_x) * (float)_w;
+  const float ay = terrain_world_to_v(origin_z) * (float)_h;
+  const float bx = 0.01f * direction_x * (float)_w;
+  const float by = 0.01f * direction_z * (float)_h;
+  const float inv_bx = std::abs(bx) > 1e-8f ? 1.f / bx : 1e8f;
+  const float inv_by = std::abs(by) > 1e-8f ? 1.f / by : 1e8f;
+  const float step_x = bx >= 0.f ? 1.f : 0.f;
+  const float step_y = by >= 0.f ? 1.f : 0.f;
+  auto above = [&](float s)
+    {
+    return origin_y + direction_y * s - height(origin_x + direction_x * s, origin_z + direction_z * s);
+    };
+  if (above(0.f) <= 0.f)
+    {
+    t = 0.f;
+    return true;
+    }
+  float s = 0.f;
+  int level = std::min(top, 5);
+  for (int i = 0; i < max_intersect_steps && s <= max_distance; ++i)
+    {
+    const float cell_size = (float)(1 << level);
+    const int cell_x = (int)std::floor((ax + bx * s) / cell_size);
+    const int cell_y = (int)std::floor((ay + by * s) / cell_size);
+    const float hmax = _max_height(level, cell_x, cell_y);
+    const float tbx = (((float)cell_x + step_x) * cell_size - ax) * inv_bx;
+    const float tby = (((float)cell_y + step_y) * cell_size - ay) * inv_by;
+    const float s_exit = std::min(std::max(std::min(tbx, tby), s), max_distance);
+    const float ymin = std::min(origin_y + direction_y * s, origin_y + direction_y * s_exit);
+    if (ymin > hmax)
+      {
+      s = s_exit + 1e-4f;
+      level = std::min(level + 1, top);
+      continue;
+      }
+    if (level > 0)
+      {
+      // the ray enters this cell above its maximum, so nothing is hit before it drops below it
+      if (direction_y < 0.f)
+        s = std::max(s, (hmax - origin_y) / direction_y);
+      --level;
+      continue;
+      }
+    float s_prev = s;
+    for (int k = 1; k <= substeps; ++k)
+      {
+      const float s_next = s + (s_exit - s) * (float)k / (float)substeps;
+      if (above(s_next) <= 0.f)
+        {
+        float lo = s_prev;
+        float hi = s_next;
+        for (int b = 0; b < bisection_steps; ++b)
+          {
+          const float mid = 0.5f * (lo + hi);
+          if (above(mid) <= 0.f)
+            hi = mid;
+          else
+            lo = mid;
+          }
+        t = hi;
+        return true;
+        }
+      s_prev = s_next;
+      }
+    if (s_exit >= max_distance)
+      break;
+    s = s_exit + 1e-4f;
+    level = std::min(level + 1, top);
+    }
+  return false;
+  }
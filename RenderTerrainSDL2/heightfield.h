@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+#include "max_mip.h"
+
+struct height_image;
+
+// CPU copy of the terrain for collision and camera logic, in the world space of terrain_space.h:
+// height(x, z) returns the same bilinearly filtered height as terrain() in the raymarch shader,
+// so it is 0 outside the heightmap region unless the heightfield repeats (procedural terrain).
+// The batched queries take structure-of-arrays positions and are evaluated in fixed size batches
+// of plain loops that the compiler can vectorize; only the texel gathers are scalar.
+class heightfield
+  {
+  public:
+    heightfield();
+
+    // pyramid is the max-mip pyramid of heights for ray intersections, it is referenced and must outlive the heightfield.
+    // repeat requires power of two dimensions
+    void init(const height_image& heights, const max_mip_pyramid* pyramid, float height_scale, bool repeat);
+
+    int width() const { return _w; }
+    int height() const { return _h; }
+
+    float height(float x, float z) const;
+    void heights(float* result, const float* x, const float* z, size_t n) const;
+
+    // unit world space normals of the filtered surface, from central differences over one texel
+    void normals(float* normal_x, float* normal_y, float* normal_z, const float* x, const float* z, size_t n) const;
+
+    // first hit of the ray origin + t*direction with t in [0, max_distance], direction need not be normalized
+    bool intersect(float& t, float origin_x, float origin_y, float origin_z, float direction_x, float direction_y, float direction_z, float max_distance) const;
+
+  private:
+    float _max_height(int level, int cell_x, int cell_y) const;
+
+  private:
+    int _w, _h;
+    float _height_scale;
+    bool _repeat;
+    std::vector<float> _heights; // world heights
+    const max_mip_pyramid* _pyramid;
+  };
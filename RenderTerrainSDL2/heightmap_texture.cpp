@@ -0,0 +1,47 @@
+#include "heightmap_texture.h"
+#include "image.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+void make_heightmap_texture(rgba_image& texture, const height_image& heights, float normal_strength)
+  {
+  const int w = heights.w;
+  const int h = heights.h;
+  texture.allocate(w, h);
+  const float s = normal_strength / 65535.f * 0.5f; // central differences over 16 bit heights
+  parallel_for(0, h, [&](int y)
+    {
+    // the heightmap is sampled with repeat wrapping, so the differences wrap as well
+    const uint16_t* above = heights.im + (size_t)((y + h - 1) % h) * w;
+    const uint16_t* row = heights.im + (size_t)y * w;
+    const uint16_t* below = heights.im + (size_t)((y + 1) % h) * w;
+    std::vector<float> gx(w), gy(w);
+    for (int x = 0; x < w; ++x)
+      {
+      const int left = x == 0 ? w - 1 : x - 1;
+      const int right = x == w - 1 ? 0 : x + 1;
+      gx[x] = (float)row[right] - (float)row[left];
+      gy[x] = (float)below[x] - (float)above[x];
+      }
+    // straight float loop over the gradients so the compiler can vectorize the normalization
+    std::vector<float> nx(w), ny(w);
+    for (int x = 0; x < w; ++x)
+      {
+      const float dx = -gx[x] * s;
+      const float dy = -gy[x] * s;
+      const float inv_len = 1.f / std::sqrt(dx * dx + dy * dy + 1.f);
+      nx[x] = dx * inv_len * 127.5f + 128.f;
+      ny[x] = dy * inv_len * 127.5f + 128.f;
+      }
+    uint32_t* dst = texture.im + (size_t)y * w;
+    for (int x = 0; x < w; ++x)
+      {
+      const uint32_t b = (uint32_t)std::min(nx[x], 255.f);
+      const uint32_t a = (uint32_t)std::min(ny[x], 255.f);
+      dst[x] = (uint32_t)(row[x] >> 8) | ((uint32_t)(row[x] & 255) << 8) | (b << 16) | (a << 24);
+      }
+    });
+  }
@@ -0,0 +1,13 @@
+#pragma once
+
+struct rgba_image;
+struct height_image;
+
+// The terrain shaders read heights and normals from a single rgba8 texture:
+// red and green hold the high and low byte of the 16 bit height, so bilinear filtering of both channels
+// followed by dot(rg, vec2(65280, 255)/65535) gives the filtered 16 bit height;
+// blue and alpha hold x and y of the z-up normal (tangent space of the heightmap image) encoded as n*0.5+0.5,
+// z is reconstructed in the shaders as sqrt(1 - x*x - y*y).
+// The normals are derived from the heights with central differences. normal_strength converts height
+// differences to slopes: a normalized height difference d between neighbouring texels gives a slope of d*normal_strength.
+void make_heightmap_texture(rgba_image& texture, const height_image& heights, float normal_strength);
@@ -0,0 +1,128 @@
+#include "horizon_map.h"
+#include "image.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace
+  {
+  const int horizon_directions = 8;
+  const float pi = 3.14159265358979f;
+
+  struct sample_offset
+    {
+    int dx, dy;      // texel offset of the bilinear footprint
+    float tx, ty;    // bilinear weights
+    float distance;  // world distance to the sample
+    };
+
+  inline int wrap(int i, int n)
+    {
+    return (i >= 0 && i < n) ? i : ((i % n) + n) % n;
+    }
+  }
+
+void make_horizon_maps(rgba_image& horizon0, rgba_image& horizon1, const height_image& heights, float texel_size, float height_scale, int max_distance,
+  int x0, int y0, int x1, int y1, bool repeat)
+  {
+  const int w = heights.w;
+  const int h = heights.h;
+  // texels that contribute to the rendered terrain
+  const int left = repeat ? 0 : std::max(x0 - 1, 0);
+  const int top = repeat ? 0 : std::max(y0 - 1, 0);
+  const int right = repeat ? w : std::min(x1 + 1, w);
+  const int bottom = repeat ? h : std::min(y1 + 1, h);
+  std::vector<float> world_heights((size_t)w * h);
+  float highest = 0.f;
+  for (int y = 0; y < h; ++y)
+    {
+    for (int x = 0; x < w; ++x)
+      {
+      const size_t i = (size_t)y * w + x;
+      world_heights[i] = (float)heights.im[i] / 65535.f * height_scale;
+      if (x >= left && x < right && y >= top && y < bottom)
+        highest = std::max(highest, world_heights[i]);
+      }
+    }
+
+  // sample distances in texels: single texel steps close by, growing by an eighth of the distance further away
+  std::vector<float> distances;
+  for (float d = 1.f; d <= (float)max_distance; d += std::max(1.f, std::floor(d / 8.f)))
+    distances.push_back(d);
+
+  // the offsets of the samples along a direction are the same for every texel
+  std::vector<sample_offset> offsets[horizon_directions];
+  for (int k = 0; k < horizon_directions; ++k)
+    {
+    const float dir_x = std::cos((float)k * 2.f * pi / (float)horizon_directions);
+    const float dir_y = std::sin((float)k * 2.f * pi / (float)horizon_directions);
+    for (float d : distances)
+      {
+      const float px = dir_x * d;
+      const float py = dir_y * d;
+      sample_offset o;
+      o.dx = (int)std::floor(px);
+      o.dy = (int)std::floor(py);
+      o.tx = px - (float)o.dx;
+      o.ty = py - (float)o.dy;
+      o.distance = d * texel_size;
+      offsets[k].push_back(o);
+      }
+    }
+
+  rgba_image* maps[2] = { &horizon0, &horizon1 };
+  for (rgba_image* m : maps)
+    {
+    m->allocate(w, h);
+    std::fill(m->im, m->im + (size_t)w * h, 0u);
+    }
+
+  parallel_for(top, bottom, [&](int y)
+    {
+    const float* row = world_heights.data() + (size_t)y * w;
+    uint32_t* dst[2] = { horizon0.im + (size_t)y * w, horizon1.im + (size_t)y * w };
+    for (int k = 0; k < horizon_directions; ++k)
+      {
+      for (int x = left; x < right; ++x)
+        {
+        const float h0 = row[x];
+        float slope = 0.f;
+        for (const sample_offset& o : offsets[k])
+          {
+          // no texel further away can rise above the current horizon
+          if (highest - h0 < slope * o.distance)
+            break;
+          int sy0, sy1, sx0, sx1;
+          if (repeat)
+            {
+            sy0 = wrap(y + o.dy, h);
+            sy1 = sy0 + 1 == h ? 0 : sy0 + 1;
+            sx0 = wrap(x + o.dx, w);
+            sx1 = sx0 + 1 == w ? 0 : sx0 + 1;
+            }
+          else
+            {
+            // the region is convex, a ray that left it stays outside, where the terrain is flat at height 0
+            sy0 = y + o.dy;
+            sx0 = x + o.dx;
+            if (sy0 < top || sy0 >= bottom || sx0 < left || sx0 >= right)
+              break;
+            sy1 = std::min(sy0 + 1, bottom - 1);
+            sx1 = std::min(sx0 + 1, right - 1);
+            }
+          const float* row0 = world_heights.data() + (size_t)sy0 * w;
+          const float* row1 = world_heights.data() + (size_t)sy1 * w;
+          const float hs = (row0[sx0] * (1.f - o.tx) + row0[sx1] * o.tx) * (1.f - o.ty) + (row1[sx0] * (1.f - o.tx) + row1[sx1] * o.tx) * o.ty;
+          slope = std::max(slope, (hs - h0) / o.distance);
+          }
+        const uint32_t angle = std::min<uint32_t>((uint32_t)(std::atan(slope) / (0.5f * pi) * 255.f + 0.5f), 255);
+        if (k % 4 == 0)
+          dst[k / 4][x] = angle;
+        else
+          dst[k / 4][x] |= angle << (8 * (k % 4));
+        }
+      }
+    });
+  }
@@ -0,0 +1,16 @@
+#pragma once
+
+struct rgba_image;
+struct height_image;
+
+// Horizon maps for terrain shadows. For every heightmap texel and for 8 azimuths (k*45 degrees, measured
+// from the +x axis of the image towards +y) the elevation angle of the horizon is stored as angle/(pi/2).
+// horizon0 holds the azimuths 0..3 in red, green, blue and alpha, horizon1 the azimuths 4..7.
+// A point is lit when the elevation of the sun is above the horizon in the direction of the sun.
+// texel_size is the world size of a texel, height_scale the world height of a normalized height of 1.
+// The horizon is searched up to max_distance texels.
+// Only the texels [x0, x1) x [y0, y1) are rendered, the terrain is flat at height 0 around them: the rays end where
+// they leave the region (extended by the texel ring that bilinear filtering reads at its border), and the texels
+// outside it have no horizon. With repeat the region must be the whole heightmap, which then wraps at its borders.
+void make_horizon_maps(rgba_image& horizon0, rgba_image& horizon1, const height_image& heights, float texel_size, float height_scale, int max_distance,
+  int x0, int y0, int x1, int y1, bool repeat);
@@ -3,25 +3,86 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "../stb/stb_image.h"
 
-rgba_image::rgba_image() : im(nullptr)
+#include "mapped_file.h"
+
+namespace
+  {
+  template <class TImage>
+  void release(TImage& image)
+    {
+    if (image.decoder_owned)
+      stbi_image_free(image.im);
+    else
+      delete [] image.im;
+    image.im = nullptr;
+    image.decoder_owned = false;
+    }
+  }
+
+rgba_image::rgba_image() : w(0), h(0), im(nullptr), decoder_owned(false)
   {
   }
 
 rgba_image::~rgba_image()
-  {  
-  delete [] im;
+  {
+  release(*this);
+  }
+
+void rgba_image::allocate(int width, int height)
+  {
+  release(*this);
+  w = width;
+  h = height;
+  im = new uint32_t[(size_t)width * height];
   }
 
 bool read_image_from_file(rgba_image& rgba, const std::string& filename)
   {
+  mapped_file file(filename);
+  if (file.data() == nullptr)
+    return false;
   int imw, imh, nr_of_channels;
-  unsigned char* im = stbi_load(filename.c_str(), &imw, &imh, &nr_of_channels, 4);
+  unsigned char* im = stbi_load_from_memory(file.data(), (int)file.size(), &imw, &imh, &nr_of_channels, 4);
   if (im == nullptr)
     return false;
+  release(rgba);
   rgba.w = imw;
   rgba.h = imh;
-  rgba.im = new uint32_t[imw * imh];
-  memcpy(rgba.im, im, imw * imh * 4);  
-  stbi_image_free(im);
+  rgba.im = (uint32_t*)im;
+  rgba.decoder_owned = true;
   return true;
-  }
\ No newline at end of file
+  }
+
+height_image::height_image() : w(0), h(0), im(nullptr), decoder_owned(false)
+  {
+  }
+
+height_image::~height_image()
+  {
+  release(*this);
+  }
+
+void height_image::allocate(int width, int height)
+  {
+  release(*this);
+  w = width;
+  h = height;
+  im = new uint16_t[(size_t)width * height];
+  }
+
+bool read_height_image_from_file(height_image& heights, const std::string& filename)
+  {
+  mapped_file file(filename);
+  if (file.data() == nullptr)
+    return false;
+  int imw, imh, nr_of_channels;
+  uint16_t* im = stbi_load_16_from_memory(file.data(), (int)file.size(), &imw, &imh, &nr_of_channels, 1);
+  if (im == nullptr)
+    return false;
+  release(heights);
+  heights.w = imw;
+  heights.h = imh;
+  heights.im = im;
+  heights.decoder_owned = true;
+  return true;
+  }
@@ -7,9 +7,30 @@ struct rgba_image
   rgba_image();
   ~rgba_image();
 
+  // replaces the pixels by an uninitialized buffer of w x h texels
+  void allocate(int width, int height);
+
   int w, h;
   uint32_t* im;
+  bool decoder_owned; // im is the buffer of the image decoder, it is released with stbi_image_free
   };
 
+// The file is memory mapped and decoded from the mapping, the image takes over the buffer of the decoder without a copy.
+bool read_image_from_file(rgba_image& rgba, const std::string& filename);
+
+// single channel 16 bit image
+struct height_image
+  {
+  height_image();
+  ~height_image();
+
+  // replaces the heights by an uninitialized buffer of w x h texels
+  void allocate(int width, int height);
+
+  int w, h;
+  uint16_t* im;
+  bool decoder_owned;
+  };
 
-bool read_image_from_file(rgba_image& rgba, const std::string& filename);
\ No newline at end of file
+// 8 bit images are expanded to the full 16 bit range
+bool read_height_image_from_file(height_image& heights, const std::string& filename);
@@ -29,18 +29,134 @@
 #endif
 
 #include "RenderDoos/render_engine.h"
+#include "asset_loader.h"
+#include "baked_texture.h"
 #include "material.h"
 #include "image.h"
 #include "keyboard.h"
+#include "max_mip.h"
+#include "heightfield.h"
+#include "heightmap_texture.h"
+#include "horizon_map.h"
+#include "cdlod.h"
+#include "dynamic_resolution.h"
+#include "procedural_terrain.h"
+#include "program_cache.h"
+#include "terrain_space.h"
+#include "terrain_tiles.h"
 
 #include "RenderDoos/types.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <stdlib.h>
+
+// a regular grid of n x n quads covering [0,1] x [0,1] in the xz plane
+static uint32_t make_grid_geometry(RenderDoos::render_engine& engine, int n)
+  {
+  uint32_t grid_geometry_id = engine.add_geometry(VERTEX_STANDARD);
+  RenderDoos::vertex_standard* gvp;
+  uint32_t* gip;
+  engine.geometry_begin(grid_geometry_id, (n + 1) * (n + 1), n * n * 6, (float**)&gvp, (void**)&gip);
+  for (int j = 0; j <= n; ++j)
+    {
+    for (int i = 0; i <= n; ++i)
+      {
+      gvp->x = (float)i / (float)n;
+      gvp->y = 0.f;
+      gvp->z = (float)j / (float)n;
+      gvp->nx = 0.f;
+      gvp->ny = 1.f;
+      gvp->nz = 0.f;
+      gvp->u = gvp->x;
+      gvp->v = gvp->z;
+      ++gvp;
+      }
+    }
+  for (int j = 0; j < n; ++j)
+    {
+    for (int i = 0; i < n; ++i)
+      {
+      const uint32_t v0 = j * (n + 1) + i;
+      const uint32_t v1 = v0 + 1;
+      const uint32_t v2 = v0 + (n + 1) + 1;
+      const uint32_t v3 = v0 + (n + 1);
+      *gip++ = v0;
+      *gip++ = v1;
+      *gip++ = v2;
+      *gip++ = v0;
+      *gip++ = v2;
+      *gip++ = v3;
+      }
+    }
+  engine.geometry_end(grid_geometry_id);
+  return grid_geometry_id;
+  }
 
 int _main(int argc, char** argv)
   {
   SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_VERBOSE);
 
+  // RenderTerrainSDL2 --bake-tiles <heightmap.png> <out.tiles> [world_size] [height_scale]
+  // RenderTerrainSDL2 --bake-texture <image> <out.tex> [rgba8|bc1|bc3|bc5]
+  //   Block compression only makes the file smaller, it saves no gpu memory or bandwidth: RenderDoos has no
+  //   compressed texture formats, so the levels are decoded to rgba8 on the cpu at load, after a lossy encode.
+  //   bc1 drops alpha and bc5 blue and alpha; a source with transparent texels is baked as bc3 instead.
+  //   assets/colormap.tex needs alpha for blending, it is only used when it is rgba8 or bc3.
+  // RenderTerrainSDL2 --tiles <file.tiles>
+  // RenderTerrainSDL2 --procedural [seed]
+  std::string tiles_filename;
+  bool procedural = false;
+  uint32_t procedural_seed = 1;
+  for (int i = 1; i < argc; ++i)
+    {
+    if (strcmp(argv[i], "--bake-tiles") == 0 && i + 2 < argc)
+      {
+      const float world_size = i + 3 < argc ? (float)atof(argv[i + 3]) : 1000.f;
+      const float height_scale = i + 4 < argc ? (float)atof(argv[i + 4]) : 100.f;
+      if (!bake_terrain_tiles(argv[i + 1], argv[i + 2], 64, world_size, height_scale))
+        {
+        std::cout << "Could not bake " << argv[i + 1] << "\n";
+        return 1;
+        }
+      return 0;
+      }
+    if (strcmp(argv[i], "--bake-texture") == 0 && i + 2 < argc)
+      {
+      baked_texture_format format = baked_texture_format_rgba8;
+      if (i + 3 < argc)
+        {
+        if (strcmp(argv[i + 3], "bc1") == 0)
+          format = baked_texture_format_bc1;
+        else if (strcmp(argv[i + 3], "bc3") == 0)
+          format = baked_texture_format_bc3;
+        else if (strcmp(argv[i + 3], "bc5") == 0)
+          format = baked_texture_format_bc5;
+        }
+      double psnr = 0.0;
+      if (!bake_texture({ argv[i + 1] }, argv[i + 2], format, &psnr))
+        {
+        std::cout << "Could not bake " << argv[i + 1] << "\n";
+        return 1;
+        }
+      baked_texture baked;
+      if (baked.open(argv[i + 2]) && baked.header().format != (uint32_t)format)
+        std::cout << "The image has transparent texels, baked as bc3 to keep alpha\n";
+      if (format != baked_texture_format_rgba8)
+        std::cout << "PSNR " << psnr << " dB (rgba), the texture is decoded to rgba8 at load and uses as much gpu memory as rgba8\n";
+      return 0;
+      }
+    if (strcmp(argv[i], "--tiles") == 0 && i + 1 < argc)
+      tiles_filename = argv[++i];
+    if (strcmp(argv[i], "--procedural") == 0)
+      {
+      procedural = true;
+      if (i + 1 < argc && argv[i + 1][0] != '-')
+        procedural_seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+      }
+    }
+
   uint32_t w = 800;
   uint32_t h = 450;
   RenderDoos::render_engine engine;
@@ -98,6 +214,9 @@ int _main(int argc, char** argv)
   engine.init(nullptr, nullptr, RenderDoos::renderer_type::OPENGL);
 #endif 
 
+  // linked OpenGL programs are kept in assets/program_*.bin, so the next start skips compiling the shaders
+  set_program_cache_folder("assets");
+
   RenderDoos::model_view_properties mv_props;
   mv_props.init(w, h);
   mv_props.orthogonal = 1;
@@ -106,25 +225,197 @@ int _main(int argc, char** argv)
   mv_props.zoom_y = 1.f;
   mv_props.light_dir = RenderDoos::normalize(RenderDoos::float4(0, 0, 1, 0));
 
-  rgba_image heightmap, normalmap, colormap;
-  if (!read_image_from_file(heightmap, "assets/heightmap.png")
-    || !read_image_from_file(normalmap, "assets/normalmap.png")
-    || !read_image_from_file(colormap, "assets/colormap.png")
-    )
+  // The assets and everything derived from them are made on the threads of the asset loader below,
+  // the textures are created as soon as their data is ready.
+  height_image heights;
+  rgba_image colormap;
+  // assets/colormap.tex, made with --bake-texture, is used instead of colormap.png when it exists
+  baked_texture baked_colormap;
+  bool colormap_baked = false;
+  rgba_image heightmap;
+  max_mip_pyramid pyramid;
+  // CPU copy of the terrain that keeps the camera above the ground
+  heightfield ground;
+  rgba_image horizon0, horizon1;
+  bool heights_read = false;
+  bool colormap_read = false;
+  int32_t heightmap_id = -1;
+  int32_t colormap_id = -1;
+  int32_t height_pyramid_id = -1;
+  int32_t horizon0_id = -1;
+  int32_t horizon1_id = -1;
+  const float camera_clearance = 0.25f;
+
+  // Endless terrain: the raymarcher reads a window of procedurally generated tiles around the camera
+  // instead of the heightmap assets. The window repeats, so the horizon maps of the assets do not apply.
+  procedural_terrain generated_terrain;
+  if (procedural && !generated_terrain.open(&engine, 1024, 64, procedural_seed, mv_props.camera_space[12], mv_props.camera_space[14]))
     {
-    std::cout << "Could not read asset\n";
+    std::cout << "Could not create the procedural terrain\n";
     exit(1);
     }
 
-  uint32_t heightmap_id = engine.add_texture(heightmap.w, heightmap.h, RenderDoos::texture_format_rgba8, (const uint8_t*)heightmap.im);
-  uint32_t normalmap_id = engine.add_texture(normalmap.w, normalmap.h, RenderDoos::texture_format_rgba8, (const uint8_t*)normalmap.im);
-  uint32_t colormap_id = engine.add_texture(colormap.w, colormap.h, RenderDoos::texture_format_rgba8, (const uint8_t*)colormap.im);
-
   terrain_material terrain_mat;
-  terrain_mat.set_texture_heightmap(heightmap_id);
-  terrain_mat.set_texture_normalmap(normalmap_id);
-  terrain_mat.set_texture_colormap(colormap_id);
+  terrain_mat.set_texture_heightmap(procedural ? generated_terrain.heightmap_texture() : heightmap_id);
+  terrain_mat.set_texture_colormap(procedural ? generated_terrain.colormap_texture() : colormap_id);
+  terrain_mat.set_texture_height_pyramid(procedural ? generated_terrain.height_pyramid_texture() : height_pyramid_id);
+  terrain_mat.set_repeat(procedural);
   terrain_mat.compile(&engine);
+
+  // Shadows of the sun from horizon maps, they are used once they are computed.
+  bool shadows = !procedural;
+  float sun_azimuth = -90.f; // degrees, from +x towards +z
+  float sun_elevation = 63.43f; // degrees, atan(2): the default sun of terrain_material
+
+  // The raymarched terrain can be rendered at half or quarter resolution and upsampled to the screen.
+  // With reprojection the rays start just before the hit distance of the previous frame, which is read
+  // from the other one of two ping-pong targets. The dynamic resolution steps back and forth between a few
+  // sizes, so a pair of targets is kept for each of the most recently used sizes: a step neither reallocates
+  // frame buffers nor loses the previous hit distances, which the shader reads at their own resolution.
+  terrain_upsample_material upsample_mat;
+  upsample_mat.compile(&engine);
+  int raymarch_downscale = 1;
+  bool reproject = true;
+  struct raymarch_target_pair
+    {
+    uint32_t w, h;
+    int32_t frame_buffer_ids[2];
+    };
+  std::vector<raymarch_target_pair> raymarch_targets; // the most recently used size last
+  const size_t max_raymarch_target_pairs = 4;
+  int32_t raymarch_framebuffer_id = -1; // target of the latest raymarch pass
+  bool prev_depth_valid = false;
+  // The beam pre-pass stores a conservative start distance for every tile of 8x8 raymarched pixels.
+  bool beam_pass = true;
+  int32_t beam_framebuffer_id = -1;
+  uint32_t beam_w = 0;
+  uint32_t beam_h = 0;
+  // With dynamic resolution (off by default, toggle with v) the raymarch resolution follows the measured frame time.
+  dynamic_resolution dynres;
+
+  terrain_mesh_material terrain_mesh_mat;
+  terrain_mesh_mat.compile(&engine);
+
+  cdlod_quadtree quadtree;
+  std::vector<cdlod_node> selected_nodes;
+  bool mesh_mode = false;
+
+  // Both images are decoded in parallel while the window already presents frames. The heightmap texture,
+  // pyramid and CPU heightfield are derived on the same thread as the heights, the horizon maps take longest
+  // and are computed after the terrain is shown.
+  asset_loader loader;
+  bool assets_loaded = false;
+  const auto load_start = std::chrono::high_resolution_clock::now();
+  // the streamed tiled terrain (--tiles) does not use the heightmap and colormap assets
+  const bool tile_mode = !tiles_filename.empty();
+  if (!tile_mode)
+    {
+    loader.add([&]()
+      {
+      heights_read = read_height_image_from_file(heights, "assets/heightmap.png");
+      if (!heights_read)
+        return;
+      // 16 bit heights and normals packed in one rgba8 texture, the normal strength matches the former normalmap.png
+      make_heightmap_texture(heightmap, heights, 39.f);
+      build_max_mip_pyramid(pyramid, heights);
+      ground.init(heights, &pyramid, terrain_height_scale, false);
+      }, [&]()
+      {
+      if (!heights_read)
+        {
+        std::cout << "Could not read asset\n";
+        exit(1);
+        }
+      heightmap_id = engine.add_texture(heightmap.w, heightmap.h, RenderDoos::texture_format_rgba8, (const uint8_t*)heightmap.im);
+      height_pyramid_id = engine.add_texture(pyramid.atlas_w, pyramid.atlas_h, RenderDoos::texture_format_r32f, (const uint8_t*)pyramid.atlas.data());
+      if (!procedural)
+        {
+        terrain_mat.set_texture_heightmap(heightmap_id);
+        terrain_mat.set_texture_height_pyramid(height_pyramid_id);
+        }
+      terrain_mesh_mat.set_texture_heightmap(heightmap_id);
+      quadtree.init(&pyramid, heightmap.w, heightmap.h);
+      if (procedural)
+        return;
+      // a texel of the heightmap is 1/(0.01*w) world units wide (see terrain_space.h). The whole heightmap is
+      // rendered, with flat ground outside of it, so the rays end at its borders instead of wrapping.
+      loader.add([&]()
+        {
+        make_horizon_maps(horizon0, horizon1, heights, 1.f / (0.01f * (float)heights.w), terrain_height_scale, 256, 0, 0, heights.w, heights.h, false);
+        }, [&]()
+        {
+        horizon0_id = engine.add_texture(horizon0.w, horizon0.h, RenderDoos::texture_format_rgba8, (const uint8_t*)horizon0.im);
+        horizon1_id = engine.add_texture(horizon1.w, horizon1.h, RenderDoos::texture_format_rgba8, (const uint8_t*)horizon1.im);
+        terrain_mat.set_textures_horizon_maps(horizon0_id, horizon1_id);
+        });
+      });
+    loader.add([&]()
+      {
+      // a colormap.tex baked from another colormap.png than the current one is skipped, as is one without alpha
+      const uint32_t source_key = baked_texture_source_key({ "assets/colormap.png" });
+      colormap_baked = baked_colormap.open("assets/colormap.tex") && (source_key == 0 || baked_colormap.header().source_key == source_key)
+        && baked_texture_channels(baked_colormap.header().format) == 4;
+      if (!colormap_baked)
+        {
+        baked_colormap.close();
+        colormap_read = read_image_from_file(colormap, "assets/colormap.png");
+        }
+      }, [&]()
+      {
+      if (colormap_baked)
+        {
+        colormap_id = add_baked_texture(&engine, baked_colormap);
+        baked_colormap.close();
+        }
+      else if (colormap_read)
+        colormap_id = engine.add_texture(colormap.w, colormap.h, RenderDoos::texture_format_rgba8, (const uint8_t*)colormap.im);
+      if (colormap_id < 0)
+        {
+        std::cout << "Could not read asset\n";
+        exit(1);
+        }
+      if (!procedural)
+        terrain_mat.set_texture_colormap(colormap_id);
+      terrain_mesh_mat.set_texture_colormap(colormap_id);
+      });
+    }
+
+  uint32_t grid_geometry_id = make_grid_geometry(engine, quadtree.grid_dim);
+
+  // streamed tiled terrain
+  terrain_tile_streamer streamer;
+  terrain_tile_material terrain_tile_mat;
+  cdlod_quadtree tile_quadtree;
+  uint32_t tile_grid_geometry_id = 0;
+  float tile_eye_height = terrain_camera_height_offset;
+  if (tile_mode)
+    {
+    if (!streamer.open(&engine, tiles_filename, 256))
+      {
+      std::cout << "Could not open " << tiles_filename << "\n";
+      exit(1);
+      }
+    const terrain_tiles_header& header = streamer.header();
+    tile_quadtree.grid_dim = (int)header.tile_size;
+    tile_quadtree.lod_levels = (int)header.levels;
+    tile_quadtree.root_size = header.world_size;
+    tile_quadtree.origin_x = -header.world_size * 0.5f;
+    tile_quadtree.origin_z = -header.world_size * 0.5f;
+    tile_quadtree.finest_range = 3.f * header.world_size / (float)(1 << (header.levels - 1));
+    const float origin = tile_quadtree.origin_x;
+    tile_quadtree.max_height = [&streamer, origin](float x, float z, float size, int lod)
+      {
+      return streamer.max_height(lod, (int)std::floor((x - origin) / size + 0.5f), (int)std::floor((z - origin) / size + 0.5f));
+      };
+    terrain_tile_mat.set_height_scale(header.height_scale);
+    terrain_tile_mat.set_far_plane(1.5f * header.world_size);
+    // the eye is raised as above the heightmap terrain, relative to the height range of the tiles
+    tile_eye_height = terrain_camera_height_offset * header.height_scale / terrain_height_scale;
+    terrain_tile_mat.set_eye_height(tile_eye_height);
+    terrain_tile_mat.compile(&engine);
+    tile_grid_geometry_id = make_grid_geometry(engine, tile_quadtree.grid_dim);
+    }
+
   uint32_t geometry_id = engine.add_geometry(VERTEX_STANDARD);
   RenderDoos::vertex_standard* vp;
   uint32_t* ip;
@@ -221,6 +512,71 @@ int _main(int argc, char** argv)
           quit = true;
           break;
           }
+          case SDLK_m:
+          {
+          if (!procedural)
+            mesh_mode = !mesh_mode;
+          break;
+          }
+          case SDLK_r:
+          {
+          raymarch_downscale = raymarch_downscale == 4 ? 1 : raymarch_downscale * 2;
+          break;
+          }
+          case SDLK_t:
+          {
+          reproject = !reproject;
+          break;
+          }
+          case SDLK_b:
+          {
+          beam_pass = !beam_pass;
+          break;
+          }
+          case SDLK_v:
+          {
+          dynres.set_enabled(!dynres.enabled());
+          break;
+          }
+          case SDLK_h:
+          {
+          if (!procedural)
+            shadows = !shadows;
+          break;
+          }
+          case SDLK_LEFTBRACKET:
+          {
+          sun_azimuth -= 10.f;
+          break;
+          }
+          case SDLK_RIGHTBRACKET:
+          {
+          sun_azimuth += 10.f;
+          break;
+          }
+          case SDLK_MINUS:
+          {
+          sun_elevation = std::max(sun_elevation - 5.f, 0.f);
+          break;
+          }
+          case SDLK_EQUALS:
+          {
+          sun_elevation = std::min(sun_elevation + 5.f, 90.f);
+          break;
+          }
+          case SDLK_g:
+          {
+          if (heightmap_id < 0)
+            break;
+          // the terrain point in the center of the screen, with the ray of the raymarch shader
+          const float* cam = &mv_props.camera_space[0];
+          float t;
+          if (ground.intersect(t, cam[12], cam[13] + terrain_camera_height_offset, cam[14], cam[8], cam[9], cam[10], 40.f))
+            std::cout << "terrain hit at distance " << t << "\n";
+          else
+            std::cout << "no terrain hit\n";
+          break;
+          }
           }
         }        
         case SDL_MOUSEWHEEL:
@@ -367,6 +723,14 @@ int _main(int argc, char** argv)
       {
       mv_props.camera_space[13] += step_size;
       }
+    if (!tile_mode && !procedural && heightmap_id >= 0)
+      {
+      // the eye of the terrain shaders is the translation of the camera matrix raised by terrain_camera_height_offset
+      const float eye_y = mv_props.camera_space[13] + terrain_camera_height_offset;
+      const float floor_y = ground.height(mv_props.camera_space[12], mv_props.camera_space[14]) + camera_clearance;
+      if (eye_y < floor_y)
+        mv_props.camera_space[13] = floor_y - terrain_camera_height_offset;
+      }
 
     RenderDoos::render_drawables drawables;
 #if defined(RENDERDOOS_METAL)
@@ -375,10 +739,111 @@ int _main(int argc, char** argv)
     drawables.metal_drawable = (void*)drawable.drawable;
     drawables.metal_screen_texture = (void*)drawable.texture;
 #endif
+    if (!assets_loaded && loader.update())
+      {
+      assets_loaded = true;
+      std::cout << "assets loaded in " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - load_start).count() << " ms\n";
+      }
+    // until the heights and colors are uploaded only the clear color is shown
+    const bool terrain_loaded = heightmap_id >= 0 && colormap_id >= 0;
+
+    dynres.frame_started();
     engine.frame_begin(drawables);
 
+    const float deg = 3.14159265f / 180.f;
+    terrain_mat.set_sun_direction(std::cos(sun_elevation * deg) * std::cos(sun_azimuth * deg), std::sin(sun_elevation * deg), std::cos(sun_elevation * deg) * std::sin(sun_azimuth * deg));
+    terrain_mat.set_shadows(shadows && horizon0_id >= 0);
+    if (procedural)
+      generated_terrain.update(&engine, mv_props.camera_space[12], mv_props.camera_space[14], 4);
+
+    const bool raymarched = !mesh_mode && !tile_mode && (procedural || terrain_loaded);
+    const bool offscreen = raymarched && (raymarch_downscale > 1 || reproject || dynres.enabled());
+    // resolution of the raymarch pass
+    uint32_t lw, lh;
+    dynres.scaled_size(lw, lh, mv_props.viewport_width, mv_props.viewport_height);
+    lw = (lw + raymarch_downscale - 1) / raymarch_downscale;
+    lh = (lh + raymarch_downscale - 1) / raymarch_downscale;
+    terrain_mat.set_texture_beam(-1);
+    if (raymarched && beam_pass)
+      {
+      const uint32_t bw = (lw + terrain_material::beam_tile_size - 1) / terrain_material::beam_tile_size;
+      const uint32_t bh = (lh + terrain_material::beam_tile_size - 1) / terrain_material::beam_tile_size;
+      if (beam_framebuffer_id < 0 || bw != beam_w || bh != beam_h)
+        {
+        if (beam_framebuffer_id >= 0)
+          engine.remove_frame_buffer(beam_framebuffer_id);
+        beam_framebuffer_id = engine.add_frame_buffer(bw, bh, false);
+        beam_w = bw;
+        beam_h = bh;
+        }
+      RenderDoos::renderpass_descriptor beam_descr;
+      beam_descr.clear_color = 0xff000000;
+      beam_descr.clear_flags = CLEAR_COLOR | CLEAR_DEPTH;
+      beam_descr.frame_buffer_handle = beam_framebuffer_id;
+      beam_descr.frame_buffer_channel = 10;
+      engine.renderpass_begin(beam_descr);
+      // the viewport keeps the raymarch resolution: every fragment covers a tile of raymarched pixels
+      RenderDoos::model_view_properties beam_props = mv_props;
+      beam_props.viewport_width = lw;
+      beam_props.viewport_height = lh;
+      engine.set_model_view_properties(beam_props);
+      terrain_mat.set_beam_pass(true);
+      terrain_mat.bind(&engine);
+      engine.geometry_draw(geometry_id);
+      engine.renderpass_end();
+      terrain_mat.set_beam_pass(false);
+      terrain_mat.set_texture_beam(engine.get_frame_buffer(beam_framebuffer_id)->texture_handle);
+      }
+    if (offscreen)
+      {
+      auto pair = std::find_if(raymarch_targets.begin(), raymarch_targets.end(), [&](const raymarch_target_pair& p)
+        {
+        return p.w == lw && p.h == lh;
+        });
+      raymarch_target_pair targets;
+      if (pair != raymarch_targets.end())
+        {
+        targets = *pair;
+        raymarch_targets.erase(pair);
+        }
+      else
+        {
+        // the least recently used pair never holds the previous frame, that is the most recently used one
+        if (raymarch_targets.size() >= max_raymarch_target_pairs)
+          {
+          for (int i = 0; i < 2; ++i)
+            engine.remove_frame_buffer(raymarch_targets.front().frame_buffer_ids[i]);
+          raymarch_targets.erase(raymarch_targets.begin());
+          }
+        targets.w = lw;
+        targets.h = lh;
+        for (int i = 0; i < 2; ++i)
+          targets.frame_buffer_ids[i] = engine.add_frame_buffer(lw, lh, false);
+        }
+      raymarch_targets.push_back(targets);
+      const int32_t prev_framebuffer_id = raymarch_framebuffer_id;
+      raymarch_framebuffer_id = targets.frame_buffer_ids[0] == prev_framebuffer_id ? targets.frame_buffer_ids[1] : targets.frame_buffer_ids[0];
+      terrain_mat.set_texture_prev_depth((reproject && prev_depth_valid) ? engine.get_frame_buffer(prev_framebuffer_id)->texture_handle : -1);
+      RenderDoos::renderpass_descriptor raymarch_descr;
+      raymarch_descr.clear_color = 0xff203040;
+      raymarch_descr.clear_flags = CLEAR_COLOR | CLEAR_DEPTH;
+      raymarch_descr.frame_buffer_handle = raymarch_framebuffer_id;
+      raymarch_descr.frame_buffer_channel = 10;
+      engine.renderpass_begin(raymarch_descr);
+      RenderDoos::model_view_properties raymarch_props = mv_props;
+      raymarch_props.viewport_width = lw;
+      raymarch_props.viewport_height = lh;
+      engine.set_model_view_properties(raymarch_props);
+      terrain_mat.bind(&engine);
+      engine.geometry_draw(geometry_id);
+      engine.renderpass_end();
+      }
+    // the previous hit distances are only usable when they were rendered with the previous bind of terrain_mat
+    prev_depth_valid = offscreen;
+    terrain_mat.set_texture_prev_depth(-1);
+
     RenderDoos::renderpass_descriptor descr;
-    descr.clear_color = 0xff203040;
+    descr.clear_color = (mesh_mode || tile_mode) ? 0xffb3b3b3 : 0xff203040;
     descr.clear_flags = CLEAR_COLOR | CLEAR_DEPTH;
     descr.w = mv_props.viewport_width;
     descr.h = mv_props.viewport_height;
@@ -386,11 +851,48 @@ int _main(int argc, char** argv)
     engine.renderpass_begin(descr);
 
     engine.set_model_view_properties(mv_props);
-    terrain_mat.bind(&engine);
-    engine.geometry_draw(geometry_id);
+    if (tile_mode)
+      {
+      streamer.update(&engine, 8);
+      cdlod_view view = make_cdlod_view(&mv_props.camera_space[0], (float)mv_props.viewport_width / (float)mv_props.viewport_height, tile_eye_height);
+      tile_quadtree.select(selected_nodes, view);
+      terrain_tile_mat.bind(&engine);
+      for (const auto& node : selected_nodes)
+        {
+        const int tx = (int)std::floor((node.x - tile_quadtree.origin_x) / node.size + 0.5f);
+        const int tz = (int)std::floor((node.z - tile_quadtree.origin_z) / node.size + 0.5f);
+        terrain_tile_mat.bind_node(&engine, node, tile_quadtree.grid_dim, streamer.acquire(node.lod, tx, tz));
+        engine.geometry_draw(tile_grid_geometry_id);
+        }
+      }
+    else if (mesh_mode && terrain_loaded)
+      {
+      cdlod_view view = make_cdlod_view(&mv_props.camera_space[0], (float)mv_props.viewport_width / (float)mv_props.viewport_height, terrain_camera_height_offset);
+      quadtree.select(selected_nodes, view);
+      terrain_mesh_mat.bind(&engine);
+      for (const auto& node : selected_nodes)
+        {
+        terrain_mesh_mat.bind_node(&engine, node, quadtree.grid_dim);
+        engine.geometry_draw(grid_geometry_id);
+        }
+      }
+    else if (offscreen)
+      {
+      upsample_mat.set_texture_low_res(engine.get_frame_buffer(raymarch_framebuffer_id)->texture_handle);
+      upsample_mat.bind(&engine);
+      engine.geometry_draw(geometry_id);
+      }
+    else if (raymarched)
+      {
+      terrain_mat.bind(&engine);
+      engine.geometry_draw(geometry_id);
+      }
 
     engine.renderpass_end();
-    engine.frame_end();
+    // waiting for the gpu only when the frame time drives the raymarch resolution
+    engine.frame_end(raymarched && dynres.enabled());
+    if (raymarched)
+      dynres.frame_finished();
     std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(10.0));
 
 #if defined(RENDERDOOS_OPENGL)
@@ -399,9 +901,37 @@ int _main(int argc, char** argv)
 
       } //while (!quit)
 
-  engine.remove_texture(heightmap_id);
-  engine.remove_texture(normalmap_id);
-  engine.remove_texture(colormap_id);
+  terrain_mat.destroy(&engine);
+  terrain_mesh_mat.destroy(&engine);
+  upsample_mat.destroy(&engine);
+  dynres.destroy(&engine);
+  for (const auto& targets : raymarch_targets)
+    {
+    for (int i = 0; i < 2; ++i)
+      engine.remove_frame_buffer(targets.frame_buffer_ids[i]);
+    }
+  if (beam_framebuffer_id >= 0)
+    engine.remove_frame_buffer(beam_framebuffer_id);
+  engine.remove_geometry(geometry_id);
+  engine.remove_geometry(grid_geometry_id);
+  if (tile_mode)
+    {
+    terrain_tile_mat.destroy(&engine);
+    engine.remove_geometry(tile_grid_geometry_id);
+    streamer.close(&engine);
+    }
+  if (heightmap_id >= 0)
+    engine.remove_texture(heightmap_id);
+  if (colormap_id >= 0)
+    engine.remove_texture(colormap_id);
+  if (height_pyramid_id >= 0)
+    engine.remove_texture(height_pyramid_id);
+  if (horizon0_id >= 0)
+    engine.remove_texture(horizon0_id);
+  if (horizon1_id >= 0)
+    engine.remove_texture(horizon1_id);
+  if (procedural)
+    generated_terrain.close(&engine);
 
   SDL_Quit();
   return 0;
@@ -0,0 +1,88 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+mapped_file::mapped_file() : _data(nullptr), _size(0)
+#ifdef _WIN32
+  , _file(INVALID_HANDLE_VALUE), _mapping(nullptr)
+#endif
+  {
+  }
+
+mapped_file::mapped_file(const std::string& filename) : mapped_file()
+  {
+  open(filename);
+  }
+
+mapped_file::~mapped_file()
+  {
+  close();
+  }
+
+bool mapped_file::open(const std::string& filename)
+  {
+  close();
+#ifdef _WIN32
+  _file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (_file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(_file, &size) || size.QuadPart == 0)
+    {
+    close();
+    return false;
+    }
+  _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (_mapping != nullptr)
+    _data = (const unsigned char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+  if (_data == nullptr)
+    {
+    close();
+    return false;
+    }
+  _size = (size_t)size.QuadPart;
+#else
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+    void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED)
+      {
+      _data = (const unsigned char*)p;
+      _size = (size_t)st.st_size;
+      }
+    }
+  // the mapping stays valid after the descriptor is closed
+  ::close(fd);
+#endif
+  return _data != nullptr;
+  }
+
+void mapped_file::close()
+  {
+#ifdef _WIN32
+  if (_data)
+    UnmapViewOfFile(_data);
+  if (_mapping)
+    CloseHandle(_mapping);
+  if (_file != INVALID_HANDLE_VALUE)
+    CloseHandle(_file);
+  _file = INVALID_HANDLE_VALUE;
+  _mapping = nullptr;
+#else
+  if (_data)
+    munmap((void*)_data, _size);
+#endif
+  _data = nullptr;
+  _size = 0;
+  }
@@ -2,6 +2,12 @@
 #include "RenderDoos/types.h"
 #include "RenderDoos/render_context.h"
 #include "RenderDoos/render_engine.h"
+#include "cdlod.h"
+#include "program_cache.h"
+#include "terrain_space.h"
+#include "terrain_tiles.h"
+
+#include <cmath>
 
 
 static std::string get_terrain_material_vertex_shader()
@@ -23,8 +29,17 @@ static std::string get_terrain_material_fragment_shader()
 uniform mat4 Camera;
 uniform vec3 iResolution;
 uniform sampler2D Heightmap;
-uniform sampler2D Normalmap;
 uniform sampler2D Colormap;
+uniform sampler2D HeightPyramid;
+uniform mat4 PrevCamera;
+uniform vec4 ReprojectParams; // x: 1 if PrevDepth holds the hit distances rendered with PrevCamera
+uniform sampler2D PrevDepth;
+uniform vec4 BeamParams; // x: 1 for the beam pre-pass, y: 1 if Beam holds the start distances of this frame, z: beam tile size in pixels
+uniform sampler2D Beam;
+uniform vec4 Sun; // xyz: direction towards the sun, w: 1 for shadows from the horizon maps
+uniform sampler2D HorizonMap0; // horizon elevations for the azimuths 0, 45, 90 and 135 degrees
+uniform sampler2D HorizonMap1; // horizon elevations for the azimuths 180, 225, 270 and 315 degrees
+uniform vec4 TerrainParams; // x: 1 if the textures repeat without bounds (procedural terrain)
 
 out vec4 FragColor;
 
@@ -39,9 +54,10 @@ vec2 scalePosition(in vec2 p)
 float terrain( in vec2 p)
 {
    p = scalePosition(p);
-   if (p.x < 0.0 || p.x >= 1.0 || p.y < 0.0 || p.y >= 1.0)
+   if (TerrainParams.x == 0.0 && (p.x < 0.0 || p.x >= 1.0 || p.y < 0.0 || p.y >= 1.0))
      return 0.0;   
-   return texture( Heightmap, p).x*5;   
+   // 16 bit height split over red (high byte) and green (low byte)
+   return dot(texture( Heightmap, p).xy, vec2(65280.0, 255.0)/65535.0)*5;
 }
 
 float map( in vec3 p )
@@ -52,18 +68,33 @@ float map( in vec3 p )
 vec4 getColor( in vec3 pos )
 {
   vec2 p = scalePosition(pos.xz);
-  if (p.x < 0.0 || p.x > 1.0 || p.y < 0.0 || p.y > 1.0)
+  if (TerrainParams.x == 0.0 && (p.x < 0.0 || p.x > 1.0 || p.y < 0.0 || p.y > 1.0))
     return vec4(0,0,0,0);
   return texture( Colormap, p);
 }
 
+// the sun is visible when it is above the horizon, interpolated between the two stored azimuths around it
+float sunVisibility( in vec3 pos, in vec3 sun )
+{
+  vec2 p = scalePosition(pos.xz);
+  vec4 h0 = texture(HorizonMap0, p);
+  vec4 h1 = texture(HorizonMap1, p);
+  float horizon[8] = float[8](h0.r, h0.g, h0.b, h0.a, h1.r, h1.g, h1.b, h1.a);
+  float a = mod(atan(sun.z, sun.x)/0.7853982, 8.0);
+  int i = min(int(a), 7);
+  float elevation = mix(horizon[i], horizon[(i+1)%8], a - float(i))*1.5707963;
+  return smoothstep(-0.02, 0.02, asin(clamp(sun.y, -1.0, 1.0)) - elevation);
+}
+
 vec3 calcNormal( in vec3 pos, float t )
 {
 #if 1
   vec2 p = scalePosition(pos.xz);
-  if (p.x < 0.0 || p.x > 1.0 || p.y < 0.0 || p.y > 1.0)
+  if (TerrainParams.x == 0.0 && (p.x < 0.0 || p.x > 1.0 || p.y < 0.0 || p.y > 1.0))
     return vec3(0,-1,0);
-  return texture( Normalmap, p).rgb;
+  // xy of the normal are packed in the blue and alpha channels of the heightmap
+  vec2 n = texture( Heightmap, p).ba*2.0 - 1.0;
+  return vec3(n, sqrt(max(1.0 - dot(n, n), 0.0)));
 #else
 	float e = 0.001;
 	e = 0.0001*t;
@@ -76,11 +107,168 @@ vec3 calcNormal( in vec3 pos, float t )
 #endif
 }
 
-float intersect( in vec3 ro, in vec3 rd )
+float pyramidMax( in int level, in ivec2 cell, in ivec2 base )
+{
+  ivec2 size = max(base >> level, ivec2(1));
+  if (TerrainParams.x > 0.0)
+    cell = cell & (size - 1); // the level sizes are powers of two
+  else if (cell.x < 0 || cell.y < 0 || cell.x >= size.x || cell.y >= size.y)
+    return 0.0;
+  ivec2 offset = (level == 0) ? ivec2(0) : ivec2(base.x, base.y - (base.y >> (level-1)));
+  return texelFetch( HeightPyramid, offset + cell, 0).x*5;
+}
+
+// Skips empty space by walking the max-mip pyramid: a cell is stepped over when the ray
+// stays above its maximum height, otherwise we descend until the finest level is reached.
+float skipEmptySpace( in vec3 ro, in vec3 rd, in float tmin, in float maxd )
+{
+  ivec2 atlas = textureSize(HeightPyramid, 0);
+  ivec2 base = ivec2(atlas.x*2/3, atlas.y);
+  int top = int(log2(float(min(base.x, base.y))) + 0.5);
+  // heightmap texel coordinates along the ray, see scalePosition
+  vec2 texels = vec2(textureSize(Heightmap, 0));
+  vec2 a = (vec2(0.75, 0.25) + 0.01*ro.xz)*texels;
+  vec2 b = 0.01*rd.xz*texels;
+  vec2 inv_b = vec2(abs(b.x) > 1e-8 ? 1.0/b.x : 1e8, abs(b.y) > 1e-8 ? 1.0/b.y : 1e8);
+  vec2 dir_step = step(vec2(0.0), b);
+  float t = tmin;
+  int level = min(top, 5);
+  for( int i=0; i<128 && t<maxd; i++ )
+  {
+    vec2 q = a + b*t;
+    float cell_size = float(1 << level);
+    ivec2 cell = ivec2(floor(q / cell_size));
+    float hmax = pyramidMax(level, cell, base);
+    vec2 tb = ((vec2(cell) + dir_step)*cell_size - a)*inv_b;
+    float t_exit = max(min(tb.x, tb.y), t);
+    float ymin = min(ro.y + rd.y*t, ro.y + rd.y*t_exit);
+    if (ymin > hmax)
+    {
+      t = t_exit + 1e-4;
+      level = min(level + 1, top);
+    }
+    else
+    {
+      // the ray enters this cell above its maximum, so nothing is hit before it drops below it
+      if (rd.y < 0.0)
+        t = max(t, (hmax - ro.y)/rd.y);
+      if (level == 0)
+        break;
+      --level;
+    }
+  }
+  return t;
+}
+
+// Conservative start distance for every ray inside the cone around rd with half angle atan(k).
+// Same walk as skipEmptySpace, but along the cone axis with cells at least as wide as the cone,
+// testing the 3x3 cells around the axis against the lowest point of the cone (slope rd.y - k).
+float beamStart( in vec3 ro, in vec3 rd, in float k, in float maxd )
+{
+  ivec2 atlas = textureSize(HeightPyramid, 0);
+  ivec2 base = ivec2(atlas.x*2/3, atlas.y);
+  int top = int(log2(float(min(base.x, base.y))) + 0.5);
+  vec2 texels = vec2(textureSize(Heightmap, 0));
+  vec2 a = (vec2(0.75, 0.25) + 0.01*ro.xz)*texels;
+  vec2 b = 0.01*rd.xz*texels;
+  vec2 inv_b = vec2(abs(b.x) > 1e-8 ? 1.0/b.x : 1e8, abs(b.y) > 1e-8 ? 1.0/b.y : 1e8);
+  vec2 dir_step = step(vec2(0.0), b);
+  float radius = 0.01*max(texels.x, texels.y)*k; // cone radius in texels per unit of t
+  float slope = rd.y - k;
+  float t = 0.0;
+  int level = min(top, 5);
+  for( int i=0; i<96 && t<maxd; i++ )
+  {
+    vec2 q = a + b*t;
+    float cell_size = float(1 << level);
+    ivec2 cell = ivec2(floor(q / cell_size));
+    vec2 tb = ((vec2(cell) + dir_step)*cell_size - a)*inv_b;
+    float t_exit = max(min(tb.x, tb.y), t);
+    if (2.0*radius*t_exit > cell_size)
+    {
+      // the cone does not fit in the 3x3 cells around the axis
+      if (level == top)
+        break;
+      ++level;
+      continue;
+    }
+    float hmax = 0.0;
+    for (int y = -1; y <= 1; ++y)
+      for (int x = -1; x <= 1; ++x)
+        hmax = max(hmax, pyramidMax(level, cell + ivec2(x, y), base));
+    if (min(ro.y + slope*t, ro.y + slope*t_exit) > hmax)
+    {
+      t = t_exit + 1e-4;
+      level = min(level + 1, top);
+    }
+    else
+    {
+      if (slope < 0.0)
+        t = max(t, (hmax - ro.y)/slope);
+      if (level == 0 || 4.0*radius*t_exit > cell_size)
+        break;
+      --level;
+    }
+  }
+  return min(t, maxd);
+}
+
+vec3 cameraRay( in vec2 fragCoord, in vec3 rx, in vec3 ry, in vec3 rz )
+{
+  vec2 xy = fragCoord / iResolution.xy;
+  vec2 s = (-1.0 + 2.0* xy) * vec2(iResolution.x/iResolution.y, 1.0);
+  return normalize( s.x*rx + s.y*ry + 2.0*rz );
+}
+
+// Lower bound for the hit distance from the hit distances of the previous frame: the ray is evaluated
+// at the previous distance of this pixel, that point is projected into the previous frame and the
+// closest previous hit around it, minus the camera motion and a safety margin, is where the ray starts.
+// The 3x3 footprint covers at least one pixel of parallax, so when the camera moved a surface nearer than
+// motion*height pixels may have moved in front unseen and the start is clamped there; a camera that stands
+// still or only rotates has no parallax and keeps the full start. Returns 0 when the footprint leaves the
+// previous frame, or holds sky or a depth discontinuity (a silhouette, where a nearer surface can slide in front).
+// The previous hit distances are the alpha of the rgba8 raymarch target, as RenderDoos frame buffers have no
+// float format; sqrt(t/maxd) spends the 8 bits on the near distances, where a step matters most.
+float reprojectStart( in vec3 ro, in vec3 rd, in vec3 pro, in vec3 prx, in vec3 pry, in vec3 prz )
+{
+  const float maxd = 40.0;
+  ivec2 size = textureSize(PrevDepth, 0);
+  // the previous frame may have been raymarched at another resolution
+  float a = texelFetch( PrevDepth, clamp(ivec2(gl_FragCoord.xy*vec2(size)/iResolution.xy), ivec2(0), size - 1), 0).a;
+  if (a >= 1.0)
+    return 0.0;
+  vec3 d = ro + rd*(a*a*maxd) - pro;
+  vec3 v = vec3(dot(d, prx), dot(d, pry), dot(d, prz));
+  if (v.z <= 0.0)
+    return 0.0;
+  vec2 xy = (2.0*v.xy/v.z/vec2(iResolution.x/iResolution.y, 1.0) + 1.0)*0.5;
+  ivec2 q = ivec2(floor(xy*vec2(size)));
+  if (q.x < 1 || q.y < 1 || q.x >= size.x - 1 || q.y >= size.y - 1)
+    return 0.0;
+  float amin = 1.0;
+  float amax = 0.0;
+  for (int j = -1; j <= 1; ++j)
+    for (int i = -1; i <= 1; ++i)
+    {
+      float b = texelFetch( PrevDepth, q + ivec2(i, j), 0).a;
+      amin = min(amin, b);
+      amax = max(amax, b);
+    }
+  if (amax >= 1.0 || amax*amax > 1.5*amin*amin)
+    return 0.0;
+  // one step of the 8 bit encoding as margin
+  amin = max(amin - 1.0/255.0, 0.0);
+  float motion = distance(ro, pro);
+  float start = max(amin*amin*maxd*0.95 - motion, 0.0);
+  return motion > 0.0 ? min(start, motion*float(size.y)) : start;
+}
+
+float intersect( in vec3 ro, in vec3 rd, in float tbeam, in float treproject )
 {
     const float maxd = 40.0;
     const float precis = 0.001;
-    float t = 0.0;
+    // tbeam is safe for every ray of the beam tile, a reprojected start below the terrain means we stepped through a surface
+    float t = (treproject > tbeam && map( ro+rd*treproject ) > 0.0) ? treproject : skipEmptySpace(ro, rd, tbeam, maxd);
     for( int i=0; i<256; i++ )
     {
         float h = map( ro+rd*t );
@@ -124,7 +312,47 @@ void mainImage( out vec4 fragColor, in vec2 fragCoord )
   );
     
     
-  float t = intersect(ro, rd);
+  if (BeamParams.x > 0.0)
+    {
+    // beam pre-pass: this fragment covers a tile of BeamParams.z x BeamParams.z pixels
+    vec3 bx = vec3(dot(rx, planeSide), dot(rx, planeNormal), dot(rx, planeUp));
+    vec3 by = vec3(dot(ry, planeSide), dot(ry, planeNormal), dot(ry, planeUp));
+    vec3 bz = vec3(dot(rz, planeSide), dot(rz, planeNormal), dot(rz, planeUp));
+    vec2 lo = floor(fragCoord)*BeamParams.z;
+    vec2 hi = min(lo + BeamParams.z, iResolution.xy);
+    vec3 c0 = cameraRay(lo, bx, by, bz);
+    vec3 c1 = cameraRay(vec2(hi.x, lo.y), bx, by, bz);
+    vec3 c2 = cameraRay(vec2(lo.x, hi.y), bx, by, bz);
+    vec3 c3 = cameraRay(hi, bx, by, bz);
+    vec3 axis = normalize(c0 + c1 + c2 + c3);
+    float cmin = min(min(dot(c0, axis), dot(c1, axis)), min(dot(c2, axis), dot(c3, axis)));
+    float tb = beamStart(ro, axis, sqrt(max(1.0 - cmin*cmin, 0.0))/cmin, 40.0);
+    // 16 bit fixed point over red and green, rounded down to stay conservative
+    float v = floor(tb/40.0*65535.0);
+    fragColor = vec4(floor(v/256.0)/255.0, mod(v, 256.0)/255.0, 0.0, 1.0);
+    return;
+    }
+  float tbeam = 0.0;
+  if (BeamParams.y > 0.0)
+    {
+    vec2 e = floor(texelFetch( Beam, ivec2(fragCoord)/int(BeamParams.z), 0).rg*255.0 + 0.5);
+    tbeam = (e.x*256.0 + e.y)/65535.0*40.0;
+    }
+  float tstart = 0.0;
+  if (ReprojectParams.x > 0.0)
+    {
+    vec3 pro = (PrevCamera*vec4(0,0,0,1)).xyz;
+    pro.y += 3;
+    vec3 prx = (PrevCamera*vec4(1,0,0,0)).xyz;
+    vec3 pry = (PrevCamera*vec4(0,1,0,0)).xyz;
+    vec3 prz = (PrevCamera*vec4(0,0,1,0)).xyz;
+    pro = vec3(dot(pro, planeSide), dot(pro, planeNormal), dot(pro, planeUp));
+    prx = vec3(dot(prx, planeSide), dot(prx, planeNormal), dot(prx, planeUp));
+    pry = vec3(dot(pry, planeSide), dot(pry, planeNormal), dot(pry, planeUp));
+    prz = vec3(dot(prz, planeSide), dot(prz, planeNormal), dot(prz, planeUp));
+    tstart = reprojectStart(ro, rd, pro, prx, pry, prz);
+    }
+  float t = intersect(ro, rd, tbeam, tstart);
     
   if(t > 0.0)
     {	
@@ -136,14 +364,18 @@ void mainImage( out vec4 fragColor, in vec2 fragCoord )
 		if (texCol.a > 0)
       {
       vec3 terraincol = vec3(pow(texCol.rgb, vec3(0.5)));
-      vec3 sunDir = normalize(vec3(0, +0.5, -1));
-      terraincol = terraincol * clamp(-dot(normal, sunDir), 0.0f, 1.0f) * 0.9 + terraincol*0.1;
+      // the normal is z-up in heightmap space, lit in its [0, 1] encoding as the texels of the former normalmap.png
+      float diffuse = clamp(dot(normal*0.5 + 0.5, Sun.xzy), 0.0f, 1.0f);
+      if (Sun.w > 0.0)
+        diffuse *= sunVisibility(pos, Sun.xyz);
+      terraincol = terraincol * diffuse * 0.9 + terraincol*0.1;
       terraincol = pow(terraincol*1.2, vec3(2.2));
       col = terraincol*texCol.a + col*(1-texCol.a);
       }
 	  }
 	
-	fragColor = vec4(col, 1.0);
+	// alpha keeps the hit distance (sqrt encoded for precision up close) for depth-aware upsampling
+	fragColor = vec4(col, t > 0.0 ? sqrt(t/40.0) : 1.0);
 }
 
 void main() 
@@ -162,11 +394,31 @@ terrain_material::terrain_material()
   cam_handle = -1;
   res_handle = -1;
   texture_heightmap = -1;
-  texture_normalmap = -1;
   texture_colormap = -1;
   heightmap_handle = -1;
-  normalmap_handle = -1;
   colormap_handle = -1;
+  texture_height_pyramid = -1;
+  height_pyramid_handle = -1;
+  prev_cam_handle = -1;
+  reproject_handle = -1;
+  prev_depth_handle = -1;
+  texture_prev_depth = -1;
+  has_prev_camera = false;
+  beam_params_handle = -1;
+  beam_handle = -1;
+  texture_beam = -1;
+  beam_pass = false;
+  sun_handle = -1;
+  horizon0_handle = -1;
+  horizon1_handle = -1;
+  texture_horizon0 = -1;
+  texture_horizon1 = -1;
+  shadows = true;
+  sun[0] = 0.f;
+  sun[1] = 2.f / std::sqrt(5.f);
+  sun[2] = -1.f / std::sqrt(5.f);
+  terrain_params_handle = -1;
+  repeat = false;
   }
 
 terrain_material::~terrain_material()
@@ -182,8 +434,17 @@ void terrain_material::destroy(RenderDoos::render_engine* engine)
   engine->remove_uniform(cam_handle);
   engine->remove_uniform(res_handle);
   engine->remove_uniform(heightmap_handle);
-  engine->remove_uniform(normalmap_handle);
   engine->remove_uniform(colormap_handle);
+  engine->remove_uniform(height_pyramid_handle);
+  engine->remove_uniform(prev_cam_handle);
+  engine->remove_uniform(reproject_handle);
+  engine->remove_uniform(prev_depth_handle);
+  engine->remove_uniform(beam_params_handle);
+  engine->remove_uniform(beam_handle);
+  engine->remove_uniform(sun_handle);
+  engine->remove_uniform(horizon0_handle);
+  engine->remove_uniform(horizon1_handle);
+  engine->remove_uniform(terrain_params_handle);
   }
 
 void terrain_material::set_texture_heightmap(int32_t id)
@@ -191,14 +452,53 @@ void terrain_material::set_texture_heightmap(int32_t id)
   texture_heightmap = id;
   }
 
-void terrain_material::set_texture_normalmap(int32_t id)
+void terrain_material::set_texture_colormap(int32_t id)
   {
-  texture_normalmap = id;
+  texture_colormap = id;
   }
 
-void terrain_material::set_texture_colormap(int32_t id)
+void terrain_material::set_texture_height_pyramid(int32_t id)
   {
-  texture_colormap = id;
+  texture_height_pyramid = id;
+  }
+
+void terrain_material::set_texture_prev_depth(int32_t id)
+  {
+  texture_prev_depth = id;
+  }
+
+void terrain_material::set_beam_pass(bool enable)
+  {
+  beam_pass = enable;
+  }
+
+void terrain_material::set_texture_beam(int32_t id)
+  {
+  texture_beam = id;
+  }
+
+void terrain_material::set_textures_horizon_maps(int32_t id0, int32_t id1)
+  {
+  texture_horizon0 = id0;
+  texture_horizon1 = id1;
+  }
+
+void terrain_material::set_sun_direction(float x, float y, float z)
+  {
+  const float len = std::sqrt(x * x + y * y + z * z);
+  sun[0] = x / len;
+  sun[1] = y / len;
+  sun[2] = z / len;
+  }
+
+void terrain_material::set_shadows(bool enable)
+  {
+  shadows = enable;
+  }
+
+void terrain_material::set_repeat(bool enable)
+  {
+  repeat = enable;
   }
 
 void terrain_material::compile(RenderDoos::render_engine* engine)
@@ -207,19 +507,27 @@ void terrain_material::compile(RenderDoos::render_engine* engine)
     {
     vs_handle = engine->add_shader(nullptr, SHADER_VERTEX, "terrain_material_vertex_shader");
     fs_handle = engine->add_shader(nullptr, SHADER_FRAGMENT, "terrain_material_fragment_shader");
+    shader_program_handle = engine->add_program(vs_handle, fs_handle);
     }
   else if (engine->get_renderer_type() == RenderDoos::renderer_type::OPENGL)
     {
-    vs_handle = engine->add_shader(get_terrain_material_vertex_shader().c_str(), SHADER_VERTEX, nullptr);
-    fs_handle = engine->add_shader(get_terrain_material_fragment_shader().c_str(), SHADER_FRAGMENT, nullptr);
+    shader_program_handle = add_cached_program(engine, vs_handle, fs_handle, get_terrain_material_vertex_shader(), get_terrain_material_fragment_shader());
     }
-  shader_program_handle = engine->add_program(vs_handle, fs_handle);
   proj_handle = engine->add_uniform("Projection", RenderDoos::uniform_type::mat4, 1);
   cam_handle = engine->add_uniform("Camera", RenderDoos::uniform_type::mat4, 1);
   res_handle = engine->add_uniform("iResolution", RenderDoos::uniform_type::vec3, 1);
   heightmap_handle = engine->add_uniform("Heightmap", RenderDoos::uniform_type::sampler, 1);
-  normalmap_handle = engine->add_uniform("Normalmap", RenderDoos::uniform_type::sampler, 1);
   colormap_handle = engine->add_uniform("Colormap", RenderDoos::uniform_type::sampler, 1);
+  height_pyramid_handle = engine->add_uniform("HeightPyramid", RenderDoos::uniform_type::sampler, 1);
+  prev_cam_handle = engine->add_uniform("PrevCamera", RenderDoos::uniform_type::mat4, 1);
+  reproject_handle = engine->add_uniform("ReprojectParams", RenderDoos::uniform_type::vec4, 1);
+  prev_depth_handle = engine->add_uniform("PrevDepth", RenderDoos::uniform_type::sampler, 1);
+  beam_params_handle = engine->add_uniform("BeamParams", RenderDoos::uniform_type::vec4, 1);
+  beam_handle = engine->add_uniform("Beam", RenderDoos::uniform_type::sampler, 1);
+  sun_handle = engine->add_uniform("Sun", RenderDoos::uniform_type::vec4, 1);
+  horizon0_handle = engine->add_uniform("HorizonMap0", RenderDoos::uniform_type::sampler, 1);
+  horizon1_handle = engine->add_uniform("HorizonMap1", RenderDoos::uniform_type::sampler, 1);
+  terrain_params_handle = engine->add_uniform("TerrainParams", RenderDoos::uniform_type::vec4, 1);
   }
 
 void terrain_material::bind(RenderDoos::render_engine* engine)
@@ -233,19 +541,529 @@ void terrain_material::bind(RenderDoos::render_engine* engine)
   engine->set_uniform(res_handle, (void*)res);
   int32_t tex = 0;
   engine->set_uniform(heightmap_handle, (void*)&tex);
-  tex = 1;
-  engine->set_uniform(normalmap_handle, (void*)&tex);
   tex = 2;
   engine->set_uniform(colormap_handle, (void*)&tex);
+  tex = 3;
+  engine->set_uniform(height_pyramid_handle, (void*)&tex);
 
   engine->bind_texture_to_channel(texture_heightmap, 0, TEX_WRAP_REPEAT | TEX_FILTER_LINEAR);
-  engine->bind_texture_to_channel(texture_normalmap, 1, TEX_WRAP_REPEAT | TEX_FILTER_LINEAR);
   engine->bind_texture_to_channel(texture_colormap, 2, TEX_WRAP_REPEAT | TEX_FILTER_LINEAR);
+  engine->bind_texture_to_channel(texture_height_pyramid, 3, TEX_WRAP_REPEAT | TEX_FILTER_NEAREST);
+  // the previous camera is the one of the previous bind, which rendered the hit distances in texture_prev_depth
+  const bool reproject = !beam_pass && texture_prev_depth >= 0 && has_prev_camera;
+  if (!has_prev_camera)
+    prev_camera = cam;
+  engine->set_uniform(prev_cam_handle, (void*)(&prev_camera));
+  float reproject_params[4] = { reproject ? 1.f : 0.f, 0.f, 0.f, 0.f };
+  engine->set_uniform(reproject_handle, (void*)reproject_params);
+  tex = 4;
+  engine->set_uniform(prev_depth_handle, (void*)&tex);
+  engine->bind_texture_to_channel(reproject ? texture_prev_depth : texture_height_pyramid, 4, TEX_WRAP_REPEAT | TEX_FILTER_NEAREST);
+  if (!beam_pass)
+    {
+    prev_camera = cam;
+    has_prev_camera = true;
+    }
+  const bool use_beam = !beam_pass && texture_beam >= 0;
+  float beam_params[4] = { beam_pass ? 1.f : 0.f, use_beam ? 1.f : 0.f, (float)beam_tile_size, 0.f };
+  engine->set_uniform(beam_params_handle, (void*)beam_params);
+  tex = 5;
+  engine->set_uniform(beam_handle, (void*)&tex);
+  engine->bind_texture_to_channel(use_beam ? texture_beam : texture_height_pyramid, 5, TEX_WRAP_REPEAT | TEX_FILTER_NEAREST);
+  const bool use_shadows = shadows && texture_horizon0 >= 0 && texture_horizon1 >= 0;
+  float sun_params[4] = { sun[0], sun[1], sun[2], use_shadows ? 1.f : 0.f };
+  engine->set_uniform(sun_handle, (void*)sun_params);
+  tex = 6;
+  engine->set_uniform(horizon0_handle, (void*)&tex);
+  tex = 7;
+  engine->set_uniform(horizon1_handle, (void*)&tex);
+  engine->bind_texture_to_channel(use_shadows ? texture_horizon0 : texture_colormap, 6, TEX_WRAP_REPEAT | TEX_FILTER_LINEAR);
+  engine->bind_texture_to_channel(use_shadows ? texture_horizon1 : texture_colormap, 7, TEX_WRAP_REPEAT | TEX_FILTER_LINEAR);
+  float terrain_params[4] = { repeat ? 1.f : 0.f, 0.f, 0.f, 0.f };
+  engine->set_uniform(terrain_params_handle, (void*)terrain_params);
 
   engine->bind_uniform(shader_program_handle, proj_handle);
   engine->bind_uniform(shader_program_handle, cam_handle);
   engine->bind_uniform(shader_program_handle, res_handle);
   engine->bind_uniform(shader_program_handle, heightmap_handle);
-  engine->bind_uniform(shader_program_handle, normalmap_handle);
   engine->bind_uniform(shader_program_handle, colormap_handle);
-  }
\ No newline at end of file
+  engine->bind_uniform(shader_program_handle, height_pyramid_handle);
+  engine->bind_uniform(shader_program_handle, prev_cam_handle);
+  engine->bind_uniform(shader_program_handle, reproject_handle);
+  engine->bind_uniform(shader_program_handle, prev_depth_handle);
+  engine->bind_uniform(shader_program_handle, beam_params_handle);
+  engine->bind_uniform(shader_program_handle, beam_handle);
+  engine->bind_uniform(shader_program_handle, sun_handle);
+  engine->bind_uniform(shader_program_handle, horizon0_handle);
+  engine->bind_uniform(shader_program_handle, horizon1_handle);
+  engine->bind_uniform(shader_program_handle, terrain_params_handle);
+  }
+
+static std::string get_terrain_mesh_material_vertex_shader()
+  {
+  return std::string(R"(#version 330 core
+layout (location = 0) in vec3 vPosition;
+uniform mat4 Camera;
+uniform vec3 iResolution;
+uniform vec4 NodeParams; // xy: world corner, z: world size, w: grid dimension
+uniform vec4 MorphParams; // x: morph start distance, y: morph end distance
+uniform sampler2D Heightmap;
+
+out vec3 worldPos;
+
+vec2 scalePosition(in vec2 p)
+{
+  p = p*0.02;
+  p = p+vec2(0.5);
+  p = mix(vec2(0.5, 0.0), vec2(1.0, 0.5), p);
+  return p;
+}
+
+float terrain( in vec2 p)
+{
+   p = scalePosition(p);
+   if (p.x < 0.0 || p.x >= 1.0 || p.y < 0.0 || p.y >= 1.0)
+     return 0.0;
+   return dot(textureLod( Heightmap, p, 0.0).xy, vec2(65280.0, 255.0)/65535.0)*5;
+}
+
+void main()
+  {
+  // same camera frame as the raymarched terrain
+  vec3 ro = (Camera*vec4(0,0,0,1)).xyz;
+  ro.y += 3;
+  vec3 rx = (Camera*vec4(1,0,0,0)).xyz;
+  vec3 ry = (Camera*vec4(0,1,0,0)).xyz;
+  vec3 rz = (Camera*vec4(0,0,1,0)).xyz;
+
+  vec2 grid = vPosition.xz;
+  vec2 p = NodeParams.xy + grid*NodeParams.z;
+  float dist = distance(ro, vec3(p.x, terrain(p), p.y));
+  float k = clamp((dist - MorphParams.x)/(MorphParams.y - MorphParams.x), 0.0, 1.0);
+  // odd grid vertices slide onto the edges of the coarser grid
+  vec2 frac_part = fract(grid*NodeParams.w*0.5)*2.0/NodeParams.w;
+  grid -= frac_part*k;
+  p = NodeParams.xy + grid*NodeParams.z;
+  worldPos = vec3(p.x, terrain(p), p.y);
+
+  vec3 d = worldPos - ro;
+  vec3 v = vec3(dot(d, rx), dot(d, ry), dot(d, rz));
+  const float n = 0.05;
+  const float f = 100.0;
+  float aspect = iResolution.x/iResolution.y;
+  gl_Position = vec4(2.0*v.x/aspect, 2.0*v.y, (v.z*(f+n) - 2.0*f*n)/(f-n), v.z);
+  }
+)");
+  }
+
+static std::string get_terrain_mesh_material_fragment_shader()
+  {
+  return std::string(R"(#version 330 core
+uniform sampler2D Heightmap;
+uniform sampler2D Colormap;
+
+in vec3 worldPos;
+out vec4 FragColor;
+
+vec2 scalePosition(in vec2 p)
+{
+  p = p*0.02;
+  p = p+vec2(0.5);
+  p = mix(vec2(0.5, 0.0), vec2(1.0, 0.5), p);
+  return p;
+}
+
+void main()
+  {
+  vec3 col = vec3(0.7, 0.7, 0.7);
+  vec2 p = scalePosition(worldPos.xz);
+  vec2 n = texture( Heightmap, p).ba*2.0 - 1.0;
+  vec3 normal = vec3(n, sqrt(max(1.0 - dot(n, n), 0.0)));
+  vec4 texCol = texture( Colormap, p);
+  if (texCol.a > 0)
+    {
+    vec3 terraincol = vec3(pow(texCol.rgb, vec3(0.5)));
+    vec3 sunDir = normalize(vec3(0, +0.5, -1));
+    terraincol = terraincol * clamp(-dot(normal*0.5 + 0.5, sunDir), 0.0f, 1.0f) * 0.9 + terraincol*0.1;
+    terraincol = pow(terraincol*1.2, vec3(2.2));
+    col = terraincol*texCol.a + col*(1-texCol.a);
+    }
+  FragColor = vec4(col, 1.0);
+  }
+)");
+  }
+
+terrain_mesh_material::terrain_mesh_material()
+  {
+  vs_handle = -1;
+  fs_handle = -1;
+  shader_program_handle = -1;
+  cam_handle = -1;
+  res_handle = -1;
+  node_handle = -1;
+  morph_handle = -1;
+  texture_heightmap = -1;
+  texture_colormap = -1;
+  heightmap_handle = -1;
+  colormap_handle = -1;
+  }
+
+terrain_mesh_material::~terrain_mesh_material()
+  {
+  }
+
+void terrain_mesh_material::destroy(RenderDoos::render_engine* engine)
+  {
+  engine->remove_shader(vs_handle);
+  engine->remove_shader(fs_handle);
+  engine->remove_program(shader_program_handle);
+  engine->remove_uniform(cam_handle);
+  engine->remove_uniform(res_handle);
+  engine->remove_uniform(node_handle);
+  engine->remove_uniform(morph_handle);
+  engine->remove_uniform(heightmap_handle);
+  engine->remove_uniform(colormap_handle);
+  }
+
+void terrain_mesh_material::set_texture_heightmap(int32_t id)
+  {
+  texture_heightmap = id;
+  }
+
+void terrain_mesh_material::set_texture_colormap(int32_t id)
+  {
+  texture_colormap = id;
+  }
+
+void terrain_mesh_material::compile(RenderDoos::render_engine* engine)
+  {
+  if (engine->get_renderer_type() == RenderDoos::renderer_type::METAL)
+    {
+    vs_handle = engine->add_shader(nullptr, SHADER_VERTEX, "terrain_mesh_material_vertex_shader");
+    fs_handle = engine->add_shader(nullptr, SHADER_FRAGMENT, "terrain_mesh_material_fragment_shader");
+    shader_program_handle = engine->add_program(vs_handle, fs_handle);
+    }
+  else if (engine->get_renderer_type() == RenderDoos::renderer_type::OPENGL)
+    {
+    shader_program_handle = add_cached_program(engine, vs_handle, fs_handle, get_terrain_mesh_material_vertex_shader(), get_terrain_mesh_material_fragment_shader());
+    }
+  cam_handle = engine->add_uniform("Camera", RenderDoos::uniform_type::mat4, 1);
+  res_handle = engine->add_uniform("iResolution", RenderDoos::uniform_type::vec3, 1);
+  node_handle = engine->add_uniform("NodeParams", RenderDoos::uniform_type::vec4, 1);
+  morph_handle = engine->add_uniform("MorphParams", RenderDoos::uniform_type::vec4, 1);
+  heightmap_handle = engine->add_uniform("Heightmap", RenderDoos::uniform_type::sampler, 1);
+  colormap_handle = engine->add_uniform("Colormap", RenderDoos::uniform_type::sampler, 1);
+  }
+
+void terrain_mesh_material::bind(RenderDoos::render_engine* engine)
+  {
+  engine->bind_program(shader_program_handle);
+  RenderDoos::float4x4 cam = (engine->get_camera_space());
+  engine->set_uniform(cam_handle, (void*)(&cam));
+  const auto& mv = engine->get_model_view_properties();
+  float res[3] = { (float)mv.viewport_width, (float)mv.viewport_height, 1.f };
+  engine->set_uniform(res_handle, (void*)res);
+  int32_t tex = 0;
+  engine->set_uniform(heightmap_handle, (void*)&tex);
+  tex = 2;
+  engine->set_uniform(colormap_handle, (void*)&tex);
+
+  engine->bind_texture_to_channel(texture_heightmap, 0, TEX_WRAP_REPEAT | TEX_FILTER_LINEAR);
+  engine->bind_texture_to_channel(texture_colormap, 2, TEX_WRAP_REPEAT | TEX_FILTER_LINEAR);
+
+  engine->bind_uniform(shader_program_handle, cam_handle);
+  engine->bind_uniform(shader_program_handle, res_handle);
+  engine->bind_uniform(shader_program_handle, heightmap_handle);
+  engine->bind_uniform(shader_program_handle, colormap_handle);
+  }
+
+void terrain_mesh_material::bind_node(RenderDoos::render_engine* engine, const cdlod_node& node, int32_t grid_dim)
+  {
+  float node_params[4] = { node.x, node.z, node.size, (float)grid_dim };
+  float morph_params[4] = { node.morph_start, node.morph_end, 0.f, 0.f };
+  engine->set_uniform(node_handle, (void*)node_params);
+  engine->set_uniform(morph_handle, (void*)morph_params);
+  engine->bind_uniform(shader_program_handle, node_handle);
+  engine->bind_uniform(shader_program_handle, morph_handle);
+  }
+static std::string get_terrain_tile_material_vertex_shader()
+  {
+  return std::string(R"(#version 330 core
+layout (location = 0) in vec3 vPosition;
+uniform mat4 Camera;
+uniform vec3 iResolution;
+uniform vec4 NodeParams; // xy: world corner, z: world size, w: grid dimension
+uniform vec4 MorphParams; // x: morph start distance, y: morph end distance
+uniform vec4 TileParams; // xy: offset of the node inside the bound tile, z: scale, w: tile size
+uniform vec4 ViewParams; // x: height scale, y: far plane, z: eye height above the camera
+uniform sampler2D Tile; // rg: high and low byte of the 16 bit heights
+
+out vec3 worldPos;
+
+float tileHeight(in vec2 grid)
+{
+  // the tile has TileParams.w+1 samples per side, sample centers are at the grid vertices
+  vec2 t = TileParams.xy + grid*TileParams.z;
+  vec2 uv = (vec2(0.5) + t*TileParams.w)/(TileParams.w + 1.0);
+  return dot(textureLod(Tile, uv, 0.0).xy, vec2(65280.0, 255.0)/65535.0)*ViewParams.x;
+}
+
+void main()
+  {
+  vec3 ro = (Camera*vec4(0,0,0,1)).xyz;
+  ro.y += ViewParams.z;
+  vec3 rx = (Camera*vec4(1,0,0,0)).xyz;
+  vec3 ry = (Camera*vec4(0,1,0,0)).xyz;
+  vec3 rz = (Camera*vec4(0,0,1,0)).xyz;
+
+  vec2 grid = vPosition.xz;
+  vec2 p = NodeParams.xy + grid*NodeParams.z;
+  float dist = distance(ro, vec3(p.x, tileHeight(grid), p.y));
+  float k = clamp((dist - MorphParams.x)/(MorphParams.y - MorphParams.x), 0.0, 1.0);
+  vec2 frac_part = fract(grid*NodeParams.w*0.5)*2.0/NodeParams.w;
+  grid -= frac_part*k;
+  p = NodeParams.xy + grid*NodeParams.z;
+  worldPos = vec3(p.x, tileHeight(grid), p.y);
+
+  vec3 d = worldPos - ro;
+  vec3 v = vec3(dot(d, rx), dot(d, ry), dot(d, rz));
+  const float n = 0.05;
+  float f = ViewParams.y;
+  float aspect = iResolution.x/iResolution.y;
+  gl_Position = vec4(2.0*v.x/aspect, 2.0*v.y, (v.z*(f+n) - 2.0*f*n)/(f-n), v.z);
+  }
+)");
+  }
+
+static std::string get_terrain_tile_material_fragment_shader()
+  {
+  return std::string(R"(#version 330 core
+uniform vec4 ViewParams; // x: height scale, y: far plane, z: eye height above the camera
+
+in vec3 worldPos;
+out vec4 FragColor;
+
+void main()
+  {
+  vec3 normal = normalize(cross(dFdy(worldPos), dFdx(worldPos)));
+  if (normal.y < 0.0)
+    normal = -normal;
+  float h = clamp(worldPos.y/ViewParams.x, 0.0, 1.0);
+  vec3 col = mix(vec3(0.25, 0.35, 0.15), vec3(0.45, 0.38, 0.3), smoothstep(0.2, 0.6, h));
+  col = mix(col, vec3(0.9, 0.9, 0.95), smoothstep(0.7, 0.85, h));
+  vec3 sunDir = normalize(vec3(0.3, 1.0, -0.5));
+  col = col * clamp(dot(normal, sunDir), 0.0, 1.0) * 0.9 + col*0.1;
+  FragColor = vec4(col, 1.0);
+  }
+)");
+  }
+
+terrain_tile_material::terrain_tile_material()
+  {
+  vs_handle = -1;
+  fs_handle = -1;
+  shader_program_handle = -1;
+  cam_handle = -1;
+  res_handle = -1;
+  node_handle = -1;
+  morph_handle = -1;
+  tile_params_handle = -1;
+  view_params_handle = -1;
+  tile_handle = -1;
+  height_scale = 1.f;
+  far_plane = 100.f;
+  eye_height = terrain_camera_height_offset;
+  }
+
+terrain_tile_material::~terrain_tile_material()
+  {
+  }
+
+void terrain_tile_material::destroy(RenderDoos::render_engine* engine)
+  {
+  engine->remove_shader(vs_handle);
+  engine->remove_shader(fs_handle);
+  engine->remove_program(shader_program_handle);
+  engine->remove_uniform(cam_handle);
+  engine->remove_uniform(res_handle);
+  engine->remove_uniform(node_handle);
+  engine->remove_uniform(morph_handle);
+  engine->remove_uniform(tile_params_handle);
+  engine->remove_uniform(view_params_handle);
+  engine->remove_uniform(tile_handle);
+  }
+
+void terrain_tile_material::set_height_scale(float s)
+  {
+  height_scale = s;
+  }
+
+void terrain_tile_material::set_far_plane(float f)
+  {
+  far_plane = f;
+  }
+
+void terrain_tile_material::set_eye_height(float h)
+  {
+  eye_height = h;
+  }
+
+void terrain_tile_material::compile(RenderDoos::render_engine* engine)
+  {
+  if (engine->get_renderer_type() == RenderDoos::renderer_type::METAL)
+    {
+    vs_handle = engine->add_shader(nullptr, SHADER_VERTEX, "terrain_tile_material_vertex_shader");
+    fs_handle = engine->add_shader(nullptr, SHADER_FRAGMENT, "terrain_tile_material_fragment_shader");
+    shader_program_handle = engine->add_program(vs_handle, fs_handle);
+    }
+  else if (engine->get_renderer_type() == RenderDoos::renderer_type::OPENGL)
+    {
+    shader_program_handle = add_cached_program(engine, vs_handle, fs_handle, get_terrain_tile_material_vertex_shader(), get_terrain_tile_material_fragment_shader());
+    }
+  cam_handle = engine->add_uniform("Camera", RenderDoos::uniform_type::mat4, 1);
+  res_handle = engine->add_uniform("iResolution", RenderDoos::uniform_type::vec3, 1);
+  node_handle = engine->add_uniform("NodeParams", RenderDoos::uniform_type::vec4, 1);
+  morph_handle = engine->add_uniform("MorphParams", RenderDoos::uniform_type::vec4, 1);
+  tile_params_handle = engine->add_uniform("TileParams", RenderDoos::uniform_type::vec4, 1);
+  view_params_handle = engine->add_uniform("ViewParams", RenderDoos::uniform_type::vec4, 1);
+  tile_handle = engine->add_uniform("Tile", RenderDoos::uniform_type::sampler, 1);
+  }
+
+void terrain_tile_material::bind(RenderDoos::render_engine* engine)
+  {
+  engine->bind_program(shader_program_handle);
+  RenderDoos::float4x4 cam = (engine->get_camera_space());
+  engine->set_uniform(cam_handle, (void*)(&cam));
+  const auto& mv = engine->get_model_view_properties();
+  float res[3] = { (float)mv.viewport_width, (float)mv.viewport_height, 1.f };
+  engine->set_uniform(res_handle, (void*)res);
+  float view_params[4] = { height_scale, far_plane, eye_height, 0.f };
+  engine->set_uniform(view_params_handle, (void*)view_params);
+  int32_t tex = 0;
+  engine->set_uniform(tile_handle, (void*)&tex);
+
+  engine->bind_uniform(shader_program_handle, cam_handle);
+  engine->bind_uniform(shader_program_handle, res_handle);
+  engine->bind_uniform(shader_program_handle, view_params_handle);
+  engine->bind_uniform(shader_program_handle, tile_handle);
+  }
+
+void terrain_tile_material::bind_node(RenderDoos::render_engine* engine, const cdlod_node& node, int32_t grid_dim, const terrain_tile_binding& tile)
+  {
+  float node_params[4] = { node.x, node.z, node.size, (float)grid_dim };
+  float morph_params[4] = { node.morph_start, node.morph_end, 0.f, 0.f };
+  float tile_params[4] = { tile.uv_offset[0], tile.uv_offset[1], tile.uv_scale, (float)grid_dim };
+  engine->set_uniform(node_handle, (void*)node_params);
+  engine->set_uniform(morph_handle, (void*)morph_params);
+  engine->set_uniform(tile_params_handle, (void*)tile_params);
+  engine->bind_texture_to_channel(tile.texture_id, 0, TEX_WRAP_REPEAT | TEX_FILTER_LINEAR);
+  engine->bind_uniform(shader_program_handle, node_handle);
+  engine->bind_uniform(shader_program_handle, morph_handle);
+  engine->bind_uniform(shader_program_handle, tile_params_handle);
+  }
+
+static std::string get_terrain_upsample_material_vertex_shader()
+  {
+  return std::string(R"(#version 330 core
+layout (location = 0) in vec3 vPosition;
+
+void main()
+  {
+  gl_Position = vec4(vPosition.xy, 0, 1);
+  }
+)");
+  }
+
+static std::string get_terrain_upsample_material_fragment_shader()
+  {
+  return std::string(R"(#version 330 core
+uniform vec3 iResolution;
+uniform sampler2D LowRes; // rgb: color, a: sqrt(t/maxd) of the raymarched terrain
+
+out vec4 FragColor;
+
+void main()
+  {
+  ivec2 low_size = textureSize(LowRes, 0);
+  vec2 scale = vec2(low_size)/iResolution.xy;
+  // the low resolution texel covering this pixel decides which surface we are on
+  ivec2 nearest = clamp(ivec2(gl_FragCoord.xy*scale), ivec2(0), low_size - 1);
+  float ref_depth = texelFetch(LowRes, nearest, 0).a;
+  vec2 p = gl_FragCoord.xy*scale - 0.5;
+  ivec2 base = ivec2(floor(p));
+  vec2 f = p - vec2(base);
+  vec4 sum = vec4(0.0);
+  for (int j = 0; j < 2; ++j)
+    {
+    for (int i = 0; i < 2; ++i)
+      {
+      vec4 s = texelFetch(LowRes, clamp(base + ivec2(i, j), ivec2(0), low_size - 1), 0);
+      float w = (i == 0 ? 1.0 - f.x : f.x)*(j == 0 ? 1.0 - f.y : f.y);
+      // bilinear weights, suppressed for samples at a different depth
+      w = max(w*exp(-abs(s.a - ref_depth)*64.0), 1e-5);
+      sum += vec4(s.rgb*w, w);
+      }
+    }
+  FragColor = vec4(sum.rgb/sum.a, 1.0);
+  }
+)");
+  }
+
+terrain_upsample_material::terrain_upsample_material()
+  {
+  vs_handle = -1;
+  fs_handle = -1;
+  shader_program_handle = -1;
+  res_handle = -1;
+  low_res_handle = -1;
+  texture_low_res = -1;
+  }
+
+terrain_upsample_material::~terrain_upsample_material()
+  {
+  }
+
+void terrain_upsample_material::destroy(RenderDoos::render_engine* engine)
+  {
+  engine->remove_shader(vs_handle);
+  engine->remove_shader(fs_handle);
+  engine->remove_program(shader_program_handle);
+  engine->remove_uniform(res_handle);
+  engine->remove_uniform(low_res_handle);
+  }
+
+void terrain_upsample_material::set_texture_low_res(int32_t id)
+  {
+  texture_low_res = id;
+  }
+
+void terrain_upsample_material::compile(RenderDoos::render_engine* engine)
+  {
+  if (engine->get_renderer_type() == RenderDoos::renderer_type::METAL)
+    {
+    vs_handle = engine->add_shader(nullptr, SHADER_VERTEX, "terrain_upsample_material_vertex_shader");
+    fs_handle = engine->add_shader(nullptr, SHADER_FRAGMENT, "terrain_upsample_material_fragment_shader");
+    shader_program_handle = engine->add_program(vs_handle, fs_handle);
+    }
+  else if (engine->get_renderer_type() == RenderDoos::renderer_type::OPENGL)
+    {
+    shader_program_handle = add_cached_program(engine, vs_handle, fs_handle, get_terrain_upsample_material_vertex_shader(), get_terrain_upsample_material_fragment_shader());
+    }
+  res_handle = engine->add_uniform("iResolution", RenderDoos::uniform_type::vec3, 1);
+  low_res_handle = engine->add_uniform("LowRes", RenderDoos::uniform_type::sampler, 1);
+  }
+
+void terrain_upsample_material::bind(RenderDoos::render_engine* engine)
+  {
+  engine->bind_program(shader_program_handle);
+  const auto& mv = engine->get_model_view_properties();
+  float res[3] = { (float)mv.viewport_width, (float)mv.viewport_height, 1.f };
+  engine->set_uniform(res_handle, (void*)res);
+  int32_t tex = 0;
+  engine->set_uniform(low_res_handle, (void*)&tex);
+
+  engine->bind_texture_to_channel(texture_low_res, 0, TEX_WRAP_REPEAT | TEX_FILTER_NEAREST);
+
+  engine->bind_uniform(shader_program_handle, res_handle);
+  engine->bind_uniform(shader_program_handle, low_res_handle);
+  }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "RenderDoos/material.h"
+#include "RenderDoos/types.h"
 
 class terrain_material : public RenderDoos::material
   {
@@ -13,13 +14,119 @@ class terrain_material : public RenderDoos::material
     virtual void destroy(RenderDoos::render_engine* engine);
 
     void set_texture_heightmap(int32_t id);
-    void set_texture_normalmap(int32_t id);
     void set_texture_colormap(int32_t id);
+    void set_texture_height_pyramid(int32_t id);
+    // frame buffer texture written by the previous bind (hit distance in alpha), -1 to march every ray from the camera
+    void set_texture_prev_depth(int32_t id);
+    // The beam pre-pass renders one texel per beam_tile_size x beam_tile_size pixels with a conservative
+    // start distance for all rays of the tile; the resolution is still the one of the full pass.
+    void set_beam_pass(bool enable);
+    // frame buffer texture written by the beam pre-pass of this frame, -1 to skip it
+    void set_texture_beam(int32_t id);
+    // horizon maps made by make_horizon_maps, used for the shadows of the sun
+    void set_textures_horizon_maps(int32_t id0, int32_t id1);
+    // direction towards the sun in world space (y up)
+    void set_sun_direction(float x, float y, float z);
+    void set_shadows(bool enable);
+    // repeat the heightmap, colormap and height pyramid endlessly instead of only drawing the terrain inside the heightmap (see procedural_terrain)
+    void set_repeat(bool enable);
+
+    static const int beam_tile_size = 8;
 
   private:
     int32_t vs_handle, fs_handle;
     int32_t shader_program_handle;
     int32_t proj_handle, res_handle, cam_handle;
-    int32_t texture_heightmap, texture_normalmap, texture_colormap;
-    int32_t heightmap_handle, normalmap_handle, colormap_handle;
-  };
\ No newline at end of file
+    int32_t texture_heightmap, texture_colormap, texture_height_pyramid;
+    int32_t heightmap_handle, colormap_handle, height_pyramid_handle;
+    int32_t prev_cam_handle, reproject_handle, prev_depth_handle;
+    int32_t texture_prev_depth;
+    RenderDoos::float4x4 prev_camera;
+    bool has_prev_camera;
+    int32_t beam_params_handle, beam_handle;
+    int32_t texture_beam;
+    bool beam_pass;
+    int32_t sun_handle, horizon0_handle, horizon1_handle;
+    int32_t texture_horizon0, texture_horizon1;
+    float sun[3];
+    bool shadows;
+    int32_t terrain_params_handle;
+    bool repeat;
+  };
+
+struct cdlod_node;
+
+class terrain_mesh_material : public RenderDoos::material
+  {
+  public:
+    terrain_mesh_material();
+    virtual ~terrain_mesh_material();
+
+    virtual void compile(RenderDoos::render_engine* engine);
+    virtual void bind(RenderDoos::render_engine* engine);
+    virtual void destroy(RenderDoos::render_engine* engine);
+
+    void set_texture_heightmap(int32_t id);
+    void set_texture_colormap(int32_t id);
+
+    // call after bind for every selected quadtree node before drawing the grid
+    void bind_node(RenderDoos::render_engine* engine, const cdlod_node& node, int32_t grid_dim);
+
+  private:
+    int32_t vs_handle, fs_handle;
+    int32_t shader_program_handle;
+    int32_t cam_handle, res_handle, node_handle, morph_handle;
+    int32_t texture_heightmap, texture_colormap;
+    int32_t heightmap_handle, colormap_handle;
+  };
+struct terrain_tile_binding;
+
+// Renders cdlod nodes of a streamed tiled terrain (see terrain_tiles.h): every node samples its heights
+// from the tile texture that the streamer returned for it.
+class terrain_tile_material : public RenderDoos::material
+  {
+  public:
+    terrain_tile_material();
+    virtual ~terrain_tile_material();
+
+    virtual void compile(RenderDoos::render_engine* engine);
+    virtual void bind(RenderDoos::render_engine* engine);
+    virtual void destroy(RenderDoos::render_engine* engine);
+
+    void set_height_scale(float s);
+    void set_far_plane(float f);
+    // height of the eye above the translation of the camera matrix, as the eye of make_cdlod_view
+    void set_eye_height(float h);
+
+    // call after bind for every selected quadtree node before drawing the grid
+    void bind_node(RenderDoos::render_engine* engine, const cdlod_node& node, int32_t grid_dim, const terrain_tile_binding& tile);
+
+  private:
+    int32_t vs_handle, fs_handle;
+    int32_t shader_program_handle;
+    int32_t cam_handle, res_handle, node_handle, morph_handle, tile_params_handle, view_params_handle;
+    int32_t tile_handle;
+    float height_scale, far_plane, eye_height;
+  };
+
+// Upsamples the terrain raymarched into a lower resolution frame buffer to the screen.
+// The low resolution target stores the encoded hit distance in alpha; bilinear weights are
+// suppressed for samples that lie at a different depth than the nearest one, so silhouettes stay sharp.
+class terrain_upsample_material : public RenderDoos::material
+  {
+  public:
+    terrain_upsample_material();
+    virtual ~terrain_upsample_material();
+
+    virtual void compile(RenderDoos::render_engine* engine);
+    virtual void bind(RenderDoos::render_engine* engine);
+    virtual void destroy(RenderDoos::render_engine* engine);
+
+    void set_texture_low_res(int32_t id);
+
+  private:
+    int32_t vs_handle, fs_handle;
+    int32_t shader_program_handle;
+    int32_t res_handle, low_res_handle;
+    int32_t texture_low_res;
+  };
@@ -0,0 +1,152 @@
+#include "max_mip.h"
+#include "image.h"
+#include "parallel.h"
+
+#include <algorithm>
+
+namespace
+  {
+  int next_power_of_two(int v)
+    {
+    int p = 1;
+    while (p < v)
+      p <<= 1;
+    return p;
+    }
+
+  int level_offset_x(const max_mip_pyramid& pyramid, int level)
+    {
+    return level == 0 ? 0 : pyramid.base_w;
+    }
+
+  int level_offset_y(const max_mip_pyramid& pyramid, int level)
+    {
+    return level <= 1 ? 0 : pyramid.base_h - (pyramid.base_h >> (level - 1));
+    }
+
+  int floor_shift(int v, int level)
+    {
+    return v >= 0 ? v >> level : -((-v + (1 << level) - 1) >> level);
+    }
+
+  int wrap(int v, int n)
+    {
+    return ((v % n) + n) % n;
+    }
+  }
+
+max_mip_pyramid::max_mip_pyramid() : base_w(0), base_h(0), levels(0), atlas_w(0), atlas_h(0)
+  {
+  }
+
+float max_mip_pyramid::get(int level, int x, int y) const
+  {
+  const int lw = std::max(base_w >> level, 1);
+  const int lh = std::max(base_h >> level, 1);
+  if (x < 0 || y < 0 || x >= lw || y >= lh)
+    return 0.f;
+  return atlas[(level_offset_y(*this, level) + y) * atlas_w + level_offset_x(*this, level) + x];
+  }
+
+void build_max_mip_pyramid(max_mip_pyramid& pyramid, const height_image& heightmap)
+  {
+  const int w = heightmap.w;
+  const int h = heightmap.h;
+  pyramid.base_w = next_power_of_two(w);
+  pyramid.base_h = next_power_of_two(h);
+  pyramid.levels = 1;
+  while ((pyramid.base_w >> pyramid.levels) > 0 && (pyramid.base_h >> pyramid.levels) > 0)
+    ++pyramid.levels;
+  pyramid.atlas_w = pyramid.base_w + pyramid.base_w / 2;
+  pyramid.atlas_h = pyramid.base_h;
+  pyramid.atlas.assign((size_t)pyramid.atlas_w * pyramid.atlas_h, 0.f);
+
+  const uint16_t* src = heightmap.im;
+  // Bilinear filtering with repeat wrapping inside texel (x,y) reads texels x-1..x+1, y-1..y+1,
+  // so level 0 stores the 3x3 neighbourhood maximum.
+  parallel_for(0, h, [&](int y)
+    {
+    float* dst = pyramid.atlas.data() + (size_t)y * pyramid.atlas_w;
+    for (int x = 0; x < w; ++x)
+      {
+      uint16_t m = 0;
+      for (int dy = -1; dy <= 1; ++dy)
+        {
+        const int yy = (y + dy + h) % h;
+        for (int dx = -1; dx <= 1; ++dx)
+          {
+          const int xx = (x + dx + w) % w;
+          m = std::max(m, src[(size_t)yy * w + xx]);
+          }
+        }
+      dst[x] = (float)m / 65535.f;
+      }
+    });
+
+  for (int level = 1; level < pyramid.levels; ++level)
+    {
+    const int lw = pyramid.base_w >> level;
+    const int lh = pyramid.base_h >> level;
+    const int src_x = level_offset_x(pyramid, level - 1);
+    const int src_y = level_offset_y(pyramid, level - 1);
+    const int dst_x = level_offset_x(pyramid, level);
+    const int dst_y = level_offset_y(pyramid, level);
+    parallel_for(0, lh, [&](int y)
+      {
+      const float* s0 = pyramid.atlas.data() + (size_t)(src_y + 2 * y) * pyramid.atlas_w + src_x;
+      const float* s1 = s0 + pyramid.atlas_w;
+      float* dst = pyramid.atlas.data() + (size_t)(dst_y + y) * pyramid.atlas_w + dst_x;
+      for (int x = 0; x < lw; ++x)
+        dst[x] = std::max(std::max(s0[2 * x], s0[2 * x + 1]), std::max(s1[2 * x], s1[2 * x + 1]));
+      });
+    }
+  }
+
+void update_max_mip_pyramid(max_mip_pyramid& pyramid, const height_image& heightmap, int x, int y, int w, int h)
+  {
+  if (heightmap.w != pyramid.base_w || heightmap.h != pyramid.base_h)
+    return;
+  const uint16_t* src = heightmap.im;
+  // level 0 texels next to the rectangle read the changed heights in their 3x3 neighbourhood as well
+  const int x0 = x - 1;
+  const int y0 = y - 1;
+  const int x1 = x + w + 1;
+  const int y1 = y + h + 1;
+  for (int level = 0; level < pyramid.levels; ++level)
+    {
+    const int lw = std::max(pyramid.base_w >> level, 1);
+    const int lh = std::max(pyramid.base_h >> level, 1);
+    const int cx0 = floor_shift(x0, level);
+    const int cy0 = floor_shift(y0, level);
+    const int nx = std::min(floor_shift(x1 - 1, level) - cx0 + 1, lw);
+    const int ny = std::min(floor_shift(y1 - 1, level) - cy0 + 1, lh);
+    const int dst_x = level_offset_x(pyramid, level);
+    const int dst_y = level_offset_y(pyramid, level);
+    parallel_for(0, ny, [&](int j)
+      {
+      const int cy = wrap(cy0 + j, lh);
+      float* dst = pyramid.atlas.data() + (size_t)(dst_y + cy) * pyramid.atlas_w + dst_x;
+      for (int i = 0; i < nx; ++i)
+        {
+        const int cx = wrap(cx0 + i, lw);
+        if (level == 0)
+          {
+          uint16_t m = 0;
+          for (int dy = -1; dy <= 1; ++dy)
+            {
+            const uint16_t* row = src + (size_t)wrap(cy + dy, lh) * lw;
+            for (int dx = -1; dx <= 1; ++dx)
+              m = std::max(m, row[wrap(cx + dx, lw)]);
+            }
+          dst[cx] = (float)m / 65535.f;
+          }
+        else
+          {
+          const float* s0 = pyramid.atlas.data() + (size_t)(level_offset_y(pyramid, level - 1) + 2 * cy) * pyramid.atlas_w + level_offset_x(pyramid, level - 1);
+          const float* s1 = s0 + pyramid.atlas_w;
+          dst[cx] = std::max(std::max(s0[2 * cx], s0[2 * cx + 1]), std::max(s1[2 * cx], s1[2 * cx + 1]));
+          }
+        }
+      });
+    }
+  }
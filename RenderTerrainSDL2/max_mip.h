@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+
+struct height_image;
+
+// Maximum mip pyramid of a heightmap, used to skip empty space while raymarching.
+// Level 0 is padded to a power of two size (base_w x base_h). All levels are packed in a
+// single atlas of (base_w + base_w/2) x base_h texels: level 0 at (0,0), level l >= 1 at
+// (base_w, base_h - (base_h >> (l-1))). Every texel stores the maximum normalized height that
+// bilinear filtering can return inside the corresponding cell.
+struct max_mip_pyramid
+  {
+  max_mip_pyramid();
+
+  int base_w, base_h;
+  int levels;
+  int atlas_w, atlas_h;
+  std::vector<float> atlas;
+
+  float get(int level, int x, int y) const;
+  };
+
+void build_max_mip_pyramid(max_mip_pyramid& pyramid, const height_image& heightmap);
+
+// Recomputes the pyramid after the heights inside the rectangle (x, y, w, h) changed. The heightmap must have
+// power of two dimensions (no padding), and the rectangle may wrap around its borders.
+void update_max_mip_pyramid(max_mip_pyramid& pyramid, const height_image& heightmap, int x, int y, int w, int h);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// Calls fun(i) for every i in [begin, end), split over the available hardware threads.
+template <class TFunctor>
+void parallel_for(int begin, int end, TFunctor fun)
+  {
+  const int size = end - begin;
+  if (size <= 0)
+    return;
+  int nr_of_threads = (int)std::thread::hardware_concurrency();
+  if (nr_of_threads < 1)
+    nr_of_threads = 1;
+  nr_of_threads = std::min(nr_of_threads, size);
+  if (nr_of_threads == 1)
+    {
+    for (int i = begin; i < end; ++i)
+      fun(i);
+    return;
+    }
+  std::vector<std::thread> threads;
+  threads.reserve(nr_of_threads);
+  const int chunk = (size + nr_of_threads - 1) / nr_of_threads;
+  for (int t = 0; t < nr_of_threads; ++t)
+    {
+    const int first = begin + t * chunk;
+    const int last = std::min(end, first + chunk);
+    if (first >= last)
+      break;
+    threads.emplace_back([first, last, &fun]()
+      {
+      for (int i = first; i < last; ++i)
+        fun(i);
+      });
+    }
+  for (auto& th : threads)
+    th.join();
+  }
@@ -0,0 +1,351 @@
+#include "procedural_terrain.h"
+#include "parallel.h"
+
+#include "RenderDoos/render_engine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+namespace
+  {
+  // positions are processed in batches of fixed size with plain loops over the batch,
+  // so the compiler can vectorize the noise (sse or neon)
+  const int batch = 8;
+  const int octaves = 8;
+  const float normal_strength = 39.f; // same as the heightmap of the demo
+  const float noise_scale = 1.f / 16.f; // lattice cells per world unit of the first octave
+
+  int wrap(int v, int n)
+    {
+    return ((v % n) + n) % n;
+    }
+
+  int floor_div(int v, int n)
+    {
+    return v >= 0 ? v / n : -((-v + n - 1) / n);
+    }
+
+  inline uint32_t lattice_hash(uint32_t x, uint32_t z, uint32_t seed)
+    {
+    uint32_t h = x * 0x8da6b343u ^ z * 0xd8163841u ^ seed * 0xcb1ab31fu;
+    h ^= h >> 13;
+    h *= 0x85ebca6bu;
+    h ^= h >> 16;
+    return h;
+    }
+
+  // fBm of value noise at batch positions, result roughly in [-1, 1]
+  void fbm(float* result, const float* px, const float* pz, uint32_t seed)
+    {
+    float x[batch], z[batch];
+    for (int i = 0; i < batch; ++i)
+      {
+      x[i] = px[i];
+      z[i] = pz[i];
+      result[i] = 0.f;
+      }
+    float amplitude = 0.5f;
+    for (int o = 0; o < octaves; ++o)
+      {
+      const uint32_t octave_seed = seed + (uint32_t)o * 0x9e3779b9u;
+      for (int i = 0; i < batch; ++i)
+        {
+        const float fx = std::floor(x[i]);
+        const float fz = std::floor(z[i]);
+        const float tx = x[i] - fx;
+        const float tz = z[i] - fz;
+        const float ux = tx * tx * tx * (tx * (tx * 6.f - 15.f) + 10.f);
+        const float uz = tz * tz * tz * (tz * (tz * 6.f - 15.f) + 10.f);
+        const uint32_t ix = (uint32_t)(int32_t)fx;
+        const uint32_t iz = (uint32_t)(int32_t)fz;
+        const float v00 = (float)(lattice_hash(ix, iz, octave_seed) >> 8);
+        const float v10 = (float)(lattice_hash(ix + 1, iz, octave_seed) >> 8);
+        const float v01 = (float)(lattice_hash(ix, iz + 1, octave_seed) >> 8);
+        const float v11 = (float)(lattice_hash(ix + 1, iz + 1, octave_seed) >> 8);
+        const float v0 = v00 + (v10 - v00) * ux;
+        const float v1 = v01 + (v11 - v01) * ux;
+        result[i] += amplitude * ((v0 + (v1 - v0) * uz) * (2.f / 16777215.f) - 1.f);
+        }
+      // next octave: double frequency, rotated to hide the lattice
+      for (int i = 0; i < batch; ++i)
+        {
+        const float rx = 1.6f * x[i] + 1.2f * z[i];
+        const float rz = -1.2f * x[i] + 1.6f * z[i];
+        x[i] = rx;
+        z[i] = rz;
+        }
+      amplitude *= 0.5f;
+      }
+    }
+
+  float smoothstep(float edge0, float edge1, float x)
+    {
+    const float t = std::min(std::max((x - edge0) / (edge1 - edge0), 0.f), 1.f);
+    return t * t * (3.f - 2.f * t);
+    }
+
+  uint32_t terrain_color(float height, float up)
+    {
+    const float sand[3] = { 0.76f, 0.70f, 0.50f };
+    const float grass[3] = { 0.25f, 0.42f, 0.14f };
+    const float rock[3] = { 0.45f, 0.41f, 0.37f };
+    const float snow[3] = { 0.95f, 0.95f, 0.97f };
+    const float to_grass = smoothstep(0.30f, 0.34f, height);
+    const float to_rock = smoothstep(0.85f, 0.75f, up) * to_grass;
+    const float to_snow = smoothstep(0.72f, 0.78f, height) * smoothstep(0.6f, 0.75f, up);
+    uint32_t color = 0xff000000;
+    for (int c = 0; c < 3; ++c)
+      {
+      float v = sand[c] + (grass[c] - sand[c]) * to_grass;
+      v += (rock[c] - v) * to_rock;
+      v += (snow[c] - v) * to_snow;
+      color |= (uint32_t)(v * 255.f + 0.5f) << (8 * c);
+      }
+    return color;
+    }
+  }
+
+procedural_terrain::procedural_terrain() : _texture_size(0), _tile_size(0), _tiles_per_side(0), _seed(0),
+  _heightmap_id(-1), _colormap_id(-1), _pyramid_id(-1), _stop(false)
+  {
+  }
+
+procedural_terrain::~procedural_terrain()
+  {
+  if (!_threads.empty())
+    {
+      {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+      }
+    _cv.notify_all();
+    for (auto& t : _threads)
+      t.join();
+    }
+  }
+
+bool procedural_terrain::open(RenderDoos::render_engine* engine, int texture_size, int tile_size, uint32_t seed, float camera_x, float camera_z)
+  {
+  if (tile_size <= 0 || texture_size % tile_size != 0 || (texture_size & (texture_size - 1)) != 0)
+    return false;
+  _texture_size = texture_size;
+  _tile_size = tile_size;
+  _tiles_per_side = texture_size / tile_size;
+  _seed = seed;
+
+  _heights.allocate(texture_size, texture_size);
+  _heightmap.allocate(texture_size, texture_size);
+  _colors.allocate(texture_size, texture_size);
+
+  // the first window is generated before the first frame
+  _slots.resize((size_t)_tiles_per_side * _tiles_per_side);
+  for (auto& s : _slots)
+    s.requested = false;
+  _wanted_tiles(camera_x, camera_z);
+  parallel_for(0, (int)_slots.size(), [&](int i)
+    {
+    generated_tile tile;
+    tile.key = _slots[i].wanted;
+    _generate(tile);
+    _write(tile);
+    _slots[i].resident = tile.key;
+    });
+  build_max_mip_pyramid(_pyramid, _heights);
+
+  _heightmap_id = engine->add_texture(texture_size, texture_size, RenderDoos::texture_format_rgba8, (const uint8_t*)_heightmap.im);
+  _colormap_id = engine->add_texture(texture_size, texture_size, RenderDoos::texture_format_rgba8, (const uint8_t*)_colors.im);
+  _pyramid_id = engine->add_texture(_pyramid.atlas_w, _pyramid.atlas_h, RenderDoos::texture_format_r32f, (const uint8_t*)_pyramid.atlas.data());
+
+  _stop = false;
+  const int nr_of_threads = std::max((int)std::thread::hardware_concurrency() - 1, 1);
+  for (int t = 0; t < nr_of_threads; ++t)
+    _threads.emplace_back(&procedural_terrain::_worker, this);
+  return true;
+  }
+
+void procedural_terrain::close(RenderDoos::render_engine* engine)
+  {
+  if (!_threads.empty())
+    {
+      {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+      }
+    _cv.notify_all();
+    for (auto& t : _threads)
+      t.join();
+    _threads.clear();
+    }
+  _requests.clear();
+  _finished.clear();
+  engine->remove_texture(_heightmap_id);
+  engine->remove_texture(_colormap_id);
+  engine->remove_texture(_pyramid_id);
+  _heightmap_id = _colormap_id = _pyramid_id = -1;
+  }
+
+procedural_terrain::slot& procedural_terrain::_slot(const tile_key& key)
+  {
+  return _slots[(size_t)wrap(key.tz, _tiles_per_side) * _tiles_per_side + wrap(key.tx, _tiles_per_side)];
+  }
+
+void procedural_terrain::_wanted_tiles(float camera_x, float camera_z)
+  {
+  // heightmap texel of the camera, see scalePosition in the terrain shader
+  const int cx = (int)std::floor((float)_texture_size * (0.75f + 0.01f * camera_x));
+  const int cz = (int)std::floor((float)_texture_size * (0.25f + 0.01f * camera_z));
+  _camera_tile.tx = floor_div(cx, _tile_size);
+  _camera_tile.tz = floor_div(cz, _tile_size);
+  const int first_tx = _camera_tile.tx - _tiles_per_side / 2;
+  const int first_tz = _camera_tile.tz - _tiles_per_side / 2;
+  for (int j = 0; j < _tiles_per_side; ++j)
+    {
+    for (int i = 0; i < _tiles_per_side; ++i)
+      {
+      tile_key key;
+      key.tx = first_tx + i;
+      key.tz = first_tz + j;
+      _slot(key).wanted = key;
+      }
+    }
+  }
+
+void procedural_terrain::_generate(generated_tile& tile) const
+  {
+  const int t = _tile_size;
+  const int n = t + 2; // one texel border for the normals
+  const float world_per_texel = 1.f / (0.01f * (float)_texture_size);
+  const int row_length = (n + batch - 1) / batch * batch;
+  std::vector<float> heights((size_t)n * row_length);
+  float px[batch], pz[batch];
+  for (int j = 0; j < n; ++j)
+    {
+    // world position of the texel center
+    const float z = ((float)(tile.key.tz * t + j - 1) + 0.5f) * world_per_texel - 0.25f * 100.f;
+    for (int i0 = 0; i0 < row_length; i0 += batch)
+      {
+      for (int i = 0; i < batch; ++i)
+        {
+        px[i] = (((float)(tile.key.tx * t + i0 + i - 1) + 0.5f) * world_per_texel - 0.75f * 100.f) * noise_scale;
+        pz[i] = z * noise_scale;
+        }
+      float* h = heights.data() + (size_t)j * row_length + i0;
+      fbm(h, px, pz, _seed);
+      for (int i = 0; i < batch; ++i)
+        h[i] = std::min(std::max(0.45f + 0.6f * h[i], 0.f), 1.f);
+      }
+    }
+
+  tile.heights.resize((size_t)t * t);
+  tile.heightmap.resize((size_t)t * t);
+  tile.colors.resize((size_t)t * t);
+  const float s = normal_strength * 0.5f;
+  for (int y = 0; y < t; ++y)
+    {
+    const float* above = heights.data() + (size_t)y * row_length + 1;
+    const float* row = above + row_length;
+    const float* below = row + row_length;
+    for (int x = 0; x < t; ++x)
+      {
+      const uint16_t h16 = (uint16_t)(row[x] * 65535.f + 0.5f);
+      const float dx = -(row[x + 1] - row[x - 1]) * s;
+      const float dy = -(below[x] - above[x]) * s;
+      const float inv_len = 1.f / std::sqrt(dx * dx + dy * dy + 1.f);
+      const uint32_t b = (uint32_t)std::min(dx * inv_len * 127.5f + 128.f, 255.f);
+      const uint32_t a = (uint32_t)std::min(dy * inv_len * 127.5f + 128.f, 255.f);
+      tile.heights[(size_t)y * t + x] = h16;
+      tile.heightmap[(size_t)y * t + x] = (uint32_t)(h16 >> 8) | ((uint32_t)(h16 & 255) << 8) | (b << 16) | (a << 24);
+      tile.colors[(size_t)y * t + x] = terrain_color(row[x], inv_len);
+      }
+    }
+  }
+
+void procedural_terrain::_write(const generated_tile& tile)
+  {
+  const int t = _tile_size;
+  const int x0 = wrap(tile.key.tx, _tiles_per_side) * t;
+  const int y0 = wrap(tile.key.tz, _tiles_per_side) * t;
+  for (int y = 0; y < t; ++y)
+    {
+    const size_t dst = (size_t)(y0 + y) * _texture_size + x0;
+    memcpy(_heights.im + dst, tile.heights.data() + (size_t)y * t, t * sizeof(uint16_t));
+    memcpy(_heightmap.im + dst, tile.heightmap.data() + (size_t)y * t, t * sizeof(uint32_t));
+    memcpy(_colors.im + dst, tile.colors.data() + (size_t)y * t, t * sizeof(uint32_t));
+    }
+  }
+
+void procedural_terrain::_worker()
+  {
+  for (;;)
+    {
+    generated_tile tile;
+      {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cv.wait(lock, [this]() { return _stop || !_requests.empty(); });
+      if (_stop)
+        return;
+      tile.key = _requests.front();
+      _requests.pop_front();
+      }
+    _generate(tile);
+    std::lock_guard<std::mutex> lock(_mutex);
+    _finished.push_back(std::move(tile));
+    }
+  }
+
+void procedural_terrain::update(RenderDoos::render_engine* engine, float camera_x, float camera_z, int max_uploads)
+  {
+  _wanted_tiles(camera_x, camera_z);
+  std::vector<generated_tile> uploads;
+    {
+    std::lock_guard<std::mutex> lock(_mutex);
+    // requests that were not picked up yet are made again below, closest tiles first
+    for (const auto& key : _requests)
+      _slot(key).requested = false;
+    _requests.clear();
+    const size_t nr_of_uploads = std::min(_finished.size(), (size_t)std::max(max_uploads, 0));
+    for (size_t i = 0; i < nr_of_uploads; ++i)
+      uploads.push_back(std::move(_finished[i]));
+    _finished.erase(_finished.begin(), _finished.begin() + nr_of_uploads);
+    }
+
+  for (const auto& tile : uploads)
+    {
+    slot& s = _slot(tile.key);
+    s.requested = false;
+    if (s.wanted.tx != tile.key.tx || s.wanted.tz != tile.key.tz)
+      continue; // the camera moved on
+    _write(tile);
+    update_max_mip_pyramid(_pyramid, _heights, wrap(tile.key.tx, _tiles_per_side) * _tile_size, wrap(tile.key.tz, _tiles_per_side) * _tile_size, _tile_size, _tile_size);
+    s.resident = tile.key;
+    }
+  if (!uploads.empty())
+    {
+    engine->update_texture(_heightmap_id, (uint8_t*)_heightmap.im);
+    engine->update_texture(_colormap_id, (uint8_t*)_colors.im);
+    engine->update_texture(_pyramid_id, (uint8_t*)_pyramid.atlas.data());
+    }
+
+  std::vector<tile_key> missing;
+  for (const auto& s : _slots)
+    {
+    if (!s.requested && (s.resident.tx != s.wanted.tx || s.resident.tz != s.wanted.tz))
+      missing.push_back(s.wanted);
+    }
+  if (missing.empty())
+    return;
+  std::sort(missing.begin(), missing.end(), [&](const tile_key& left, const tile_key& right)
+    {
+    const int dl = std::max(std::abs(left.tx - _camera_tile.tx), std::abs(left.tz - _camera_tile.tz));
+    const int dr = std::max(std::abs(right.tx - _camera_tile.tx), std::abs(right.tz - _camera_tile.tz));
+    return dl < dr;
+    });
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (const auto& key : missing)
+    {
+    _slot(key).requested = true;
+    _requests.push_back(key);
+    }
+  _cv.notify_all();
+  }
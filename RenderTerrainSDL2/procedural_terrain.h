@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "image.h"
+#include "max_mip.h"
+
+namespace RenderDoos
+  {
+  class render_engine;
+  }
+
+// Endless procedural terrain for terrain_material.
+// The heightmap, colormap and max-mip pyramid textures are used as a toroidal window: the terrain shader
+// repeats them (terrain_material::set_repeat), and every tile of the window holds the terrain of the world
+// tile around the camera that maps to it. When the camera moves, the tiles that leave the window at one side
+// are generated again for the other side on worker threads, and uploaded in update when they are finished.
+// Heights are fBm value noise in the same 16 bit heights + normals encoding as make_heightmap_texture.
+class procedural_terrain
+  {
+  public:
+    procedural_terrain();
+    ~procedural_terrain();
+
+    // texture_size must be a power of two and a multiple of tile_size; the window is generated around the camera position
+    bool open(RenderDoos::render_engine* engine, int texture_size, int tile_size, uint32_t seed, float camera_x, float camera_z);
+    void close(RenderDoos::render_engine* engine);
+
+    int32_t heightmap_texture() const { return _heightmap_id; }
+    int32_t colormap_texture() const { return _colormap_id; }
+    int32_t height_pyramid_texture() const { return _pyramid_id; }
+
+    // requests the tiles around the camera and uploads at most max_uploads finished tiles
+    void update(RenderDoos::render_engine* engine, float camera_x, float camera_z, int max_uploads);
+
+  private:
+    struct tile_key
+      {
+      int tx, tz; // world tile in heightmap texels / tile_size
+      };
+
+    struct generated_tile
+      {
+      tile_key key;
+      std::vector<uint16_t> heights;
+      std::vector<uint32_t> heightmap;
+      std::vector<uint32_t> colors;
+      };
+
+    struct slot
+      {
+      tile_key resident;
+      tile_key wanted;
+      bool requested;
+      };
+
+    void _worker();
+    void _generate(generated_tile& tile) const;
+    void _write(const generated_tile& tile);
+    void _wanted_tiles(float camera_x, float camera_z);
+    slot& _slot(const tile_key& key);
+
+  private:
+    int _texture_size, _tile_size, _tiles_per_side;
+    uint32_t _seed;
+    std::vector<slot> _slots;
+    tile_key _camera_tile;
+    height_image _heights;
+    rgba_image _heightmap, _colors;
+    max_mip_pyramid _pyramid;
+    int32_t _heightmap_id, _colormap_id, _pyramid_id;
+
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _stop;
+    std::deque<tile_key> _requests;
+    std::vector<generated_tile> _finished;
+  };
@@ -0,0 +1,177 @@
+#include "program_cache.h"
+
+#include "RenderDoos/render_engine.h"
+#include "RenderDoos/types.h"
+
+#if !defined(RENDERDOOS_METAL)
+#include <GL/glew.h>
+#include <glew/GL/glew.h>
+#endif
+
+#include <stdio.h>
+#include <fstream>
+#include <vector>
+
+namespace
+  {
+  std::string cache_folder;
+
+#if !defined(RENDERDOOS_METAL)
+  const char* placeholder_vertex_shader = R"(#version 330 core
+void main()
+  {
+  gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+  }
+)";
+
+  const char* placeholder_fragment_shader = R"(#version 330 core
+out vec4 FragColor;
+void main()
+  {
+  FragColor = vec4(0.0);
+  }
+)";
+
+  struct program_binary_header
+    {
+    char magic[4];
+    uint32_t format; // binary format of glGetProgramBinary
+    uint64_t key;
+    uint32_t size;
+    uint32_t reserved;
+    };
+
+  uint64_t fnv1a(uint64_t hash, const char* s, size_t length)
+    {
+    for (size_t i = 0; i < length; ++i)
+      {
+      hash ^= (uint8_t)s[i];
+      hash *= 1099511628211ull;
+      }
+    return hash;
+    }
+
+  uint64_t fnv1a(uint64_t hash, const std::string& s)
+    {
+    // the terminating zero separates consecutive strings
+    return fnv1a(hash, s.c_str(), s.size() + 1);
+    }
+
+  std::string driver_string(GLenum name)
+    {
+    const GLubyte* s = glGetString(name);
+    return s ? std::string((const char*)s) : std::string();
+    }
+
+  bool program_binaries_supported()
+    {
+    if (!(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary))
+      return false;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+    }
+
+  GLuint current_gl_program(RenderDoos::render_engine* engine, int32_t program_handle)
+    {
+    engine->bind_program(program_handle);
+    GLint name = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &name);
+    return (GLuint)name;
+    }
+
+  bool read_program_binary(program_binary_header& header, std::vector<char>& binary, const std::string& filename, uint64_t key)
+    {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+      return false;
+    if (!file.read((char*)&header, sizeof(header)))
+      return false;
+    if (header.magic[0] != 'R' || header.magic[1] != 'D' || header.magic[2] != 'P' || header.magic[3] != 'B' || header.key != key || header.size == 0)
+      return false;
+    binary.resize(header.size);
+    return (bool)file.read(binary.data(), header.size);
+    }
+
+  void write_program_binary(RenderDoos::render_engine* engine, int32_t program_handle, const std::string& filename, uint64_t key)
+    {
+    const GLuint name = current_gl_program(engine, program_handle);
+    GLint length = 0;
+    glGetProgramiv(name, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+      return;
+    std::vector<char> binary(length);
+    GLsizei written = 0;
+    GLenum format = 0;
+    glGetProgramBinary(name, length, &written, &format, binary.data());
+    if (written <= 0)
+      return;
+    program_binary_header header;
+    header.magic[0] = 'R';
+    header.magic[1] = 'D';
+    header.magic[2] = 'P';
+    header.magic[3] = 'B';
+    header.format = (uint32_t)format;
+    header.key = key;
+    header.size = (uint32_t)written;
+    header.reserved = 0;
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open())
+      return;
+    file.write((const char*)&header, sizeof(header));
+    file.write(binary.data(), written);
+    }
+#endif
+  }
+
+void set_program_cache_folder(const std::string& folder)
+  {
+  cache_folder = folder;
+  }
+
+int32_t add_cached_program(RenderDoos::render_engine* engine, int32_t& vs_handle, int32_t& fs_handle, const std::string& vertex_source, const std::string& fragment_source)
+  {
+#if !defined(RENDERDOOS_METAL)
+  std::string filename;
+  uint64_t key = 0;
+  if (!cache_folder.empty() && engine->get_renderer_type() == RenderDoos::renderer_type::OPENGL && program_binaries_supported())
+    {
+    key = 14695981039346656037ull;
+    key = fnv1a(key, vertex_source);
+    key = fnv1a(key, fragment_source);
+    key = fnv1a(key, driver_string(GL_VENDOR));
+    key = fnv1a(key, driver_string(GL_RENDERER));
+    key = fnv1a(key, driver_string(GL_VERSION));
+    char name[64];
+    sprintf(name, "/program_%016llx.bin", (unsigned long long)key);
+    filename = cache_folder + name;
+    program_binary_header header;
+    std::vector<char> binary;
+    if (read_program_binary(header, binary, filename, key))
+      {
+      vs_handle = engine->add_shader(placeholder_vertex_shader, SHADER_VERTEX, nullptr);
+      fs_handle = engine->add_shader(placeholder_fragment_shader, SHADER_FRAGMENT, nullptr);
+      const int32_t program_handle = engine->add_program(vs_handle, fs_handle);
+      const GLuint gl_program = current_gl_program(engine, program_handle);
+      glProgramBinary(gl_program, (GLenum)header.format, binary.data(), (GLsizei)binary.size());
+      GLint linked = GL_FALSE;
+      glGetProgramiv(gl_program, GL_LINK_STATUS, &linked);
+      if (linked == GL_TRUE)
+        return program_handle;
+      // e.g. a format the driver does not accept anymore: compiled again below, which replaces the file
+      glGetError();
+      engine->remove_program(program_handle);
+      engine->remove_shader(vs_handle);
+      engine->remove_shader(fs_handle);
+      }
+    }
+#endif
+  vs_handle = engine->add_shader(vertex_source.c_str(), SHADER_VERTEX, nullptr);
+  fs_handle = engine->add_shader(fragment_source.c_str(), SHADER_FRAGMENT, nullptr);
+  const int32_t program_handle = engine->add_program(vs_handle, fs_handle);
+#if !defined(RENDERDOOS_METAL)
+  if (!filename.empty() && program_handle >= 0)
+    write_program_binary(engine, program_handle, filename, key);
+#endif
+  return program_handle;
+  }
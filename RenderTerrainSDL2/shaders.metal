@@ -12,8 +12,17 @@ struct TerrainMaterialUniforms {
   float4x4 camera_matrix;
   float3 resolution;
   int heightmap_handle;
-  int normalmap_handle;
   int colormap_handle;
+  int height_pyramid_handle;
+  float4x4 prev_camera_matrix;
+  float4 reproject_params;
+  int prev_depth_handle;
+  float4 beam_params;
+  int beam_handle;
+  float4 sun;
+  int horizon0_handle;
+  int horizon1_handle;
+  float4 terrain_params;
 };
 
 struct VertexOut {
@@ -36,50 +45,210 @@ float2 scalePosition(float2 p)
   return p;
 }
 
-float terrain( float2 pos, texture2d<float> Heightmap, sampler sampler2d)
+float terrain( float2 pos, texture2d<float> Heightmap, sampler sampler2d, bool repeat = false)
 {
   float2 p = scalePosition(pos);
-  if (p.x < 0.0 || p.x > 1.0 || p.y < 0.0 || p.y > 1.0)
+  if (!repeat && (p.x < 0.0 || p.x > 1.0 || p.y < 0.0 || p.y > 1.0))
     return 0.0;
-  return Heightmap.sample(sampler2d, p).r*5.0;
+  // 16 bit height split over red (high byte) and green (low byte)
+  return dot(Heightmap.sample(sampler2d, p).rg, float2(65280.0, 255.0)/65535.0)*5.0;
 }
 
-float map( float3 p,  texture2d<float> Heightmap, sampler sampler2d)
+float map( float3 p,  texture2d<float> Heightmap, sampler sampler2d, bool repeat = false)
 {
-    return p.y - terrain(p.xz, Heightmap, sampler2d);
+    return p.y - terrain(p.xz, Heightmap, sampler2d, repeat);
 }
 
-float intersect( float3 ro, float3 rd, texture2d<float> Heightmap, sampler sampler2d)
+float pyramidMax(int level, int2 cell, int2 base, texture2d<float> HeightPyramid, bool repeat)
+{
+  int2 size = max(base >> level, int2(1));
+  if (repeat)
+    cell = cell & (size - 1);
+  else if (cell.x < 0 || cell.y < 0 || cell.x >= size.x || cell.y >= size.y)
+    return 0.0;
+  int2 offset = (level == 0) ? int2(0) : int2(base.x, base.y - (base.y >> (level-1)));
+  return HeightPyramid.read(uint2(offset + cell)).r*5.0;
+}
+
+float skipEmptySpace(float3 ro, float3 rd, float tmin, float maxd, texture2d<float> Heightmap, texture2d<float> HeightPyramid, bool repeat)
+{
+  int2 atlas = int2(HeightPyramid.get_width(), HeightPyramid.get_height());
+  int2 base = int2(atlas.x*2/3, atlas.y);
+  int top = int(log2(float(min(base.x, base.y))) + 0.5);
+  float2 texels = float2(Heightmap.get_width(), Heightmap.get_height());
+  float2 a = (float2(0.75, 0.25) + 0.01*ro.xz)*texels;
+  float2 b = 0.01*rd.xz*texels;
+  float2 inv_b = float2(abs(b.x) > 1e-8 ? 1.0/b.x : 1e8, abs(b.y) > 1e-8 ? 1.0/b.y : 1e8);
+  float2 dir_step = step(float2(0.0), b);
+  float t = tmin;
+  int level = min(top, 5);
+  for( int i=0; i<128 && t<maxd; i++ )
+  {
+    float2 q = a + b*t;
+    float cell_size = float(1 << level);
+    int2 cell = int2(floor(q / cell_size));
+    float hmax = pyramidMax(level, cell, base, HeightPyramid, repeat);
+    float2 tb = ((float2(cell) + dir_step)*cell_size - a)*inv_b;
+    float t_exit = max(min(tb.x, tb.y), t);
+    float ymin = min(ro.y + rd.y*t, ro.y + rd.y*t_exit);
+    if (ymin > hmax)
+    {
+      t = t_exit + 1e-4;
+      level = min(level + 1, top);
+    }
+    else
+    {
+      // the ray enters this cell above its maximum, so nothing is hit before it drops below it
+      if (rd.y < 0.0)
+        t = max(t, (hmax - ro.y)/rd.y);
+      if (level == 0)
+        break;
+      --level;
+    }
+  }
+  return t;
+}
+
+// see beamStart in the OpenGL terrain shader
+float beamStart(float3 ro, float3 rd, float k, float maxd, texture2d<float> Heightmap, texture2d<float> HeightPyramid, bool repeat)
+{
+  int2 atlas = int2(HeightPyramid.get_width(), HeightPyramid.get_height());
+  int2 base = int2(atlas.x*2/3, atlas.y);
+  int top = int(log2(float(min(base.x, base.y))) + 0.5);
+  float2 texels = float2(Heightmap.get_width(), Heightmap.get_height());
+  float2 a = (float2(0.75, 0.25) + 0.01*ro.xz)*texels;
+  float2 b = 0.01*rd.xz*texels;
+  float2 inv_b = float2(abs(b.x) > 1e-8 ? 1.0/b.x : 1e8, abs(b.y) > 1e-8 ? 1.0/b.y : 1e8);
+  float2 dir_step = step(float2(0.0), b);
+  float radius = 0.01*max(texels.x, texels.y)*k;
+  float slope = rd.y - k;
+  float t = 0.0;
+  int level = min(top, 5);
+  for( int i=0; i<96 && t<maxd; i++ )
+  {
+    float2 q = a + b*t;
+    float cell_size = float(1 << level);
+    int2 cell = int2(floor(q / cell_size));
+    float2 tb = ((float2(cell) + dir_step)*cell_size - a)*inv_b;
+    float t_exit = max(min(tb.x, tb.y), t);
+    if (2.0*radius*t_exit > cell_size)
+    {
+      if (level == top)
+        break;
+      ++level;
+      continue;
+    }
+    float hmax = 0.0;
+    for (int y = -1; y <= 1; ++y)
+      for (int x = -1; x <= 1; ++x)
+        hmax = max(hmax, pyramidMax(level, cell + int2(x, y), base, HeightPyramid, repeat));
+    if (min(ro.y + slope*t, ro.y + slope*t_exit) > hmax)
+    {
+      t = t_exit + 1e-4;
+      level = min(level + 1, top);
+    }
+    else
+    {
+      if (slope < 0.0)
+        t = max(t, (hmax - ro.y)/slope);
+      if (level == 0 || 4.0*radius*t_exit > cell_size)
+        break;
+      --level;
+    }
+  }
+  return min(t, maxd);
+}
+
+// pixel rows run top to bottom here
+float3 cameraRay(float2 fragCoord, float3 resolution, float3 rx, float3 ry, float3 rz)
+{
+  float2 xy = fragCoord / resolution.xy;
+  xy.y = 1.0 - xy.y;
+  float2 s = (-1.0 + 2.0* xy) * float2(resolution.x/resolution.y, 1.0);
+  return normalize( s.x*rx + s.y*ry + 2.0*rz );
+}
+
+// see reprojectStart in the OpenGL terrain shader; pixel rows run top to bottom here
+float reprojectStart(float3 ro, float3 rd, float3 pro, float3 prx, float3 pry, float3 prz, float2 fragCoord, float3 resolution, texture2d<float> PrevDepth)
+{
+  const float maxd = 40.0;
+  int2 size = int2(PrevDepth.get_width(), PrevDepth.get_height());
+  float a = PrevDepth.read(uint2(clamp(int2(fragCoord*float2(size)/resolution.xy), int2(0), size - 1))).a;
+  if (a >= 1.0)
+    return 0.0;
+  float3 d = ro + rd*(a*a*maxd) - pro;
+  float3 v = float3(dot(d, prx), dot(d, pry), dot(d, prz));
+  if (v.z <= 0.0)
+    return 0.0;
+  float2 xy = (2.0*v.xy/v.z/float2(resolution.x/resolution.y, 1.0) + 1.0)*0.5;
+  xy.y = 1.0 - xy.y;
+  int2 q = int2(floor(xy*float2(size)));
+  if (q.x < 1 || q.y < 1 || q.x >= size.x - 1 || q.y >= size.y - 1)
+    return 0.0;
+  float amin = 1.0;
+  float amax = 0.0;
+  for (int j = -1; j <= 1; ++j)
+    for (int i = -1; i <= 1; ++i)
+    {
+      float b = PrevDepth.read(uint2(q + int2(i, j))).a;
+      amin = min(amin, b);
+      amax = max(amax, b);
+    }
+  if (amax >= 1.0 || amax*amax > 1.5*amin*amin)
+    return 0.0;
+  // one step of the 8 bit encoding as margin
+  amin = max(amin - 1.0/255.0, 0.0);
+  float motion = distance(ro, pro);
+  float start = max(amin*amin*maxd*0.95 - motion, 0.0);
+  return motion > 0.0 ? min(start, motion*float(size.y)) : start;
+}
+
+float intersect( float3 ro, float3 rd, float tbeam, float treproject, texture2d<float> Heightmap, texture2d<float> HeightPyramid, sampler sampler2d, bool repeat)
 {
     const float maxd = 40.0;
     const float precis = 0.001;
-    float t = 0.0;
+    float t = (treproject > tbeam && map(ro+rd*treproject, Heightmap, sampler2d, repeat) > 0.0) ? treproject : skipEmptySpace(ro, rd, tbeam, maxd, Heightmap, HeightPyramid, repeat);
     for( int i=0; i<256; i++ )
     {
-        float h = map( ro+rd*t, Heightmap, sampler2d);
+        float h = map( ro+rd*t, Heightmap, sampler2d, repeat);
         if( abs(h)<precis || t>maxd ) break;
         t += h*0.5;
     }
     return (t>maxd)?-1.0:t;
 }
 
-float3 calcNormal( float3 pos, float t, texture2d<float> Normalmap, sampler sampler2d)
+float3 calcNormal( float3 pos, float t, texture2d<float> Heightmap, sampler sampler2d, bool repeat = false)
 {
   float2 p = scalePosition(pos.xz);
-  if (p.x < 0.0 || p.x > 1.0 || p.y < 0.0 || p.y > 1.0)
+  if (!repeat && (p.x < 0.0 || p.x > 1.0 || p.y < 0.0 || p.y > 1.0))
     return float3(0,1,0);
-  return Normalmap.sample(sampler2d, p).rgb;
+  // xy of the normal are packed in the blue and alpha channels of the heightmap
+  float2 n = Heightmap.sample(sampler2d, p).ba*2.0 - 1.0;
+  return float3(n, sqrt(max(1.0 - dot(n, n), 0.0)));
 }
 
-float4 getColor(float3 pos, texture2d<float> Colormap, sampler sampler2d)
+float4 getColor(float3 pos, texture2d<float> Colormap, sampler sampler2d, bool repeat = false)
 {
   float2 p = scalePosition(pos.xz);
-  if (p.x < 0.0 || p.x > 1.0 || p.y < 0.0 || p.y > 1.0)
+  if (!repeat && (p.x < 0.0 || p.x > 1.0 || p.y < 0.0 || p.y > 1.0))
     return float4(0,0,0,0);
   return Colormap.sample(sampler2d, p);
 }
 
-fragment float4 terrain_material_fragment_shader(const VertexOut vertexIn [[stage_in]], texture2d<float> heightmap [[texture(0)]], texture2d<float> normalmap [[texture(1)]], texture2d<float> colormap [[texture(2)]], sampler sampler2d [[sampler(0)]], constant TerrainMaterialUniforms& input [[buffer(10)]]) {
+// see sunVisibility in the OpenGL terrain shader
+float sunVisibility(float3 pos, float3 sun, texture2d<float> HorizonMap0, texture2d<float> HorizonMap1, sampler sampler2d)
+{
+  float2 p = scalePosition(pos.xz);
+  float4 h0 = HorizonMap0.sample(sampler2d, p);
+  float4 h1 = HorizonMap1.sample(sampler2d, p);
+  float horizon[8] = { h0.r, h0.g, h0.b, h0.a, h1.r, h1.g, h1.b, h1.a };
+  float a = fmod(atan2(sun.z, sun.x)/0.7853982 + 8.0, 8.0);
+  int i = min(int(a), 7);
+  float elevation = mix(horizon[i], horizon[(i+1)%8], a - float(i))*1.5707963;
+  return smoothstep(-0.02, 0.02, asin(clamp(sun.y, -1.0, 1.0)) - elevation);
+}
+
+fragment float4 terrain_material_fragment_shader(const VertexOut vertexIn [[stage_in]], texture2d<float> heightmap [[texture(0)]], texture2d<float> colormap [[texture(2)]], texture2d<float> heightPyramid [[texture(3)]], texture2d<float> prevDepth [[texture(4)]], texture2d<float> beam [[texture(5)]], texture2d<float> horizonMap0 [[texture(6)]], texture2d<float> horizonMap1 [[texture(7)]], sampler sampler2d [[sampler(0)]], constant TerrainMaterialUniforms& input [[buffer(10)]]) {
   //return colormap.sample(sampler2d, vertexIn.position.xy/input.resolution.xy);
   float2 xy = vertexIn.position.xy / input.resolution.xy;
   xy.y = 1-xy.y;
@@ -114,23 +283,213 @@ fragment float4 terrain_material_fragment_shader(const VertexOut vertexIn [[stag
   );
     
     
-  float t = intersect(ro, rd, heightmap, sampler2d);
+  const bool repeat = input.terrain_params.x > 0.0;
+  if (input.beam_params.x > 0.0)
+    {
+    float3 bx = float3(dot(rx, planeSide), dot(rx, planeNormal), dot(rx, planeUp));
+    float3 by = float3(dot(ry, planeSide), dot(ry, planeNormal), dot(ry, planeUp));
+    float3 bz = float3(dot(rz, planeSide), dot(rz, planeNormal), dot(rz, planeUp));
+    float2 lo = floor(vertexIn.position.xy)*input.beam_params.z;
+    float2 hi = min(lo + input.beam_params.z, input.resolution.xy);
+    float3 c0 = cameraRay(lo, input.resolution, bx, by, bz);
+    float3 c1 = cameraRay(float2(hi.x, lo.y), input.resolution, bx, by, bz);
+    float3 c2 = cameraRay(float2(lo.x, hi.y), input.resolution, bx, by, bz);
+    float3 c3 = cameraRay(hi, input.resolution, bx, by, bz);
+    float3 axis = normalize(c0 + c1 + c2 + c3);
+    float cmin = min(min(dot(c0, axis), dot(c1, axis)), min(dot(c2, axis), dot(c3, axis)));
+    float tb = beamStart(ro, axis, sqrt(max(1.0 - cmin*cmin, 0.0))/cmin, 40.0, heightmap, heightPyramid, repeat);
+    float v = floor(tb/40.0*65535.0);
+    return float4(floor(v/256.0)/255.0, fmod(v, 256.0)/255.0, 0.0, 1.0);
+    }
+  float tbeam = 0.0;
+  if (input.beam_params.y > 0.0)
+    {
+    float2 e = floor(beam.read(uint2(vertexIn.position.xy)/uint(input.beam_params.z)).rg*255.0 + 0.5);
+    tbeam = (e.x*256.0 + e.y)/65535.0*40.0;
+    }
+  float tstart = 0.0;
+  if (input.reproject_params.x > 0.0)
+    {
+    float3 pro = (input.prev_camera_matrix*float4(0,0,0,1)).xyz;
+    pro.y += 3;
+    float3 prx = (input.prev_camera_matrix*float4(1,0,0,0)).xyz;
+    float3 pry = (input.prev_camera_matrix*float4(0,1,0,0)).xyz;
+    float3 prz = (input.prev_camera_matrix*float4(0,0,1,0)).xyz;
+    pro = float3(dot(pro, planeSide), dot(pro, planeNormal), dot(pro, planeUp));
+    prx = float3(dot(prx, planeSide), dot(prx, planeNormal), dot(prx, planeUp));
+    pry = float3(dot(pry, planeSide), dot(pry, planeNormal), dot(pry, planeUp));
+    prz = float3(dot(prz, planeSide), dot(prz, planeNormal), dot(prz, planeUp));
+    tstart = reprojectStart(ro, rd, pro, prx, pry, prz, vertexIn.position.xy, input.resolution, prevDepth);
+    }
+  float t = intersect(ro, rd, tbeam, tstart, heightmap, heightPyramid, sampler2d, repeat);
     
   if(t > 0.0)
     {
 		// Get some information about our intersection
 		float3 pos = ro + t * rd;
-		float3 normal = calcNormal(pos, t, normalmap, sampler2d);
-		float4 texCol = getColor(pos, colormap, sampler2d);
+		float3 normal = calcNormal(pos, t, heightmap, sampler2d, repeat);
+		float4 texCol = getColor(pos, colormap, sampler2d, repeat);
     if (texCol.a > 0)
       {
       float3 terraincol = float3(pow(texCol.rgb, float3(0.5)));
-		  float3 sunDir = normalize(float3(0, 0.5, -1));
-      terraincol = terraincol * clamp(-dot(normal, sunDir), 0.0f, 1.0f) * 0.9 + terraincol * 0.1;
+      // the normal is z-up in heightmap space, lit in its [0, 1] encoding as the texels of the former normalmap.png
+      float diffuse = clamp(dot(normal*0.5 + 0.5, input.sun.xzy), 0.0f, 1.0f);
+      if (input.sun.w > 0.0)
+        diffuse *= sunVisibility(pos, input.sun.xyz, horizonMap0, horizonMap1, sampler2d);
+      terraincol = terraincol * diffuse * 0.9 + terraincol * 0.1;
       terraincol = pow(terraincol*1.2, float3(2.2));
       col = terraincol*texCol.a + col*(1-texCol.a);
       }
 	  }
 	
-	return float4(col, 1.0);
+	// alpha keeps the hit distance (sqrt encoded for precision up close) for depth-aware upsampling
+	return float4(col, t > 0.0 ? sqrt(t/40.0) : 1.0);
+}
+
+struct TerrainMeshMaterialUniforms {
+  float4x4 camera_matrix;
+  float3 resolution;
+  float4 node_params;
+  float4 morph_params;
+  int heightmap_handle;
+  int colormap_handle;
+};
+
+struct MeshVertexOut {
+  float4 position [[position]];
+  float3 world_pos;
+};
+
+vertex MeshVertexOut terrain_mesh_material_vertex_shader(const device VertexIn *vertices [[buffer(0)]], uint vertexId [[vertex_id]], texture2d<float> heightmap [[texture(0)]], sampler sampler2d [[sampler(0)]], constant TerrainMeshMaterialUniforms& input [[buffer(10)]]) {
+  float3 ro = (input.camera_matrix*float4(0,0,0,1)).xyz;
+  ro.y += 3;
+  float3 rx = (input.camera_matrix*float4(1,0,0,0)).xyz;
+  float3 ry = (input.camera_matrix*float4(0,1,0,0)).xyz;
+  float3 rz = (input.camera_matrix*float4(0,0,1,0)).xyz;
+
+  float3 vpos = vertices[vertexId].position;
+  float2 grid = vpos.xz;
+  float2 p = input.node_params.xy + grid*input.node_params.z;
+  float2 uv = scalePosition(p);
+  float h = (uv.x < 0.0 || uv.x >= 1.0 || uv.y < 0.0 || uv.y >= 1.0) ? 0.0 : dot(heightmap.sample(sampler2d, uv, level(0)).rg, float2(65280.0, 255.0)/65535.0)*5.0;
+  float dist = distance(ro, float3(p.x, h, p.y));
+  float k = clamp((dist - input.morph_params.x)/(input.morph_params.y - input.morph_params.x), 0.0, 1.0);
+  float2 frac_part = fract(grid*input.node_params.w*0.5)*2.0/input.node_params.w;
+  grid -= frac_part*k;
+  p = input.node_params.xy + grid*input.node_params.z;
+  uv = scalePosition(p);
+  h = (uv.x < 0.0 || uv.x >= 1.0 || uv.y < 0.0 || uv.y >= 1.0) ? 0.0 : dot(heightmap.sample(sampler2d, uv, level(0)).rg, float2(65280.0, 255.0)/65535.0)*5.0;
+
+  MeshVertexOut out;
+  out.world_pos = float3(p.x, h, p.y);
+  float3 d = out.world_pos - ro;
+  float3 v = float3(dot(d, rx), dot(d, ry), dot(d, rz));
+  const float n = 0.05;
+  const float f = 100.0;
+  float aspect = input.resolution.x/input.resolution.y;
+  out.position = float4(2.0*v.x/aspect, 2.0*v.y, v.z*f/(f-n) - f*n/(f-n), v.z);
+  return out;
+}
+
+fragment float4 terrain_mesh_material_fragment_shader(const MeshVertexOut vertexIn [[stage_in]], texture2d<float> heightmap [[texture(0)]], texture2d<float> colormap [[texture(2)]], sampler sampler2d [[sampler(0)]], constant TerrainMeshMaterialUniforms& input [[buffer(10)]]) {
+  float3 col = float3(0.7, 0.7, 0.7);
+  float3 normal = calcNormal(vertexIn.world_pos, 0.0, heightmap, sampler2d);
+  float4 texCol = getColor(vertexIn.world_pos, colormap, sampler2d);
+  if (texCol.a > 0)
+    {
+    float3 terraincol = float3(pow(texCol.rgb, float3(0.5)));
+    float3 sunDir = normalize(float3(0, 0.5, -1));
+    terraincol = terraincol * clamp(-dot(normal*0.5 + 0.5, sunDir), 0.0f, 1.0f) * 0.9 + terraincol * 0.1;
+    terraincol = pow(terraincol*1.2, float3(2.2));
+    col = terraincol*texCol.a + col*(1-texCol.a);
+    }
+  return float4(col, 1.0);
+}
+
+struct TerrainTileMaterialUniforms {
+  float4x4 camera_matrix;
+  float3 resolution;
+  float4 node_params;
+  float4 morph_params;
+  float4 tile_params;
+  float4 view_params;
+  int tile_handle;
+};
+
+float tileHeight(float2 grid, texture2d<float> tile, sampler sampler2d, constant TerrainTileMaterialUniforms& input) {
+  float2 t = input.tile_params.xy + grid*input.tile_params.z;
+  float2 uv = (float2(0.5) + t*input.tile_params.w)/(input.tile_params.w + 1.0);
+  return dot(tile.sample(sampler2d, uv, level(0)).rg, float2(65280.0, 255.0)/65535.0)*input.view_params.x;
+}
+
+vertex MeshVertexOut terrain_tile_material_vertex_shader(const device VertexIn *vertices [[buffer(0)]], uint vertexId [[vertex_id]], texture2d<float> tile [[texture(0)]], sampler sampler2d [[sampler(0)]], constant TerrainTileMaterialUniforms& input [[buffer(10)]]) {
+  float3 ro = (input.camera_matrix*float4(0,0,0,1)).xyz;
+  ro.y += input.view_params.z;
+  float3 rx = (input.camera_matrix*float4(1,0,0,0)).xyz;
+  float3 ry = (input.camera_matrix*float4(0,1,0,0)).xyz;
+  float3 rz = (input.camera_matrix*float4(0,0,1,0)).xyz;
+
+  float3 vpos = vertices[vertexId].position;
+  float2 grid = vpos.xz;
+  float2 p = input.node_params.xy + grid*input.node_params.z;
+  float dist = distance(ro, float3(p.x, tileHeight(grid, tile, sampler2d, input), p.y));
+  float k = clamp((dist - input.morph_params.x)/(input.morph_params.y - input.morph_params.x), 0.0, 1.0);
+  float2 frac_part = fract(grid*input.node_params.w*0.5)*2.0/input.node_params.w;
+  grid -= frac_part*k;
+  p = input.node_params.xy + grid*input.node_params.z;
+
+  MeshVertexOut out;
+  out.world_pos = float3(p.x, tileHeight(grid, tile, sampler2d, input), p.y);
+  float3 d = out.world_pos - ro;
+  float3 v = float3(dot(d, rx), dot(d, ry), dot(d, rz));
+  const float n = 0.05;
+  float f = input.view_params.y;
+  float aspect = input.resolution.x/input.resolution.y;
+  out.position = float4(2.0*v.x/aspect, 2.0*v.y, v.z*f/(f-n) - f*n/(f-n), v.z);
+  return out;
+}
+
+fragment float4 terrain_tile_material_fragment_shader(const MeshVertexOut vertexIn [[stage_in]], constant TerrainTileMaterialUniforms& input [[buffer(10)]]) {
+  float3 normal = normalize(cross(dfdy(vertexIn.world_pos), dfdx(vertexIn.world_pos)));
+  if (normal.y < 0.0)
+    normal = -normal;
+  float h = clamp(vertexIn.world_pos.y/input.view_params.x, 0.0, 1.0);
+  float3 col = mix(float3(0.25, 0.35, 0.15), float3(0.45, 0.38, 0.3), smoothstep(0.2, 0.6, h));
+  col = mix(col, float3(0.9, 0.9, 0.95), smoothstep(0.7, 0.85, h));
+  float3 sunDir = normalize(float3(0.3, 1.0, -0.5));
+  col = col * clamp(dot(normal, sunDir), 0.0, 1.0) * 0.9 + col*0.1;
+  return float4(col, 1.0);
+}
+
+struct TerrainUpsampleMaterialUniforms {
+  float3 resolution;
+  int low_res_handle;
+};
+
+vertex VertexOut terrain_upsample_material_vertex_shader(const device VertexIn *vertices [[buffer(0)]], uint vertexId [[vertex_id]], constant TerrainUpsampleMaterialUniforms& input [[buffer(10)]]) {
+  VertexOut out;
+  out.position = float4(vertices[vertexId].position.xy, 0, 1);
+  return out;
+}
+
+fragment float4 terrain_upsample_material_fragment_shader(const VertexOut vertexIn [[stage_in]], texture2d<float> lowRes [[texture(0)]], constant TerrainUpsampleMaterialUniforms& input [[buffer(10)]]) {
+  int2 low_size = int2(lowRes.get_width(), lowRes.get_height());
+  float2 scale = float2(low_size)/input.resolution.xy;
+  int2 nearest = clamp(int2(vertexIn.position.xy*scale), int2(0), low_size - 1);
+  float ref_depth = lowRes.read(uint2(nearest)).a;
+  float2 p = vertexIn.position.xy*scale - 0.5;
+  int2 base = int2(floor(p));
+  float2 f = p - float2(base);
+  float4 sum = float4(0.0);
+  for (int j = 0; j < 2; ++j)
+    {
+    for (int i = 0; i < 2; ++i)
+      {
+      float4 s = lowRes.read(uint2(clamp(base + int2(i, j), int2(0), low_size - 1)));
+      float w = (i == 0 ? 1.0 - f.x : f.x)*(j == 0 ? 1.0 - f.y : f.y);
+      w = max(w*exp(-abs(s.a - ref_depth)*64.0), 1e-5);
+      sum += float4(s.rgb*w, w);
+      }
+    }
+  return float4(sum.rgb/sum.a, 1.0);
 }
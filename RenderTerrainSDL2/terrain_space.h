@@ -0,0 +1,30 @@
+#pragma once
+
+// World space layout of the terrain, identical to scalePosition/terrain in the terrain shaders:
+// world x maps to u = 0.75 + 0.01*x and world z to v = 0.25 + 0.01*z, so the whole heightmap texture, u and v
+// in [0, 1), covers x in [-75, 25] and z in [-25, 75] (the area around the origin, x and z in [-25, 25], is the
+// region u in [0.5, 1], v in [0, 0.5]). The terrain is flat at height 0 outside the heightmap, and normalized
+// heights are scaled by terrain_height_scale.
+
+const float terrain_height_scale = 5.f;
+const float terrain_camera_height_offset = 3.f;
+
+inline float terrain_world_to_u(float x)
+  {
+  return 0.75f + 0.01f * x;
+  }
+
+inline float terrain_world_to_v(float z)
+  {
+  return 0.25f + 0.01f * z;
+  }
+
+inline float terrain_u_to_world(float u)
+  {
+  return (u - 0.75f) / 0.01f;
+  }
+
+inline float terrain_v_to_world(float v)
+  {
+  return (v - 0.25f) / 0.01f;
+  }
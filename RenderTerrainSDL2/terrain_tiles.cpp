@@ -0,0 +1,350 @@
+#include "terrain_tiles.h"
+#include "parallel.h"
+
+#include "RenderDoos/render_engine.h"
+
+#include "../stb/stb_image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string.h>
+
+namespace
+  {
+  const uint32_t terrain_tiles_version = 1;
+  const uint64_t no_tile = std::numeric_limits<uint64_t>::max();
+
+  uint64_t tile_data_offset(const terrain_tiles_header& header, uint64_t index)
+    {
+    const uint64_t samples = (uint64_t)(header.tile_size + 1) * (header.tile_size + 1);
+    return sizeof(terrain_tiles_header) + terrain_tile_count(header) * sizeof(uint16_t) + index * samples * sizeof(uint16_t);
+    }
+
+  // 3x3 tent filter that keeps the samples of the coarser grid on the samples of the finer grid
+  void downsample(std::vector<uint16_t>& coarse, const std::vector<uint16_t>& fine, int fine_n)
+    {
+    const int coarse_n = fine_n / 2;
+    coarse.resize((size_t)(coarse_n + 1) * (coarse_n + 1));
+    parallel_for(0, coarse_n + 1, [&](int j)
+      {
+      for (int i = 0; i <= coarse_n; ++i)
+        {
+        uint32_t sum = 0;
+        uint32_t weight = 0;
+        for (int dy = -1; dy <= 1; ++dy)
+          {
+          const int y = 2 * j + dy;
+          if (y < 0 || y > fine_n)
+            continue;
+          for (int dx = -1; dx <= 1; ++dx)
+            {
+            const int x = 2 * i + dx;
+            if (x < 0 || x > fine_n)
+              continue;
+            const uint32_t wgt = (dx == 0 ? 2 : 1) * (dy == 0 ? 2 : 1);
+            sum += wgt * fine[(size_t)y * (fine_n + 1) + x];
+            weight += wgt;
+            }
+          }
+        coarse[(size_t)j * (coarse_n + 1) + i] = (uint16_t)((sum + weight / 2) / weight);
+        }
+      });
+    }
+  }
+
+uint32_t terrain_tiles_per_side(const terrain_tiles_header& header, int level)
+  {
+  return 1u << (header.levels - 1 - level);
+  }
+
+uint64_t terrain_tile_index(const terrain_tiles_header& header, int level, int tx, int tz)
+  {
+  uint64_t index = 0;
+  for (int l = 0; l < level; ++l)
+    {
+    const uint64_t n = terrain_tiles_per_side(header, l);
+    index += n * n;
+    }
+  return index + (uint64_t)tz * terrain_tiles_per_side(header, level) + tx;
+  }
+
+uint64_t terrain_tile_count(const terrain_tiles_header& header)
+  {
+  return terrain_tile_index(header, header.levels, 0, 0);
+  }
+
+bool bake_terrain_tiles(const std::string& heightmap_filename, const std::string& tiles_filename, int tile_size, float world_size, float height_scale)
+  {
+  int w, h, nr_of_channels;
+  uint16_t* src = stbi_load_16(heightmap_filename.c_str(), &w, &h, &nr_of_channels, 1);
+  if (src == nullptr)
+    return false;
+
+  terrain_tiles_header header;
+  memcpy(header.magic, "RDTT", 4);
+  header.version = terrain_tiles_version;
+  header.tile_size = (uint32_t)tile_size;
+  header.levels = 1;
+  while ((int)(header.tile_size << (header.levels - 1)) < std::max(w, h) - 1)
+    ++header.levels;
+  header.world_size = world_size;
+  header.height_scale = height_scale;
+
+  // level 0 grid with one sample per heightmap pixel, padded by repeating the border pixels
+  int n = (int)(header.tile_size << (header.levels - 1));
+  std::vector<uint16_t> level((size_t)(n + 1) * (n + 1));
+  parallel_for(0, n + 1, [&](int j)
+    {
+    const int y = std::min(j, h - 1);
+    for (int i = 0; i <= n; ++i)
+      level[(size_t)j * (n + 1) + i] = src[(size_t)y * w + std::min(i, w - 1)];
+    });
+  stbi_image_free(src);
+
+  std::ofstream f(tiles_filename, std::ios::binary);
+  if (!f.is_open())
+    return false;
+  f.write((const char*)&header, sizeof(terrain_tiles_header));
+  std::vector<uint16_t> max_heights(terrain_tile_count(header), 0);
+  f.write((const char*)max_heights.data(), max_heights.size() * sizeof(uint16_t));
+
+  const int ts = tile_size + 1;
+  std::vector<uint16_t> tile((size_t)ts * ts);
+  std::vector<uint16_t> coarse;
+  for (int l = 0; l < (int)header.levels; ++l)
+    {
+    const int tiles = (int)terrain_tiles_per_side(header, l);
+    for (int tz = 0; tz < tiles; ++tz)
+      {
+      for (int tx = 0; tx < tiles; ++tx)
+        {
+        uint16_t m = 0;
+        for (int y = 0; y < ts; ++y)
+          {
+          const uint16_t* row = level.data() + (size_t)(tz * tile_size + y) * (n + 1) + tx * tile_size;
+          memcpy(tile.data() + (size_t)y * ts, row, ts * sizeof(uint16_t));
+          m = std::max(m, *std::max_element(row, row + ts));
+          }
+        max_heights[terrain_tile_index(header, l, tx, tz)] = m;
+        f.write((const char*)tile.data(), tile.size() * sizeof(uint16_t));
+        }
+      }
+    if (l + 1 < (int)header.levels)
+      {
+      downsample(coarse, level, n);
+      level.swap(coarse);
+      n /= 2;
+      }
+    }
+  f.seekp(sizeof(terrain_tiles_header));
+  f.write((const char*)max_heights.data(), max_heights.size() * sizeof(uint16_t));
+  return f.good();
+  }
+
+terrain_tile_streamer::terrain_tile_streamer() : _frame(0), _stop(false)
+  {
+  memset(&_header, 0, sizeof(terrain_tiles_header));
+  }
+
+terrain_tile_streamer::~terrain_tile_streamer()
+  {
+  if (_thread.joinable())
+    {
+      {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+      }
+    _cv.notify_all();
+    _thread.join();
+    }
+  }
+
+bool terrain_tile_streamer::open(RenderDoos::render_engine* engine, const std::string& filename, int cache_slots)
+  {
+  std::ifstream f(filename, std::ios::binary);
+  if (!f.is_open())
+    return false;
+  f.read((char*)&_header, sizeof(terrain_tiles_header));
+  if (!f || memcmp(_header.magic, "RDTT", 4) != 0 || _header.version != terrain_tiles_version || _header.levels == 0)
+    return false;
+  _max_heights.resize(terrain_tile_count(_header));
+  f.read((char*)_max_heights.data(), _max_heights.size() * sizeof(uint16_t));
+  if (!f)
+    return false;
+  _filename = filename;
+
+  const int ts = (int)_header.tile_size + 1;
+  _slots.resize(std::max(cache_slots, 1));
+  for (auto& slot : _slots)
+    {
+    slot.texture_id = engine->add_texture(ts, ts, RenderDoos::texture_format_rgba8, (const uint8_t*)nullptr);
+    slot.index = no_tile;
+    slot.last_used_frame = 0;
+    }
+
+  // the coarsest tile lives in slot 0 and is never evicted
+  loaded_tile root;
+  root.index = terrain_tile_index(_header, _header.levels - 1, 0, 0);
+  if (!_read_tile(root, f))
+    return false;
+  engine->update_texture(_slots[0].texture_id, (uint8_t*)root.texels.data());
+  _slots[0].index = root.index;
+  _resident[root.index] = 0;
+
+  _stop = false;
+  _thread = std::thread(&terrain_tile_streamer::_worker, this);
+  return true;
+  }
+
+void terrain_tile_streamer::close(RenderDoos::render_engine* engine)
+  {
+  if (_thread.joinable())
+    {
+      {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+      }
+    _cv.notify_all();
+    _thread.join();
+    }
+  for (auto& slot : _slots)
+    engine->remove_texture(slot.texture_id);
+  _slots.clear();
+  _resident.clear();
+  _requests.clear();
+  _pending.clear();
+  _finished.clear();
+  }
+
+float terrain_tile_streamer::max_height(int level, int tx, int tz) const
+  {
+  return (float)_max_heights[terrain_tile_index(_header, level, tx, tz)] / 65535.f * _header.height_scale;
+  }
+
+bool terrain_tile_streamer::_read_tile(loaded_tile& tile, std::ifstream& f)
+  {
+  const size_t samples = (size_t)(_header.tile_size + 1) * (_header.tile_size + 1);
+  std::vector<uint16_t> raw(samples);
+  f.seekg((std::streamoff)tile_data_offset(_header, tile.index));
+  f.read((char*)raw.data(), samples * sizeof(uint16_t));
+  if (!f)
+    return false;
+  tile.texels.resize(samples);
+  for (size_t i = 0; i < samples; ++i)
+    tile.texels[i] = (uint32_t)(raw[i] >> 8) | ((uint32_t)(raw[i] & 255) << 8);
+  return true;
+  }
+
+void terrain_tile_streamer::_worker()
+  {
+  std::ifstream f(_filename, std::ios::binary);
+  for (;;)
+    {
+    loaded_tile tile;
+      {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cv.wait(lock, [this]() { return _stop || !_requests.empty(); });
+      if (_stop)
+        return;
+      auto it = _requests.begin();
+      tile.index = it->second.front();
+      it->second.pop_front();
+      if (it->second.empty())
+        _requests.erase(it);
+      }
+    bool ok = _read_tile(tile, f);
+    if (!ok)
+      f.clear();
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (ok)
+      _finished.push_back(std::move(tile));
+    else
+      _pending.erase(tile.index);
+    }
+  }
+
+void terrain_tile_streamer::_request(uint64_t index, int level)
+  {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_pending.insert(index).second)
+    {
+    _requests[level].push_back(index);
+    _cv.notify_one();
+    }
+  }
+
+void terrain_tile_streamer::update(RenderDoos::render_engine* engine, int max_uploads)
+  {
+  ++_frame;
+  std::vector<loaded_tile> uploads;
+    {
+    std::lock_guard<std::mutex> lock(_mutex);
+    // requests that were not picked up yet are dropped, tiles that are still needed get requested again this frame
+    for (const auto& level_requests : _requests)
+      for (uint64_t index : level_requests.second)
+        _pending.erase(index);
+    _requests.clear();
+    const size_t nr_of_uploads = std::min(_finished.size(), (size_t)std::max(max_uploads, 0));
+    for (size_t i = 0; i < nr_of_uploads; ++i)
+      {
+      _pending.erase(_finished[i].index);
+      uploads.push_back(std::move(_finished[i]));
+      }
+    _finished.erase(_finished.begin(), _finished.begin() + nr_of_uploads);
+    }
+  for (auto& tile : uploads)
+    {
+    if (_resident.find(tile.index) != _resident.end())
+      continue;
+    // least recently used slot that was not used last frame, slot 0 holds the coarsest tile
+    size_t best = 0;
+    for (size_t s = 1; s < _slots.size(); ++s)
+      {
+      if (_slots[s].last_used_frame + 1 >= _frame)
+        continue;
+      if (best == 0 || _slots[s].last_used_frame < _slots[best].last_used_frame)
+        best = s;
+      }
+    if (best == 0)
+      break;
+    if (_slots[best].index != no_tile)
+      _resident.erase(_slots[best].index);
+    engine->update_texture(_slots[best].texture_id, (uint8_t*)tile.texels.data());
+    _slots[best].index = tile.index;
+    _slots[best].last_used_frame = _frame;
+    _resident[tile.index] = best;
+    }
+  }
+
+terrain_tile_binding terrain_tile_streamer::acquire(int level, int tx, int tz)
+  {
+  terrain_tile_binding binding;
+  binding.uv_offset[0] = 0.f;
+  binding.uv_offset[1] = 0.f;
+  binding.uv_scale = 1.f;
+  bool requested = false;
+  for (;;)
+    {
+    const uint64_t index = terrain_tile_index(_header, level, tx, tz);
+    auto it = _resident.find(index);
+    if (it != _resident.end())
+      {
+      _slots[it->second].last_used_frame = _frame;
+      binding.texture_id = _slots[it->second].texture_id;
+      return binding;
+      }
+    if (!requested)
+      {
+      _request(index, level);
+      requested = true;
+      }
+    // fall back to the parent tile
+    binding.uv_offset[0] = ((tx & 1) + binding.uv_offset[0]) * 0.5f;
+    binding.uv_offset[1] = ((tz & 1) + binding.uv_offset[1]) * 0.5f;
+    binding.uv_scale *= 0.5f;
+    tx >>= 1;
+    tz >>= 1;
+    ++level;
+    }
+  }
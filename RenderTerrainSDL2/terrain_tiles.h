@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace RenderDoos
+  {
+  class render_engine;
+  }
+
+// Tiled terrain file: a header, a table with the maximum height of every tile, followed by the tiles.
+// Level 0 is the finest level and has 2^(levels-1) x 2^(levels-1) tiles, the last level is a single tile
+// covering the complete terrain. A tile has (tile_size+1) x (tile_size+1) 16 bit height samples: the
+// samples on the border are shared with the neighbouring tiles. Tiles are stored level by level, starting
+// with level 0, in row major order.
+struct terrain_tiles_header
+  {
+  char magic[4];
+  uint32_t version;
+  uint32_t tile_size;
+  uint32_t levels;
+  float world_size;
+  float height_scale;
+  };
+
+uint32_t terrain_tiles_per_side(const terrain_tiles_header& header, int level);
+uint64_t terrain_tile_index(const terrain_tiles_header& header, int level, int tx, int tz);
+uint64_t terrain_tile_count(const terrain_tiles_header& header);
+
+// Converts a (16 bit) heightmap image to a tiled terrain file.
+bool bake_terrain_tiles(const std::string& heightmap_filename, const std::string& tiles_filename, int tile_size, float world_size, float height_scale);
+
+struct terrain_tile_binding
+  {
+  int32_t texture_id;
+  float uv_offset[2]; // position of the requested tile inside the bound tile, in tile units
+  float uv_scale;
+  };
+
+// Streams the tiles of a tiled terrain file into a fixed number of GPU textures.
+// The tile textures are rgba8 with the high and the low byte of the 16 bit heights in red and green, as the
+// heightmap texture (heightmap_texture.h), so a tile upload is half the size of float heights.
+// Tiles are read on a background thread; the render thread uploads finished tiles in update.
+// The coarsest tile is always resident, so acquire always returns a usable (possibly coarser) tile.
+class terrain_tile_streamer
+  {
+  public:
+    terrain_tile_streamer();
+    ~terrain_tile_streamer();
+
+    bool open(RenderDoos::render_engine* engine, const std::string& filename, int cache_slots);
+    void close(RenderDoos::render_engine* engine);
+
+    const terrain_tiles_header& header() const { return _header; }
+    // maximum world height of the tile
+    float max_height(int level, int tx, int tz) const;
+
+    // starts a new frame: uploads at most max_uploads finished tiles
+    void update(RenderDoos::render_engine* engine, int max_uploads);
+    // returns the best resident tile for the requested tile and requests it if it is not resident
+    terrain_tile_binding acquire(int level, int tx, int tz);
+
+  private:
+    struct loaded_tile
+      {
+      uint64_t index;
+      std::vector<uint32_t> texels;
+      };
+
+    struct cache_slot
+      {
+      int32_t texture_id;
+      uint64_t index;
+      uint64_t last_used_frame;
+      };
+
+    void _worker();
+    bool _read_tile(loaded_tile& tile, std::ifstream& f);
+    void _request(uint64_t index, int level);
+
+  private:
+    terrain_tiles_header _header;
+    std::string _filename;
+    std::vector<uint16_t> _max_heights;
+    std::vector<cache_slot> _slots;
+    std::map<uint64_t, size_t> _resident; // tile index -> slot
+    uint64_t _frame;
+
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _stop;
+    std::map<int, std::deque<uint64_t>, std::greater<int>> _requests; // per level, coarse levels first
+    std::set<uint64_t> _pending;
+    std::vector<loaded_tile> _finished;
+  };